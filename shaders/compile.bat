@@ -1,3 +0,0 @@
-G:\VulkanSDK\1.2.131.2\Bin\glslc.exe triangle.vert -o vert.spv
-G:\VulkanSDK\1.2.131.2\Bin\glslc.exe triangle.frag -o frag.spv
-pause
\ No newline at end of file
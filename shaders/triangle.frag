@@ -1,14 +1,30 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+// variant features, see CreateTriangleShaders()
+layout(constant_id = 0) const bool VERTEX_COLOUR = false;
+layout(constant_id = 1) const bool ALPHA_TEST = false;
+
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
 
+// declared whether or not TEXTURED is, so every variant fits the same layout
 layout(binding = 1) uniform sampler2D texSampler;
 
 layout(location = 0) out vec4 outColor;
 
 void main()
 {
-  outColor = texture(texSampler, fragTexCoord);
-}
\ No newline at end of file
+#ifdef TEXTURED
+  vec4 colour = texture(texSampler, fragTexCoord);
+#else
+  vec4 colour = vec4(1.0);
+#endif
+  if (VERTEX_COLOUR) {
+    colour.rgb *= fragColor;
+  }
+  if (ALPHA_TEST && colour.a < 0.5) {
+    discard;
+  }
+  outColor = colour;
+}
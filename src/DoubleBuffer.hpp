@@ -0,0 +1,52 @@
+#pragma once
+#include "common.h"
+
+#include <atomic>
+
+// Hands values from one producer thread to one consumer thread through two slots. The producer fills one while the
+// consumer works through the other, and a side only waits when it has got a whole slot ahead. Each slot's handoff is
+// a single atomic flag, no locks, and the slots are reused so whatever T has allocated is too.
+template <typename T> class DoubleBuffer
+{
+  struct alignas(64) Slot {
+    T mValue;
+    // set by the producer once the value is complete, cleared by the consumer once it's done with it
+    std::atomic<bool> mFull{false};
+  };
+
+  Slot mSlots[2];
+  // only touched by their own side
+  u32 mWriteIndex = 0;
+  u32 mReadIndex = 0;
+
+public:
+  // waits for the consumer to finish with the slot, the value is left as it was for the producer to overwrite
+  NODISCARD T &BeginWrite()
+  {
+    auto &slot = mSlots[mWriteIndex];
+    slot.mFull.wait(true, std::memory_order_acquire);
+    return slot.mValue;
+  }
+  void EndWrite()
+  {
+    auto &slot = mSlots[mWriteIndex];
+    slot.mFull.store(true, std::memory_order_release);
+    slot.mFull.notify_one();
+    mWriteIndex ^= 1;
+  }
+
+  // waits for the producer to publish the slot
+  NODISCARD T &BeginRead()
+  {
+    auto &slot = mSlots[mReadIndex];
+    slot.mFull.wait(false, std::memory_order_acquire);
+    return slot.mValue;
+  }
+  void EndRead()
+  {
+    auto &slot = mSlots[mReadIndex];
+    slot.mFull.store(false, std::memory_order_release);
+    slot.mFull.notify_one();
+    mReadIndex ^= 1;
+  }
+};
@@ -0,0 +1,87 @@
+#include "FramePacer.hpp"
+
+#include "common.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+void FramePacer::WaitForNextFrame(bool focused)
+{
+  if (mLowLatency) {
+    u64 retired = mRetired.load();
+    while (retired < mIssued) {
+      mRetired.wait(retired);
+      retired = mRetired.load();
+    }
+  }
+
+  f64 frameRate = mFrameRate;
+  if (!focused && mUnfocusedFrameRate > 0.0) {
+    frameRate = frameRate > 0.0 ? std::min(frameRate, mUnfocusedFrameRate) : mUnfocusedFrameRate;
+  }
+  if (frameRate <= 0.0) {
+    return;
+  }
+
+  auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<f64>(1.0 / frameRate));
+  auto now = Clock::now();
+  // a frame or more behind, after a hitch or the first time through. Counting on from the missed deadline would run
+  // a burst of unpaced frames to catch up.
+  if (now - mNextFrame > period) {
+    mNextFrame = now + period;
+    return;
+  }
+  if (mNextFrame - now > mSpinMargin) {
+    std::this_thread::sleep_until(mNextFrame - mSpinMargin);
+  }
+  while (Clock::now() < mNextFrame) {
+  }
+  mNextFrame += period;
+}
+
+void FramePacer::FrameSubmitted(Clock::time_point inputTime)
+{
+  auto now = Clock::now();
+  f64 latency = std::chrono::duration<f64, std::milli>(now - inputTime).count();
+  mLatencyCount++;
+  mLatencySum += latency;
+  mLatencyMax = std::max(mLatencyMax, latency);
+
+  if (mLastSubmit != Clock::time_point{}) {
+    f64 interval = std::chrono::duration<f64, std::milli>(now - mLastSubmit).count();
+    mIntervalCount++;
+    f64 delta = interval - mIntervalMean;
+    mIntervalMean += delta / mIntervalCount;
+    mIntervalM2 += delta * (interval - mIntervalMean);
+    mIntervalMax = std::max(mIntervalMax, interval);
+  }
+  mLastSubmit = now;
+}
+
+void FramePacer::FrameRetired()
+{
+  mRetired.fetch_add(1);
+  mRetired.notify_one();
+}
+
+FramePacer::Stats FramePacer::GetStats() const
+{
+  return {
+      .mFrames = mLatencyCount,
+      .mFrameTimeMean = mIntervalMean,
+      .mFrameTimeStdDev = mIntervalCount > 1 ? std::sqrt(mIntervalM2 / (mIntervalCount - 1)) : 0.0,
+      .mFrameTimeMax = mIntervalMax,
+      .mLatencyMean = mLatencyCount ? mLatencySum / mLatencyCount : 0.0,
+      .mLatencyMax = mLatencyMax,
+  };
+}
+
+void FramePacer::PrintStats() const
+{
+  auto stats = GetStats();
+  fmt::print("FramePacer: {} frames, frame time {:.3f} ms +- {:.3f} (max {:.3f}), input to submit {:.3f} ms (max "
+             "{:.3f})\n",
+      stats.mFrames, stats.mFrameTimeMean, stats.mFrameTimeStdDev, stats.mFrameTimeMax, stats.mLatencyMean,
+      stats.mLatencyMax);
+}
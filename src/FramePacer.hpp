@@ -0,0 +1,85 @@
+#pragma once
+#include "common.h"
+
+#include <atomic>
+#include <chrono>
+
+// Decides when the main thread starts a frame, and keeps the numbers needed to tune that.
+//
+//  - A frame rate limit, met by sleeping until shortly before the deadline and spinning the rest of the way. Sleeps
+//    routinely overshoot by a millisecond or more, which shows up directly as frame time jitter.
+//  - A lower limit while the window doesn't have focus.
+//  - A low latency mode that holds the next frame back until the render thread has retired every frame issued so
+//    far, so input is sampled as late as possible instead of queueing up behind frames in flight. Throughput drops to
+//    what one frame at a time gets.
+//
+// Frame times are submit to submit on the render thread, latency is from the main thread sampling input to the frame
+// built from it being submitted.
+class FramePacer
+{
+public:
+  using Clock = std::chrono::high_resolution_clock;
+
+  struct Stats {
+    u64 mFrames = 0;
+    // in ms
+    f64 mFrameTimeMean = 0.0;
+    f64 mFrameTimeStdDev = 0.0;
+    f64 mFrameTimeMax = 0.0;
+    f64 mLatencyMean = 0.0;
+    f64 mLatencyMax = 0.0;
+  };
+
+private:
+  static constexpr f64 sDefaultUnfocusedFrameRate = 30.0;
+  static constexpr auto sDefaultSpinMargin = std::chrono::microseconds(1500);
+
+  // main thread
+  f64 mFrameRate = 0.0;
+  f64 mUnfocusedFrameRate = sDefaultUnfocusedFrameRate;
+  Clock::duration mSpinMargin = sDefaultSpinMargin;
+  bool mLowLatency = false;
+  Clock::time_point mNextFrame = {};
+  u64 mIssued = 0;
+
+  // bumped by the render thread, the main thread waits on it in low latency mode
+  std::atomic<u64> mRetired{0};
+
+  // render thread
+  Clock::time_point mLastSubmit = {};
+  u64 mIntervalCount = 0;
+  // running mean and sum of squared differences from it, Welford's method
+  f64 mIntervalMean = 0.0;
+  f64 mIntervalM2 = 0.0;
+  f64 mIntervalMax = 0.0;
+  u64 mLatencyCount = 0;
+  f64 mLatencySum = 0.0;
+  f64 mLatencyMax = 0.0;
+
+public:
+  // 0 for no limit
+  void SetFrameRate(f64 framesPerSecond) { mFrameRate = framesPerSecond; }
+  NODISCARD f64 GetFrameRate() const { return mFrameRate; }
+  // applies on top of the normal limit, 0 for none
+  void SetUnfocusedFrameRate(f64 framesPerSecond) { mUnfocusedFrameRate = framesPerSecond; }
+  void SetLowLatency(bool enabled) { mLowLatency = enabled; }
+  NODISCARD bool IsLowLatency() const { return mLowLatency; }
+  // how long before the deadline to stop sleeping and start spinning, 0 to only sleep
+  void SetSpinMargin(Clock::duration margin) { mSpinMargin = margin; }
+
+  // Main thread, before input is sampled for the next frame. Waits for the render thread in low latency mode, then
+  // for the frame's slot under the limit.
+  void WaitForNextFrame(bool focused);
+  // main thread, once the frame has been handed to the render thread
+  void FrameIssued() { mIssued++; }
+
+  // render thread, right after the frame is submitted
+  void FrameSubmitted(Clock::time_point inputTime);
+  // Render thread, once it's done with a frame whether or not it was submitted. In low latency mode that should be
+  // after the GPU has finished it.
+  void FrameRetired();
+
+  // only consistent while the render thread isn't running
+  NODISCARD Stats GetStats() const;
+  void PrintStats() const;
+};
@@ -0,0 +1,120 @@
+#pragma once
+#include "common.h"
+
+#include <deque>
+#include <tuple>
+#include <vector>
+
+// A 32 bit reference into a HandlePool, the low bits are the slot and the high bits the slot's generation when the
+// handle was made. Tag only keeps handles from different pools apart, 0 is never handed out and means no handle.
+template <typename Tag> struct Handle {
+  static constexpr u32 sIndexBits = 20;
+  static constexpr u32 sIndexMask = (1u << sIndexBits) - 1;
+  static constexpr u32 sMaxGeneration = (1u << (32 - sIndexBits)) - 1;
+
+  u32 mValue = 0;
+
+  NODISCARD u32 GetIndex() const { return mValue & sIndexMask; }
+  NODISCARD u32 GetGeneration() const { return mValue >> sIndexBits; }
+  NODISCARD bool IsNull() const { return mValue == 0; }
+  bool operator==(const Handle &) const = default;
+};
+
+// Slots for objects referred to by Handle<Tag>, stored as one dense array per field so a lookup that only wants one
+// field only pulls that field into the cache. A slot's generation goes up every time it's created in and every time
+// it's freed, odd while it holds something, so a handle to something destroyed no longer matches its slot and is
+// caught by a single compare instead of reading garbage.
+//
+// Freed slots are reused oldest first, which spreads the generations over every slot instead of burning through one.
+// A slot whose generation runs out is never handed out again rather than wrap around and match stale handles. Not
+// thread safe, lookups from several threads are fine while nothing is created or destroyed.
+template <typename Tag, typename... Fields> class HandlePool
+{
+public:
+  using HandleType = Handle<Tag>;
+
+private:
+  // odd while the slot is live, 0 for slots nothing was ever created in and retired ones
+  std::vector<u16> mGenerations;
+  std::tuple<std::vector<Fields>...> mFields;
+  std::deque<u32> mFreeSlots;
+  u32 mCount = 0;
+  u32 mRetiredSlots = 0;
+
+public:
+  static_assert(HandleType::sMaxGeneration <= 0xffff, "generations are stored in 16 bits");
+
+  NODISCARD HandleType Create(Fields... values)
+  {
+    u32 index;
+    if (!mFreeSlots.empty()) {
+      index = mFreeSlots.front();
+      mFreeSlots.pop_front();
+    } else {
+      index = (u32)mGenerations.size();
+      if (index > HandleType::sIndexMask) {
+        fmt::print("handle pool is out of slots ({})\n", index);
+        assert(0);
+      }
+      mGenerations.push_back(0);
+      std::apply([](auto &...fields) { (fields.emplace_back(), ...); }, mFields);
+    }
+    mGenerations[index]++;
+    std::apply([&](auto &...fields) { ((fields[index] = std::move(values)), ...); }, mFields);
+    mCount++;
+    return {(u32)mGenerations[index] << HandleType::sIndexBits | index};
+  }
+
+  // the fields are left as they were, the caller is expected to have read whatever it needs to clean up
+  void Destroy(HandleType handle)
+  {
+    assert(IsValid(handle));
+    u32 index = handle.GetIndex();
+    mCount--;
+    if (mGenerations[index] == HandleType::sMaxGeneration) {
+      mGenerations[index] = 0;
+      mRetiredSlots++;
+      return;
+    }
+    mGenerations[index]++;
+    mFreeSlots.push_back(index);
+  }
+
+  NODISCARD bool IsValid(HandleType handle) const
+  {
+    u32 index = handle.GetIndex();
+    // even generations are never handed out, that also rules out the null handle
+    return (handle.GetGeneration() & 1) && index < mGenerations.size() && mGenerations[index] == handle.GetGeneration();
+  }
+
+  // the handle must be valid
+  template <u32 Field> NODISCARD auto &Get(HandleType handle)
+  {
+    assert(IsValid(handle));
+    return std::get<Field>(mFields)[handle.GetIndex()];
+  }
+  template <u32 Field> NODISCARD const auto &Get(HandleType handle) const
+  {
+    assert(IsValid(handle));
+    return std::get<Field>(mFields)[handle.GetIndex()];
+  }
+  // nullptr for stale and null handles
+  template <u32 Field> NODISCARD const auto *TryGet(HandleType handle) const
+  {
+    return IsValid(handle) ? &std::get<Field>(mFields)[handle.GetIndex()] : nullptr;
+  }
+
+  // calls func with every live handle, e.g. to destroy whatever is left at shutdown
+  template <typename Func> void ForEach(Func &&func) const
+  {
+    for (u32 index = 0; index < (u32)mGenerations.size(); index++) {
+      if (mGenerations[index] & 1) {
+        func(HandleType{(u32)mGenerations[index] << HandleType::sIndexBits | index});
+      }
+    }
+  }
+
+  NODISCARD u32 GetCount() const { return mCount; }
+  NODISCARD u32 GetCapacity() const { return (u32)mGenerations.size(); }
+  NODISCARD u32 GetRetiredSlotCount() const { return mRetiredSlots; }
+};
@@ -0,0 +1,214 @@
+#include "JobSystem.hpp"
+
+#include "common.h"
+
+#include <algorithm>
+
+// only set on worker threads, everything else pushes to the shared queue 0
+static thread_local const JobSystem *sJobThreadOwner = nullptr;
+static thread_local u32 sJobThreadIndex = 0;
+// set while the thread runs a background job, whatever it queues is background too
+static thread_local bool sJobInBackground = false;
+
+JobSystem::JobSystem(u32 workerCount)
+{
+  if (workerCount == 0) {
+    workerCount = std::max(1u, std::thread::hardware_concurrency()) - 1;
+  }
+  for (u32 i = 0; i < workerCount + 1; i++) {
+    mQueues.push_back(std::make_unique<Queue>());
+  }
+  for (u32 i = 1; i <= workerCount; i++) {
+    mWorkers.emplace_back(&JobSystem::WorkerLoop, this, i);
+  }
+}
+
+JobSystem::~JobSystem()
+{
+  {
+    std::lock_guard lock(mSleepMutex);
+    mQuit = true;
+  }
+  mWake.notify_all();
+  for (auto &worker : mWorkers) {
+    worker.join();
+  }
+}
+
+u32 JobSystem::GetThreadIndex() const
+{
+  return sJobThreadOwner == this ? sJobThreadIndex : 0;
+}
+
+void JobSystem::Run(std::function<void()> func, JobCounter *counter)
+{
+  if (counter) {
+    counter->mValue.fetch_add(1);
+  }
+  Push({std::move(func), counter, sJobInBackground});
+}
+
+void JobSystem::RunBackground(std::function<void()> func, JobCounter *counter)
+{
+  if (counter) {
+    counter->mValue.fetch_add(1);
+  }
+  Push({std::move(func), counter, true});
+}
+
+void JobSystem::RunAfter(JobCounter *dependency, std::function<void()> func, JobCounter *counter)
+{
+  if (counter) {
+    counter->mValue.fetch_add(1);
+  }
+  bool background = sJobInBackground;
+  {
+    // Finish() takes the same lock after the counter hits zero, so the continuation is either seen there or the
+    // zero is seen here
+    std::lock_guard lock(dependency->mMutex);
+    if (dependency->mValue.load() != 0) {
+      dependency->mContinuations.push_back([this, func = std::move(func), counter, background]() mutable {
+        Push({std::move(func), counter, background});
+      });
+      return;
+    }
+  }
+  Push({std::move(func), counter, background});
+}
+
+void JobSystem::Push(Job job)
+{
+  auto &queue = job.mBackground ? mBackground : *mQueues[GetThreadIndex()];
+  {
+    std::lock_guard lock(queue.mMutex);
+    queue.mJobs.push_back(std::move(job));
+  }
+  mQueued.fetch_add(1);
+  // paired with the sleeping worker bumping mSleeping before it checks mQueued, one of the two sees the other
+  if (mSleeping.load() > 0) {
+    std::lock_guard lock(mSleepMutex);
+    mWake.notify_one();
+  }
+}
+
+bool JobSystem::TryRunOne(u32 queueIndex)
+{
+  Job job;
+  bool found = false;
+  {
+    // newest first from our own queue, it's the most likely to still be in cache
+    auto &queue = *mQueues[queueIndex];
+    std::lock_guard lock(queue.mMutex);
+    if (!queue.mJobs.empty()) {
+      job = std::move(queue.mJobs.back());
+      queue.mJobs.pop_back();
+      found = true;
+    }
+  }
+  // oldest first from everyone else, those tend to be the biggest chunks of work
+  for (u32 i = 1; !found && i < mQueues.size(); i++) {
+    auto &queue = *mQueues[(queueIndex + i) % mQueues.size()];
+    std::lock_guard lock(queue.mMutex);
+    if (!queue.mJobs.empty()) {
+      job = std::move(queue.mJobs.front());
+      queue.mJobs.pop_front();
+      found = true;
+    }
+  }
+  if (!found) {
+    return false;
+  }
+
+  Execute(job);
+  return true;
+}
+
+bool JobSystem::TryRunBackground()
+{
+  Job job;
+  {
+    std::lock_guard lock(mBackground.mMutex);
+    if (mBackground.mJobs.empty()) {
+      return false;
+    }
+    job = std::move(mBackground.mJobs.front());
+    mBackground.mJobs.pop_front();
+  }
+  Execute(job);
+  return true;
+}
+
+void JobSystem::Execute(Job &job)
+{
+  mQueued.fetch_sub(1);
+  bool wasInBackground = sJobInBackground;
+  sJobInBackground = job.mBackground;
+  job.mFunc();
+  sJobInBackground = wasInBackground;
+  if (job.mCounter) {
+    Finish(job.mCounter);
+  }
+}
+
+void JobSystem::Finish(JobCounter *counter)
+{
+  counter->mFinishing.fetch_add(1);
+  std::vector<std::function<void()>> continuations;
+  if (counter->mValue.fetch_sub(1) == 1) {
+    std::lock_guard lock(counter->mMutex);
+    continuations.swap(counter->mContinuations);
+  }
+  // last access, the counter may be gone after this
+  counter->mFinishing.fetch_sub(1);
+
+  for (auto &continuation : continuations) {
+    continuation();
+  }
+}
+
+void JobSystem::Wait(JobCounter *counter)
+{
+  // a background job waiting on its own children has to be able to run them, so does a thread with no workers
+  bool background = sJobInBackground || mWorkers.empty();
+  while (!counter->IsDone()) {
+    if (!TryRunOne(GetThreadIndex()) && !(background && TryRunBackground())) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void JobSystem::ParallelFor(u32 count, u32 grainSize, const std::function<void(u32 begin, u32 end)> &func)
+{
+  if (count == 0) {
+    return;
+  }
+  grainSize = std::max(1u, grainSize);
+  if (count <= grainSize) {
+    func(0, count);
+    return;
+  }
+
+  JobCounter counter;
+  // the first chunk is kept for the calling thread, it would only be waiting otherwise
+  for (u32 begin = grainSize; begin < count; begin += grainSize) {
+    u32 end = std::min(count, begin + grainSize);
+    Run([&func, begin, end] { func(begin, end); }, &counter);
+  }
+  func(0, grainSize);
+  Wait(&counter);
+}
+
+void JobSystem::WorkerLoop(u32 index)
+{
+  sJobThreadOwner = this;
+  sJobThreadIndex = index;
+  while (!mQuit.load()) {
+    if (TryRunOne(index) || TryRunBackground()) {
+      continue;
+    }
+    std::unique_lock lock(mSleepMutex);
+    mSleeping.fetch_add(1);
+    mWake.wait(lock, [&] { return mQuit.load() || mQueued.load() > 0; });
+    mSleeping.fetch_sub(1);
+  }
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include "common.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tracks a group of jobs. Run() bumps it when a job is queued and it drops back when the job finishes, jobs
+// queued with RunAfter() start once it reaches zero. Counters must outlive their jobs and shouldn't be reused while
+// continuations are still attached.
+class JobCounter
+{
+  friend class JobSystem;
+
+  std::atomic<u32> mValue{0};
+  // jobs between their decrement and their last touch of the counter, waiters hold off until it's zero too so the
+  // counter can be destroyed as soon as Wait() returns
+  std::atomic<u32> mFinishing{0};
+  std::mutex mMutex;
+  std::vector<std::function<void()>> mContinuations;
+
+public:
+  NODISCARD bool IsDone() const { return mValue.load() == 0 && mFinishing.load() == 0; }
+};
+
+// Work stealing scheduler. Every worker owns a deque it pushes and pops at the back, idle workers steal from the
+// front of the others. Threads that aren't workers (the main thread) share one extra queue.
+//
+// Wait() never blocks outright, the waiting thread runs queued jobs until the counter drains, so it's safe to call
+// from the main thread and from inside jobs without tying up a worker.
+//
+// Background jobs (RunBackground(), and anything a background job queues) have a queue of their own that workers
+// only look at when there's nothing else. Wait() only runs them from inside another background job, or when there
+// are no workers to do it, so a frame waiting on its own jobs never ends up running a shader or pipeline compile.
+class JobSystem
+{
+  struct Job {
+    std::function<void()> mFunc;
+    JobCounter *mCounter;
+    bool mBackground;
+  };
+
+  struct Queue {
+    std::mutex mMutex;
+    std::deque<Job> mJobs;
+  };
+
+  // queue 0 is shared by every thread that isn't a worker, worker i owns queue i
+  std::vector<std::unique_ptr<Queue>> mQueues;
+  // oldest first, shared by everyone
+  Queue mBackground;
+  std::vector<std::thread> mWorkers;
+
+  std::atomic<u32> mQueued{0};
+  std::atomic<u32> mSleeping{0};
+  std::mutex mSleepMutex;
+  std::condition_variable mWake;
+  std::atomic<bool> mQuit{false};
+
+public:
+  // workerCount threads on top of the calling thread, 0 picks one less than the hardware thread count
+  explicit JobSystem(u32 workerCount = 0);
+  ~JobSystem();
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+
+  void Run(std::function<void()> func, JobCounter *counter = nullptr);
+  // for long work nothing is waiting on this frame, e.g. compiles
+  void RunBackground(std::function<void()> func, JobCounter *counter = nullptr);
+  // queues func once dependency reaches zero, counter is bumped straight away so waiting on it covers func too
+  void RunAfter(JobCounter *dependency, std::function<void()> func, JobCounter *counter = nullptr);
+  // runs other jobs until counter reaches zero
+  void Wait(JobCounter *counter);
+
+  // calls func(begin, end) over [0, count) in chunks of about grainSize and waits for all of them
+  void ParallelFor(u32 count, u32 grainSize, const std::function<void(u32 begin, u32 end)> &func);
+
+  // workers plus the calling thread
+  NODISCARD u32 GetThreadCount() const { return (u32)mWorkers.size() + 1; }
+  // index of the queue the current thread pushes to, 0 for threads that aren't workers of this system
+  NODISCARD u32 GetThreadIndex() const;
+
+private:
+  void Push(Job job);
+  NODISCARD bool TryRunOne(u32 queueIndex);
+  NODISCARD bool TryRunBackground();
+  void Execute(Job &job);
+  void Finish(JobCounter *counter);
+  void WorkerLoop(u32 index);
+};
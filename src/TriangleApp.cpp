@@ -1,29 +1,16 @@
 #include "TriangleApp.h"
 
+#include "bench.h"
 #include "stb_image.h"
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <iostream>
+#include <unordered_map>
 #include <unordered_set>
 #include <string>
 #include <vector>
-#include <fstream>
-
-static std::vector<char> ReadFile(const std::string &filename)
-{
-  std::ifstream file(filename, std::ios::ate | std::ios::binary);
-  if (!file.is_open()) {
-    printf("failed to open file\n");
-    assert(0);
-  }
-  u64 fileSize = file.tellg();
-  std::vector<char> buffer(fileSize);
-  file.seekg(0);
-  file.read(buffer.data(), fileSize);
-  file.close();
-  return buffer;
-}
 
 static VKAPI_ATTR VkBool32 VKAPI_CALL DebugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
     VkDebugUtilsMessageTypeFlagBitsEXT messageType, const VkDebugUtilsMessengerCallbackDataEXT *callBackData,
@@ -53,12 +40,42 @@ void DestroyDebugUtilsMessengerEXT(
   }
 }
 
-static void FramebufferResizeCallback(GLFWwindow *window, s32 width, s32 height)
+static void FramebufferResizeCallback(GLFWwindow *window, s32 /*width*/, s32 /*height*/)
 {
   auto app = (TriangleApp *)glfwGetWindowUserPointer(window);
   app->mFramebufferResized = true;
 }
 
+static void KeyCallback(GLFWwindow *window, s32 key, s32 /*scancode*/, s32 action, s32 /*mods*/)
+{
+  auto app = (TriangleApp *)glfwGetWindowUserPointer(window);
+  if (action == GLFW_PRESS) {
+    app->OnKeyPressed(key);
+  }
+}
+
+void TriangleApp::OnKeyPressed(s32 key)
+{
+  if (key >= GLFW_KEY_1 && key <= GLFW_KEY_4) {
+    mFramesInFlightRequest = (u32)(key - GLFW_KEY_1 + 1);
+  } else if (key == GLFW_KEY_P) {
+    static constexpr VkPresentModeKHR modes[] = {VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR,
+        VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR};
+    u32 index = 0;
+    while (index < ArraySize(modes) && modes[index] != mPresentModeSetting) {
+      index++;
+    }
+    mPresentModeSetting = modes[(index + 1) % ArraySize(modes)];
+    fmt::print("present mode requested: {}\n", vk::GetPresentModeName(mPresentModeSetting));
+  } else if (key == GLFW_KEY_L) {
+    mPacer.SetLowLatency(!mPacer.IsLowLatency());
+    fmt::print("low latency mode: {}\n", mPacer.IsLowLatency() ? "on" : "off");
+  } else if (key == GLFW_KEY_F) {
+    mPacer.SetFrameRate(mPacer.GetFrameRate() > 0.0 ? 0.0 : mFrameRateLimit);
+    fmt::print("frame rate limit: {}\n", mPacer.GetFrameRate());
+  }
+}
+
 void TriangleApp::Run()
 {
   InitWindow();
@@ -76,31 +93,72 @@ void TriangleApp::InitWindow()
   glfwSetWindowUserPointer(mWindow, this);
 
   glfwSetFramebufferSizeCallback(mWindow, FramebufferResizeCallback);
+  glfwSetKeyCallback(mWindow, KeyCallback);
+
+  s32 width = 0;
+  s32 height = 0;
+  glfwGetFramebufferSize(mWindow, &width, &height);
+  mFramebufferExtent = {(u32)width, (u32)height};
 }
 void TriangleApp::InitVulkan()
 {
+  mJobs.Run(
+      [this] {
+        s32 channels = 0;
+        mTextureDecode.mPixels = stbi_load("../textures/statue.jpg", &mTextureDecode.mWidth, &mTextureDecode.mHeight,
+            &channels, STBI_rgb_alpha);
+      },
+      &mTextureDecodeCounter);
+  // on a warm start these are only reads from the shader cache
+  mShaderCompiler.Init(&mJobs, "../shaders", "shader_cache");
+  CreateTriangleShaders();
+  mShaderCompiler.CompileAsync({.mPath = "cull.comp"}, &mCullSpirv, &mShaderCounter);
+
   CreateInstance();
   SetupDebugMessenger();
   CreateSurface();
   PickPhysicalDevice();
   CreateLogicalDevice();
+  CreateAllocator();
+  CreateRenderGraph();
+  CreatePipelineCache();
+  ConfigurePacing();
   CreateSwapChain();
   CreateImageViews();
   CreateRenderPass();
+  // layouts come from the shaders now, so they're needed from here on
+  mJobs.Wait(&mShaderCounter);
+  mShaderCompiler.PrintStats();
+  mTriangleShaders.PrintStats();
   CreateDescriptorSetLayout();
-  CreateGraphicsPipeline();
-  CreateFrameBuffers();
-  CreateCommandPool();
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    CreateGraphicsPipeline();
+    auto end = std::chrono::high_resolution_clock::now();
+    fmt::print("pipeline cache: graphics pipeline created in {:.3f} ms ({} cache)\n",
+        std::chrono::duration<f64, std::milli>(end - start).count(), mPipelineCache.IsWarm() ? "warm" : "cold");
+  }
+  CreateUploadManager();
   CreateTextureImage();
   CreateTextureImageView();
   CreateTextureSampler();
   CreateVertexBuffer();
   CreateIndexBuffer();
+  // every upload above was recorded into one batch, the graphics queue side of the hand over is ordered before any
+  // later submission on the graphics queue
+  mUploadManager.Submit();
   CreateUniformBuffers();
   CreateDescriptorPool();
   CreateDescriptorSets();
-  CreateCommandBuffers();
-  CreateSyncObjects();
+  CreateFrameSlots();
+  CreateAsyncCompute();
+  if (auto framesInFlight = getenv("FOCUS_FRAMES_IN_FLIGHT")) {
+    SetFramesInFlight((u32)atoi(framesInFlight));
+  }
+
+  if (BenchmarksEnabled()) {
+    RunBenchmarks();
+  }
 }
 
 void TriangleApp::CreateInstance()
@@ -241,16 +299,28 @@ bool TriangleApp::IsDeviceSuitable(VkPhysicalDevice device)
     auto swapChainSupport = QuerySwapChainSupport(device);
     swapChainAdequate = swapChainSupport.IsAdequate();
   }
-  VkPhysicalDeviceFeatures supportedFeatures;
-  vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
-  return indices.IsComplete() && extensionsSupported && swapChainAdequate && supportedFeatures.samplerAnisotropy;
+  VkPhysicalDeviceVulkan12Features vulkan12Features = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+  };
+  VkPhysicalDeviceFeatures2 supportedFeatures = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+      .pNext = &vulkan12Features,
+  };
+  vkGetPhysicalDeviceFeatures2(device, &supportedFeatures);
+  return indices.IsComplete() && extensionsSupported && swapChainAdequate
+         && supportedFeatures.features.samplerAnisotropy && vulkan12Features.timelineSemaphore;
 }
 
 void TriangleApp::CreateSwapChain()
 {
   auto swapChainSupport = QuerySwapChainSupport(mPhysicalDevice);
   auto surfaceFormat = ChooseSwapSurfaceFormat(swapChainSupport.mFormats);
-  auto presentMode = ChooseSwapPresentMode(swapChainSupport.mPresentModes);
+  auto presentMode = vk::ChoosePresentMode(swapChainSupport.mPresentModes, mPresentMode);
+  if (presentMode != mSwapChainPresentMode) {
+    fmt::print("present mode: {} (asked for {})\n", vk::GetPresentModeName(presentMode),
+        vk::GetPresentModeName(mPresentMode));
+    mSwapChainPresentMode = presentMode;
+  }
   auto extent = ChooseSwapExtent(swapChainSupport.mCapabilities);
 
   u32 imageCount = swapChainSupport.mCapabilities.minImageCount + 1;
@@ -287,7 +357,9 @@ void TriangleApp::CreateSwapChain()
   createInfo.presentMode = presentMode;
   createInfo.clipped = VK_TRUE;
 
-  createInfo.oldSwapchain = VK_NULL_HANDLE;
+  // lets the driver hand resources over from the swap chain being replaced, which stays valid for the frames still
+  // presenting from it
+  createInfo.oldSwapchain = mSwapChain;
 
   if (vkCreateSwapchainKHR(mDevice, &createInfo, nullptr, &mSwapChain) != VK_SUCCESS) {
     printf("Failed to create swap chain\n");
@@ -303,80 +375,91 @@ void TriangleApp::CreateSwapChain()
 
 void TriangleApp::CreateRenderPass()
 {
-  VkAttachmentDescription colorAttachment{};
-  colorAttachment.format = mSwapChainImageFormat;
-  colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-
-  colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-
-  colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-
-  colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-  VkAttachmentReference colorAttachmentRef{};
-  colorAttachmentRef.attachment = 0;
-  colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-  VkSubpassDescription subpass{};
-  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-  subpass.colorAttachmentCount = 1;
-  subpass.pColorAttachments = &colorAttachmentRef;
-
-  VkSubpassDependency dependency{};
-  dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-  dependency.dstSubpass = 0;
-
-  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.srcAccessMask = 0;
-
-  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-  VkRenderPassCreateInfo renderPassInfo{};
-  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-  renderPassInfo.attachmentCount = 1;
-  renderPassInfo.pAttachments = &colorAttachment;
-  renderPassInfo.subpassCount = 1;
-  renderPassInfo.pSubpasses = &subpass;
-
-  renderPassInfo.dependencyCount = 1;
-  renderPassInfo.pDependencies = &dependency;
+  // only used to build the pipeline against, the graph makes the render passes frames actually use
+  mRenderPass = mRenderGraph.GetCompatibleRenderPass({mSwapChainImageFormat});
+}
 
-  if (vkCreateRenderPass(mDevice, &renderPassInfo, nullptr, &mRenderPass) != VK_SUCCESS) {
-    printf("failed to create render pass\n");
-    assert(0);
+void TriangleApp::CreateTriangleShaders()
+{
+  // TEXTURED removes the sample outright, the others are cheap enough to leave to specialization
+  mTriangleShaders.Init("triangle", &mShaderCompiler, &mJobs,
+      {{VK_SHADER_STAGE_VERTEX_BIT, "triangle.vert"}, {VK_SHADER_STAGE_FRAGMENT_BIT, "triangle.frag"}},
+      {
+          {.mName = "TEXTURED", .mKind = vk::FeatureKind::Define, .mStages = VK_SHADER_STAGE_FRAGMENT_BIT},
+          {.mName = "VERTEX_COLOUR", .mKind = vk::FeatureKind::Specialization, .mSpecId = 0},
+          {.mName = "ALPHA_TEST", .mKind = vk::FeatureKind::Specialization, .mSpecId = 1},
+      });
+
+  // comma separated feature names
+  std::vector<std::string> features = {"TEXTURED"};
+  if (auto shaderFeatures = getenv("FOCUS_SHADER_FEATURES")) {
+    features.clear();
+    std::string names = shaderFeatures;
+    for (u64 begin = 0; begin < names.size();) {
+      u64 end = std::min(names.find(',', begin), names.size());
+      if (end > begin) {
+        features.push_back(names.substr(begin, end - begin));
+      }
+      begin = end + 1;
+    }
   }
+  mTriangleVariant = mTriangleShaders.MakeKey(features);
+  mFallbackVariant = mTriangleShaders.MakeKey({"TEXTURED"});
+  fmt::print("triangle shader variant: {}, {} until it's compiled\n", mTriangleShaders.Describe(mTriangleVariant),
+      mTriangleShaders.Describe(mFallbackVariant));
+  // the variant asked for is compiled along with its pipeline
+  mJobs.Run([this] { (void)mTriangleShaders.Get(mFallbackVariant); }, &mShaderCounter);
 }
 
 void TriangleApp::CreateGraphicsPipeline()
 {
-  auto vertShaderCode = ReadFile("../shaders/vert.spv");
-  auto fragShaderCode = ReadFile("../shaders/frag.spv");
-
-  auto vertShaderModule = CreateShaderModule(vertShaderCode);
-  auto fragShaderModule = CreateShaderModule(fragShaderCode);
-
-  VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
-  vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-
-  vertShaderStageInfo.module = vertShaderModule;
-  vertShaderStageInfo.pName = "main";
-
-  VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
-  fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-  fragShaderStageInfo.module = fragShaderModule;
-  fragShaderStageInfo.pName = "main";
+  VkPipelineLayout pipelineLayout = mLayouts.GetPipelineLayout(mGraphicsReflection);
+  // there's nothing to draw with until the fallback is there, so it's the one pipeline still built on the spot
+  VkPipeline pipeline = BuildGraphicsPipeline(mFallbackVariant, pipelineLayout, mRenderPass);
+  if (pipeline == VK_NULL_HANDLE) {
+    assert(0);
+  }
+  mGraphicsPipeline = mResources.AddPipeline(pipeline, pipelineLayout, VK_PIPELINE_BIND_POINT_GRAPHICS);
+  if (mTriangleVariant != mFallbackVariant) {
+    // the render pass is captured rather than read on the worker, it's owned by the render graph and outlives this
+    mTrianglePipeline = mPipelines.CompileAsync(
+        [this, pipelineLayout, renderPass = mRenderPass] {
+          return BuildGraphicsPipeline(mTriangleVariant, pipelineLayout, renderPass);
+        },
+        pipelineLayout, VK_PIPELINE_BIND_POINT_GRAPHICS);
+  }
+}
 
-  VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+VkPipeline TriangleApp::BuildGraphicsPipeline(
+    vk::VariantKey variantKey, VkPipelineLayout pipelineLayout, VkRenderPass renderPass)
+{
+  // a variant that failed to compile is a failed pipeline, its draws stay on the fallback
+  const auto *variant = mTriangleShaders.Get(variantKey);
+  if (!variant) {
+    fmt::print("failed to create graphics pipeline for {}, its shaders didn't compile\n",
+        mTriangleShaders.Describe(variantKey));
+    return VK_NULL_HANDLE;
+  }
+  auto specialization = variant->GetSpecializationInfo();
+  std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+  for (u32 i = 0; i < mTriangleShaders.GetStageCount(); i++) {
+    shaderStages.push_back({
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = mTriangleShaders.GetStage(i),
+        .module = CreateShaderModule(*variant->mSpirv[i]),
+        .pName = "main",
+        .pSpecializationInfo = &specialization,
+    });
+  }
 
-  auto bindingDescription = Vertex::GetBindingDescription();
-  auto attributeDescriptions = Vertex::GetAttributeDescriptions();
+  // the shader's inputs are laid out in location order with no padding, which is what Vertex has to match
+  std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+  VkVertexInputBindingDescription bindingDescription = {
+      .binding = 0,
+      .stride = mGraphicsReflection.GetVertexAttributes(0, &attributeDescriptions),
+      .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+  };
+  passert("vertex shader inputs don't match Vertex\n", (bindingDescription.stride == sizeof(Vertex)));
 
   VkPipelineVertexInputStateCreateInfo vertexInpuInfo{};
   vertexInpuInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
@@ -390,24 +473,20 @@ void TriangleApp::CreateGraphicsPipeline()
   inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
   inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-  VkViewport viewport{};
-  viewport.x = 0.0f;
-  viewport.y = 0.0f;
-  viewport.width = (f32)mSwapChainExtent.width;
-  viewport.height = (f32)mSwapChainExtent.height;
-  viewport.minDepth = 0.0f;
-  viewport.maxDepth = 1.0f;
-
-  VkRect2D scissor{};
-  scissor.offset = {0, 0};
-  scissor.extent = mSwapChainExtent;
-
+  // viewport and scissor are set when recording so the pipeline doesn't depend on the swap chain extent and
+  // survives window resizes
   VkPipelineViewportStateCreateInfo viewportState{};
   viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
   viewportState.viewportCount = 1;
-  viewportState.pViewports = &viewport;
+  viewportState.pViewports = nullptr;
   viewportState.scissorCount = 1;
-  viewportState.pScissors = &scissor;
+  viewportState.pScissors = nullptr;
+
+  VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+  VkPipelineDynamicStateCreateInfo dynamicState{};
+  dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamicState.dynamicStateCount = (u32)ArraySize(dynamicStates);
+  dynamicState.pDynamicStates = dynamicStates;
 
   VkPipelineRasterizationStateCreateInfo rasterizer{};
   rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -453,22 +532,10 @@ void TriangleApp::CreateGraphicsPipeline()
   colorBlending.blendConstants[2] = 0.0f;
   colorBlending.blendConstants[3] = 0.0f;
 
-  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-
-  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-  pipelineLayoutInfo.setLayoutCount = 1;
-  pipelineLayoutInfo.pSetLayouts = &mDescriptorSetLayout;
-  pipelineLayoutInfo.pushConstantRangeCount = 0;
-  pipelineLayoutInfo.pPushConstantRanges = nullptr;
-  if (vkCreatePipelineLayout(mDevice, &pipelineLayoutInfo, nullptr, &mPipelineLayout) != VK_SUCCESS) {
-    printf("failed to create pipeline layout\n");
-    assert(0);
-  }
-
   VkGraphicsPipelineCreateInfo pipelineInfo{};
   pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-  pipelineInfo.stageCount = 2;
-  pipelineInfo.pStages = shaderStages;
+  pipelineInfo.stageCount = (u32)shaderStages.size();
+  pipelineInfo.pStages = shaderStages.data();
 
   pipelineInfo.pVertexInputState = &vertexInpuInfo;
   pipelineInfo.pInputAssemblyState = &inputAssembly;
@@ -477,23 +544,26 @@ void TriangleApp::CreateGraphicsPipeline()
   pipelineInfo.pMultisampleState = &multisampling;
   pipelineInfo.pDepthStencilState = nullptr;
   pipelineInfo.pColorBlendState = &colorBlending;
-  pipelineInfo.pDynamicState = nullptr;
+  pipelineInfo.pDynamicState = &dynamicState;
 
-  pipelineInfo.layout = mPipelineLayout;
+  pipelineInfo.layout = pipelineLayout;
 
-  pipelineInfo.renderPass = mRenderPass;
+  pipelineInfo.renderPass = renderPass;
   pipelineInfo.subpass = 0;
 
   pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
   pipelineInfo.basePipelineIndex = -1;
 
-  if (vkCreateGraphicsPipelines(mDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &mGraphicsPipeline) != VK_SUCCESS) {
-    printf("failed to create grpahics pipeline\n");
-    assert(0);
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  if (vkCreateGraphicsPipelines(mDevice, mPipelineCache.Get(), 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+    fmt::print("failed to create graphics pipeline for {}\n", mTriangleShaders.Describe(variantKey));
+    pipeline = VK_NULL_HANDLE;
   }
 
-  vkDestroyShaderModule(mDevice, fragShaderModule, nullptr);
-  vkDestroyShaderModule(mDevice, vertShaderModule, nullptr);
+  for (const auto &stage : shaderStages) {
+    vkDestroyShaderModule(mDevice, stage.module, nullptr);
+  }
+  return pipeline;
 }
 
 VkShaderModule TriangleApp::CreateShaderModule(const std::vector<char> &code)
@@ -574,34 +644,62 @@ TriangleApp::QueueFamilyIndices TriangleApp::FindQueueFamilies(VkPhysicalDevice
     i++;
   }
 
+  indices.mFamilyCount = queueFamilyCount;
+  if (indices.mGraphicsFamily.has_value()) {
+    indices.mTransfer = vk::SelectTransferQueue(queueFamilies, *indices.mGraphicsFamily);
+    indices.mCompute = vk::SelectComputeQueue(queueFamilies, *indices.mGraphicsFamily, indices.mTransfer);
+  }
   return indices;
 }
 void TriangleApp::CreateLogicalDevice()
 {
   auto indices = FindQueueFamilies(mPhysicalDevice);
   std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-  std::unordered_set<u32> uniqueQueueFamilies = {*indices.mGraphicsFamily, *indices.mPresentFamily};
-
-  f32 queuePriority = 1.0f;
-  for (auto queueFamily : uniqueQueueFamilies) {
+  auto queueCounts = vk::CountQueuesPerFamily(indices.mFamilyCount,
+      {{*indices.mGraphicsFamily, 0}, {*indices.mPresentFamily, 0}, indices.mTransfer, indices.mCompute});
+
+  // at most three queues come from one family (graphics + transfer + compute)
+  f32 queuePriorities[] = {1.0f, 1.0f, 1.0f};
+  for (u32 queueFamily = 0; queueFamily < queueCounts.size(); queueFamily++) {
+    if (queueCounts[queueFamily] == 0) {
+      continue;
+    }
     VkDeviceQueueCreateInfo queueCreateInfo = {};
     queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
     queueCreateInfo.queueFamilyIndex = queueFamily;
-    queueCreateInfo.queueCount = 1;
-    queueCreateInfo.pQueuePriorities = &queuePriority;
+    queueCreateInfo.queueCount = queueCounts[queueFamily];
+    queueCreateInfo.pQueuePriorities = queuePriorities;
     queueCreateInfos.push_back(queueCreateInfo);
   }
 
   VkPhysicalDeviceFeatures deviceFeatures = {};
   deviceFeatures.samplerAnisotropy = VK_TRUE;
+  // culled draws go out a recording range at a time with it, one indirect draw each without
+  VkPhysicalDeviceFeatures supportedFeatures;
+  vkGetPhysicalDeviceFeatures(mPhysicalDevice, &supportedFeatures);
+  if (supportedFeatures.multiDrawIndirect) {
+    deviceFeatures.multiDrawIndirect = VK_TRUE;
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(mPhysicalDevice, &properties);
+    mMaxDrawIndirectCount = std::max(1u, properties.limits.maxDrawIndirectCount);
+  }
 
   VkDeviceCreateInfo createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
   createInfo.queueCreateInfoCount = (u32)queueCreateInfos.size();
   createInfo.pQueueCreateInfos = queueCreateInfos.data();
   createInfo.pEnabledFeatures = &deviceFeatures;
-  createInfo.enabledExtensionCount = (u32)mDeviceExtensions.size();
-  createInfo.ppEnabledExtensionNames = mDeviceExtensions.data();
+  // all queue synchronisation goes through timeline semaphores
+  VkPhysicalDeviceVulkan12Features vulkan12Features = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+      .timelineSemaphore = VK_TRUE,
+  };
+  // optional extensions are only added when the device has them
+  std::vector<const char *> extensions = mDeviceExtensions;
+  mHostImageCopy = vk::HostImageCopy(mPhysicalDevice);
+  createInfo.pNext = mHostImageCopy.Enable(&extensions, &vulkan12Features);
+  createInfo.enabledExtensionCount = (u32)extensions.size();
+  createInfo.ppEnabledExtensionNames = extensions.data();
   if (mEnableValidationLayers) {
     createInfo.enabledLayerCount = (u32)mValidationLayers.size();
     createInfo.ppEnabledLayerNames = mValidationLayers.data();
@@ -615,6 +713,38 @@ void TriangleApp::CreateLogicalDevice()
 
   vkGetDeviceQueue(mDevice, *indices.mGraphicsFamily, 0, &mGraphicsQueue);
   vkGetDeviceQueue(mDevice, *indices.mPresentFamily, 0, &mPresentQueue);
+  vkGetDeviceQueue(mDevice, indices.mTransfer.mFamily, indices.mTransfer.mIndex, &mTransferQueue);
+  vkGetDeviceQueue(mDevice, indices.mCompute.mFamily, indices.mCompute.mIndex, &mComputeQueue);
+  mGraphicsTimeline = vk::Timeline(mDevice);
+  mGraphicsSubmits = vk::SubmitBatch(mGraphicsQueue);
+  if (mTransferQueue != mGraphicsQueue) {
+    mTransferTimeline = vk::Timeline(mDevice);
+    mTransferSubmits = vk::SubmitBatch(mTransferQueue);
+  }
+  if (mComputeQueue != mGraphicsQueue) {
+    mComputeTimeline = vk::Timeline(mDevice);
+    mComputeSubmits = vk::SubmitBatch(mComputeQueue);
+  }
+  mHostImageCopy.Init(mDevice);
+}
+
+void TriangleApp::CreateAllocator()
+{
+  mAllocator = vk::Allocator(mPhysicalDevice, mDevice);
+  mDeletionQueue = vk::DeletionQueue(mDevice, &mAllocator);
+  mResources = vk::ResourceRegistry(mDevice, &mAllocator, &mDeletionQueue);
+}
+
+void TriangleApp::CreateRenderGraph()
+{
+  mRenderGraph = vk::RenderGraph(mDevice, &mAllocator, &mGraphicsTimeline, &mDeletionQueue);
+}
+
+void TriangleApp::CreatePipelineCache()
+{
+  mPipelineCache = vk::PipelineCache(mPhysicalDevice, mDevice, "pipeline_cache.bin");
+  mLayouts = vk::LayoutCache(mDevice);
+  mPipelines.Init(mDevice, &mJobs, &mResources);
 }
 
 void TriangleApp::CreateSurface()
@@ -636,14 +766,24 @@ VkSurfaceFormatKHR TriangleApp::ChooseSwapSurfaceFormat(const std::vector<VkSurf
   return availableFormats[0];
 }
 
-VkPresentModeKHR TriangleApp::ChooseSwapPresentMode(const std::vector<VkPresentModeKHR> &availablePresentModes)
+void TriangleApp::ConfigurePacing()
 {
-  for (const auto &availablePresentMode : availablePresentModes) {
-    if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-      return availablePresentMode;
+  if (auto presentMode = getenv("FOCUS_PRESENT_MODE")) {
+    auto mode = vk::ParsePresentMode(presentMode);
+    if (mode != VK_PRESENT_MODE_MAX_ENUM_KHR) {
+      mPresentMode = mode;
+      mPresentModeSetting = mode;
+    } else {
+      fmt::print("unknown present mode {}, expected immediate, mailbox, fifo or fifo_relaxed\n", presentMode);
     }
   }
-  return VK_PRESENT_MODE_FIFO_KHR;
+  if (auto frameRateLimit = getenv("FOCUS_FRAME_RATE_LIMIT")) {
+    mFrameRateLimit = std::max(0.0, atof(frameRateLimit));
+    mPacer.SetFrameRate(mFrameRateLimit);
+  }
+  if (auto lowLatency = getenv("FOCUS_LOW_LATENCY")) {
+    mPacer.SetLowLatency(atoi(lowLatency) != 0);
+  }
 }
 
 VkExtent2D TriangleApp::ChooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabilities)
@@ -651,10 +791,8 @@ VkExtent2D TriangleApp::ChooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabil
   if (capabilities.currentExtent.width != UINT32_MAX) {
     return capabilities.currentExtent;
   } else {
-    s32 width = 0;
-    s32 height = 0;
-    glfwGetFramebufferSize(mWindow, &width, &height);
-    VkExtent2D actualExtent = {(u32)width, (u32)height};
+    // GLFW is main thread only, this is the size the render command list was built for
+    VkExtent2D actualExtent = mFramebufferExtent;
     actualExtent.width =
         std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
     actualExtent.height =
@@ -670,194 +808,513 @@ void TriangleApp::CreateImageViews()
   }
 }
 
-void TriangleApp::CreateFrameBuffers()
+void TriangleApp::CreateUploadManager()
 {
-  mSwapChainFramebuffers.resize(mSwapChainImageViews.size());
-  for (u64 i = 0; i < mSwapChainImageViews.size(); i++) {
-    VkImageView attachments[] = {mSwapChainImageViews[i]};
+  QueueFamilyIndices queueFamilyIndices = FindQueueFamilies(mPhysicalDevice);
+  mUploadManager = vk::UploadManager(mDevice, queueFamilyIndices.mTransfer.mFamily, mTransferQueue,
+      *queueFamilyIndices.mGraphicsFamily, mGraphicsQueue,
+      mTransferTimeline.IsValid() ? &mTransferTimeline : &mGraphicsTimeline, &mGraphicsTimeline,
+      mTransferSubmits.IsValid() ? &mTransferSubmits : &mGraphicsSubmits, &mGraphicsSubmits, &mAllocator);
+}
 
-    VkFramebufferCreateInfo framebufferInfo{};
-    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-    framebufferInfo.renderPass = mRenderPass;
-    framebufferInfo.attachmentCount = 1;
-    framebufferInfo.pAttachments = attachments;
-    framebufferInfo.width = mSwapChainExtent.width;
-    framebufferInfo.height = mSwapChainExtent.height;
-    framebufferInfo.layers = 1;
+void TriangleApp::RecreateSwapChain()
+{
+  // The main thread stops handing out frames while the window is minimised, but a list it handed over just before
+  // can still get here. There's no creating a 0x0 swap chain, so the old one is kept and DrawFrame drops frames and
+  // retries until the surface has a size again.
+  VkSurfaceCapabilitiesKHR capabilities;
+  vkGetPhysicalDeviceSurfaceCapabilitiesKHR(mPhysicalDevice, mSurface, &capabilities);
+  VkExtent2D extent = ChooseSwapExtent(capabilities);
+  mSwapChainDeferred = extent.width == 0 || extent.height == 0;
+  if (mSwapChainDeferred) {
+    return;
+  }
+  auto start = std::chrono::high_resolution_clock::now();
+
+  // Frames already submitted keep presenting from the old swap chain, so instead of draining the device everything
+  // that wraps its images goes to the deletion queue with the last frame submitted. The pipeline, render pass,
+  // descriptors and frame slots don't depend on the swap chain and carry over. The graph's framebuffers wrap the old
+  // views and go with them.
+  // Presents don't signal the timeline, the submission before them is the closest thing there is. By the time the
+  // timeline passes the last frame rendered to the old swap chain, its presents have been queued behind that frame's
+  // semaphore.
+  u64 retireValue = mGraphicsTimeline.GetLastSignaled();
+  mRenderGraph.ReleaseFramebuffers();
+  for (auto imageView : mSwapChainImageViews) {
+    mDeletionQueue.ImageView(&mGraphicsTimeline, retireValue, imageView);
+  }
+  mDeletionQueue.SwapChain(&mGraphicsTimeline, retireValue, mSwapChain);
+  VkFormat oldFormat = mSwapChainImageFormat;
+  CreateSwapChain();
+  CreateImageViews();
 
-    if (vkCreateFramebuffer(mDevice, &framebufferInfo, nullptr, &mSwapChainFramebuffers[i]) != VK_SUCCESS) {
-      printf("failed to create frame buffer");
-      assert(0);
-    }
+  // surface formats basically never change on a resize, but the render pass is only compatible with the old one
+  if (mSwapChainImageFormat != oldFormat) {
+    mResources.Destroy(mGraphicsPipeline, &mGraphicsTimeline, retireValue);
+    mPipelines.Destroy(mTrianglePipeline, &mGraphicsTimeline, retireValue);
+    CreateRenderPass();
+    CreateGraphicsPipeline();
+    // only writes anything if the rebuild added to the cache
+    mPipelineCache.Save();
   }
+
+  auto end = std::chrono::high_resolution_clock::now();
+  fmt::print("swap chain recreated in {:.3f} ms ({}x{})\n", std::chrono::duration<f64, std::milli>(end - start).count(),
+      mSwapChainExtent.width, mSwapChainExtent.height);
 }
-void TriangleApp::CreateCommandPool()
+
+void TriangleApp::CreateFrameSlots()
 {
   QueueFamilyIndices queueFamilyIndices = FindQueueFamilies(mPhysicalDevice);
-  VkCommandPoolCreateInfo poolInfo{};
-  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-  poolInfo.queueFamilyIndex = *queueFamilyIndices.mGraphicsFamily;
-  poolInfo.flags = 0;
+  mFrames.resize(MAX_FRAMES_IN_FLIGHT);
+  for (auto &frame : mFrames) {
+    // the command buffer is re-recorded every time the slot comes round, resetting the whole pool is the cheapest
+    // way to recycle it
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = *queueFamilyIndices.mGraphicsFamily;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    if (vkCreateCommandPool(mDevice, &poolInfo, nullptr, &frame.mCommandPool) != VK_SUCCESS) {
+      printf("failed to create command pool\n");
+      assert(0);
+    }
 
-  if (vkCreateCommandPool(mDevice, &poolInfo, nullptr, &mCommandPool) != VK_SUCCESS) {
-    printf("failed to create command pool\n");
-    assert(0);
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = frame.mCommandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    if (vkAllocateCommandBuffers(mDevice, &allocInfo, &frame.mCommandBuffer) != VK_SUCCESS) {
+      printf("failed to allocate command buffers\n");
+      assert(0);
+    }
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    if (vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &frame.mImageAvailable) != VK_SUCCESS
+        || vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &frame.mRenderFinished) != VK_SUCCESS) {
+      printf("failed to create semaphores\n");
+      assert(0);
+    }
+  }
+
+  mRecorder = vk::ParallelRecorder(mDevice, *queueFamilyIndices.mGraphicsFamily, MAX_FRAMES_IN_FLIGHT, &mJobs);
+  if (auto drawCount = getenv("FOCUS_DRAW_COUNT")) {
+    mDrawCount = (u32)std::max(1, atoi(drawCount));
   }
 }
 
-void TriangleApp::RecreateSwapChain()
+void TriangleApp::DestroyFrameSlots()
 {
-  s32 width = 0;
-  s32 height = 0;
-  glfwGetFramebufferSize(mWindow, &width, &height);
-  while (width == 0 || height == 0) {
-    glfwGetFramebufferSize(mWindow, &width, &height);
-    glfwWaitEvents();
+  mRecorder.Destroy();
+  for (auto &frame : mFrames) {
+    if (frame.mPacketCapacity != 0) {
+      vkDestroyBuffer(mDevice, frame.mPacketBuffer, nullptr);
+      mAllocator.Free(frame.mPacketAllocation);
+      vkDestroyBuffer(mDevice, frame.mIndirectBuffer, nullptr);
+      mAllocator.Free(frame.mIndirectAllocation);
+    }
+    vkDestroySemaphore(mDevice, frame.mRenderFinished, nullptr);
+    vkDestroySemaphore(mDevice, frame.mImageAvailable, nullptr);
+    vkDestroyCommandPool(mDevice, frame.mCommandPool, nullptr);
   }
+  mFrames.clear();
+}
 
-  vkDeviceWaitIdle(mDevice);
-
-  CleanupSwapChain();
+void TriangleApp::SetFramesInFlight(u32 count)
+{
+  // Every slot keeps its own resources whether it's in use or not, so nothing has to be drained or rebuilt. Slots
+  // dropped out of the rotation finish on their own and are waited on as usual if they come back.
+  mFramesInFlight = std::clamp(count, 1u, MAX_FRAMES_IN_FLIGHT);
+  mCurrentFrame %= mFramesInFlight;
+  fmt::print("frames in flight: {}\n", mFramesInFlight);
+}
 
-  CreateSwapChain();
-  CreateImageViews();
-  CreateRenderPass();
-  CreateGraphicsPipeline();
-  CreateFrameBuffers();
-  CreateUniformBuffers();
-  CreateDescriptorPool();
-  CreateDescriptorSets();
-  CreateCommandBuffers();
+void TriangleApp::CreateAsyncCompute()
+{
+  QueueFamilyIndices queueFamilyIndices = FindQueueFamilies(mPhysicalDevice);
+  bool async = mComputeQueue != mGraphicsQueue;
+  mAsyncCompute = vk::AsyncCompute(mDevice, queueFamilyIndices.mCompute.mFamily, mComputeQueue, mGraphicsQueue,
+      async ? &mComputeTimeline : &mGraphicsTimeline, &mGraphicsTimeline,
+      async ? &mComputeSubmits : &mGraphicsSubmits, MAX_FRAMES_IN_FLIGHT);
+  fmt::print("async compute: {}\n",
+      async ? fmt::format("family {} queue {}", queueFamilyIndices.mCompute.mFamily, queueFamilyIndices.mCompute.mIndex)
+            : "sharing the graphics queue");
+  CreateCullPipeline();
+  if (auto gpuCulling = getenv("FOCUS_GPU_CULLING")) {
+    mGpuCulling = atoi(gpuCulling) != 0;
+  }
 }
 
-void TriangleApp::CreateCommandBuffers()
+// matches the push constants in cull.comp
+struct CullConstants
 {
-  mCommandBuffers.resize(mSwapChainFramebuffers.size());
+  glm::vec4 mPlanes[6];
+  glm::vec4 mBounds;
+  u32 mPacketCount;
+};
 
-  VkCommandBufferAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.commandPool = mCommandPool;
-  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandBufferCount = (u32)mCommandBuffers.size();
+void TriangleApp::CreateCullPipeline()
+{
+  auto reflection = vk::ReflectShader(mCullSpirv);
+  passert("cull.comp's push constants don't match CullConstants\n",
+      (reflection.mPushConstants.size == sizeof(CullConstants)));
+  mCullGroupSize = reflection.mLocalSize[0];
+  mCullSetLayout = mLayouts.GetSetLayout(reflection.mSets[0]);
+  VkPipelineLayout pipelineLayout = mLayouts.GetPipelineLayout(reflection);
+  mCullPipeline = mResources.AddPipeline(
+      vk::CreateComputePipeline(mDevice, mPipelineCache.Get(), pipelineLayout, mCullSpirv), pipelineLayout,
+      VK_PIPELINE_BIND_POINT_COMPUTE);
+
+  // one set per frame slot, each pointing at the slot's packet and indirect buffers
+  auto poolSizes = reflection.GetPoolSizes(0, MAX_FRAMES_IN_FLIGHT);
+  VkDescriptorPoolCreateInfo poolInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+      .maxSets = MAX_FRAMES_IN_FLIGHT,
+      .poolSizeCount = (u32)poolSizes.size(),
+      .pPoolSizes = poolSizes.data(),
+  };
+  assert(vkCreateDescriptorPool(mDevice, &poolInfo, nullptr, &mCullDescriptorPool) == VK_SUCCESS);
 
-  if (vkAllocateCommandBuffers(mDevice, &allocInfo, mCommandBuffers.data()) != VK_SUCCESS) {
-    printf("failed to allocate command buffers\n");
-    assert(0);
+  // every packet draws the same quad, so one sphere around its vertices bounds them all
+  glm::vec2 centre = {};
+  for (const auto &vertex : vertices) {
+    centre += vertex.mPos / (f32)vertices.size();
+  }
+  f32 radius = 0.0f;
+  for (const auto &vertex : vertices) {
+    radius = std::max(radius, glm::length(vertex.mPos - centre));
   }
+  mSceneBounds = {centre, 0.0f, radius};
+}
 
-  for (u64 i = 0; i < mCommandBuffers.size(); i++) {
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = 0;
-    beginInfo.pInheritanceInfo = nullptr;
-    if (vkBeginCommandBuffer(mCommandBuffers[i], &beginInfo) != VK_SUCCESS) {
-      printf("failed to begin recording command buffer\n");
-      assert(0);
-    }
-    VkRenderPassBeginInfo renderPassInfo{};
-    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassInfo.renderPass = mRenderPass;
-    renderPassInfo.framebuffer = mSwapChainFramebuffers[i];
-
-    renderPassInfo.renderArea.offset = {0, 0};
-    renderPassInfo.renderArea.extent = mSwapChainExtent;
-
-    VkClearValue clearColor{0.0f, 0.0f, 0.0f, 1.0f};
-    renderPassInfo.clearValueCount = 1;
-    renderPassInfo.pClearValues = &clearColor;
-    vkCmdBeginRenderPass(mCommandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdBindPipeline(mCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, mGraphicsPipeline);
-
-    VkBuffer vertexBuffers[] = {mVertexBuffer};
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(mCommandBuffers[i], 0, 1, vertexBuffers, offsets);
-    vkCmdBindIndexBuffer(mCommandBuffers[i], mIndexBuffer, 0, VK_INDEX_TYPE_UINT16);
-
-    vkCmdBindDescriptorSets(
-        mCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, mPipelineLayout, 0, 1, &mDescriptorSets[i], 0, nullptr);
-
-    vkCmdDrawIndexed(mCommandBuffers[i], (u32)indices.size(), 1, 0, 0, 0);
-    vkCmdEndRenderPass(mCommandBuffers[i]);
-    if (vkEndCommandBuffer(mCommandBuffers[i]) != VK_SUCCESS) {
-      printf("failed to record command buffer\n");
-      assert(0);
-    }
+void TriangleApp::ReserveCullBuffers(FrameSlot *frame, u32 packetCount)
+{
+  if (packetCount <= frame->mPacketCapacity) {
+    return;
+  }
+  // the graphics frame that last drew from them also waited on the dispatch that filled them
+  if (frame->mPacketCapacity != 0) {
+    mDeletionQueue.Buffer(&mGraphicsTimeline, frame->mSubmitted, frame->mPacketBuffer, frame->mPacketAllocation);
+    mDeletionQueue.Buffer(&mGraphicsTimeline, frame->mSubmitted, frame->mIndirectBuffer, frame->mIndirectAllocation);
+  }
+  frame->mPacketCapacity = std::max({packetCount, 2 * frame->mPacketCapacity, 256u});
+
+  // the packets are only read by the compute queue, the commands are written there and read by the graphics queue
+  std::vector<u32> sharedFamilies;
+  u32 graphicsFamily = *FindQueueFamilies(mPhysicalDevice).mGraphicsFamily;
+  if (graphicsFamily != mAsyncCompute.GetFamily()) {
+    sharedFamilies = {graphicsFamily, mAsyncCompute.GetFamily()};
+  }
+  CreateBuffer(frame->mPacketCapacity * sizeof(DrawPacket), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &frame->mPacketBuffer,
+      &frame->mPacketAllocation);
+  CreateBuffer(frame->mPacketCapacity * sizeof(VkDrawIndexedIndirectCommand),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      &frame->mIndirectBuffer, &frame->mIndirectAllocation, sharedFamilies);
+
+  if (frame->mCullDescriptorSet == VK_NULL_HANDLE) {
+    VkDescriptorSetAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = mCullDescriptorPool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &mCullSetLayout,
+    };
+    assert(vkAllocateDescriptorSets(mDevice, &allocInfo, &frame->mCullDescriptorSet) == VK_SUCCESS);
+  }
+  VkDescriptorBufferInfo bufferInfos[] = {
+      {frame->mPacketBuffer, 0, VK_WHOLE_SIZE},
+      {frame->mIndirectBuffer, 0, VK_WHOLE_SIZE},
+  };
+  std::array<VkWriteDescriptorSet, 2> writes = {};
+  for (u32 i = 0; i < writes.size(); i++) {
+    writes[i] = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = frame->mCullDescriptorSet,
+        .dstBinding = i,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .pBufferInfo = &bufferInfos[i],
+    };
   }
+  vkUpdateDescriptorSets(mDevice, (u32)writes.size(), writes.data(), 0, nullptr);
 }
 
-void TriangleApp::CreateSyncObjects()
+void TriangleApp::DispatchCulling(u32 frameSlot, const UniformBufferObject &camera,
+    const std::vector<DrawPacket> &packets)
 {
-  mImageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-  mRenderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-  mInFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-  mImagesInFlight.resize(mSwapChainImages.size(), VK_NULL_HANDLE);
+  auto &frame = mFrames[frameSlot];
+  if (packets.empty()) {
+    return;
+  }
+  VkCommandBuffer commandBuffer = mAsyncCompute.Begin(frameSlot);
+  ReserveCullBuffers(&frame, (u32)packets.size());
+  memcpy(frame.mPacketAllocation.mMapped, packets.data(), packets.size() * sizeof(DrawPacket));
+
+  // Vulkan's clip volume pulled back into model space, -w <= x, y <= w and 0 <= z <= w. Rows of the matrix are
+  // columns of its transpose, glm is column major.
+  glm::mat4 transform = glm::transpose(camera.mProj * camera.mView * camera.mModel);
+  CullConstants constants = {
+      .mPlanes =
+          {
+              transform[3] + transform[0],
+              transform[3] - transform[0],
+              transform[3] + transform[1],
+              transform[3] - transform[1],
+              transform[2],
+              transform[3] - transform[2],
+          },
+      .mBounds = mSceneBounds,
+      .mPacketCount = (u32)packets.size(),
+  };
+  for (auto &plane : constants.mPlanes) {
+    plane /= glm::length(glm::vec3(plane));
+  }
 
-  VkSemaphoreCreateInfo semaphoreInfo{};
-  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  VkPipelineLayout cullLayout = mResources.GetPipelineLayout(mCullPipeline);
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, mResources.GetPipeline(mCullPipeline));
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullLayout, 0, 1, &frame.mCullDescriptorSet,
+      0, nullptr);
+  vkCmdPushConstants(commandBuffer, cullLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+  vkCmdDispatch(commandBuffer, ((u32)packets.size() + mCullGroupSize - 1) / mCullGroupSize, 1, 1);
 
-  VkFenceCreateInfo fenceInfo{};
-  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-  fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-  for (u64 i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    if (vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &mImageAvailableSemaphores[i]) != VK_SUCCESS
-        || vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &mRenderFinishedSemaphores[i]) != VK_SUCCESS
-        || vkCreateFence(mDevice, &fenceInfo, nullptr, &mInFlightFences[i]) != VK_SUCCESS) {
-      printf("failed to create semaphores\n");
-      assert(0);
-    }
+  // the slot's previous frame drew from the commands being overwritten, it's normally long done
+  frame.mCulled = mAsyncCompute.Submit(frame.mSubmitted, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+}
+
+void TriangleApp::RecordCommandBuffer(VkCommandBuffer commandBuffer, VkImage target, VkImageView targetView,
+    VkExtent2D extent, VkImageLayout finalLayout, u32 uniformOffset, const std::vector<DrawPacket> &packets,
+    VkBuffer indirectBuffer)
+{
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  beginInfo.pInheritanceInfo = nullptr;
+  if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+    printf("failed to begin recording command buffer\n");
+    assert(0);
+  }
+
+  // The last frame to use the target wrote it as a colour attachment, and for swap chain images that's also the
+  // stage the acquire semaphore is waited on. Its contents are cleared away either way.
+  vk::RenderGraph::ImageState initialState = {
+      VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT};
+  vk::RenderGraph::ImageState finalState = {finalLayout,
+      finalLayout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT
+                                                     : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      0};
+  mRenderGraph.Reset();
+  auto color = mRenderGraph.ImportImage(
+      "target", target, targetView, {mSwapChainImageFormat, extent}, initialState, finalState);
+
+  // the variant asked for once its compile has finished, the fallback until then so the frame never waits on it
+  mPipelines.Update();
+  auto graphicsPipeline = mPipelines.Acquire(mTrianglePipeline, mGraphicsPipeline);
+
+  // looked up once here rather than on every recording thread
+  VkPipeline pipeline = mResources.GetPipeline(graphicsPipeline);
+  VkPipelineLayout pipelineLayout = mResources.GetPipelineLayout(graphicsPipeline);
+  VkBuffer vertexBuffer = mResources.GetBuffer(mVertexBuffer);
+  VkBuffer indexBuffer = mResources.GetBuffer(mIndexBuffer);
+
+  VkClearColorValue clearColor = {{0.0f, 0.0f, 0.0f, 1.0f}};
+  mRenderGraph
+      .AddPass("scene", VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS,
+          [&](const vk::RenderGraph::PassContext &context) {
+            VkCommandBufferInheritanceInfo inheritance{};
+            inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+            inheritance.renderPass = context.mRenderPass;
+            inheritance.subpass = 0;
+            inheritance.framebuffer = context.mFramebuffer;
+
+            // each range is its own command buffer and inherits no state, so it binds everything it draws with
+            mRecorder.Record(context.mCommandBuffer, inheritance, (u32)packets.size(),
+                [&](VkCommandBuffer secondary, u32 begin, u32 end) {
+                  vkCmdBindPipeline(secondary, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+                  VkViewport viewport = {0.0f, 0.0f, (f32)extent.width, (f32)extent.height, 0.0f, 1.0f};
+                  VkRect2D scissor = {{0, 0}, extent};
+                  vkCmdSetViewport(secondary, 0, 1, &viewport);
+                  vkCmdSetScissor(secondary, 0, 1, &scissor);
+
+                  VkBuffer vertexBuffers[] = {vertexBuffer};
+                  VkDeviceSize offsets[] = {0};
+                  vkCmdBindVertexBuffers(secondary, 0, 1, vertexBuffers, offsets);
+                  vkCmdBindIndexBuffer(secondary, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+                  vkCmdBindDescriptorSets(secondary, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1,
+                      &mDescriptorSet, 1, &uniformOffset);
+
+                  if (indirectBuffer != VK_NULL_HANDLE) {
+                    constexpr u32 stride = sizeof(VkDrawIndexedIndirectCommand);
+                    for (u32 draw = begin; draw < end; draw += mMaxDrawIndirectCount) {
+                      vkCmdDrawIndexedIndirect(secondary, indirectBuffer, (VkDeviceSize)draw * stride,
+                          std::min(end - draw, mMaxDrawIndirectCount), stride);
+                    }
+                    return;
+                  }
+                  for (u32 draw = begin; draw < end; draw++) {
+                    const auto &packet = packets[draw];
+                    vkCmdDrawIndexed(secondary, packet.mIndexCount, packet.mInstanceCount, packet.mFirstIndex,
+                        packet.mVertexOffset, 0);
+                  }
+                });
+          })
+      .WriteColor(color, &clearColor);
+  mRenderGraph.Compile();
+  // the graph doesn't track buffers, culling's writes are made visible to the indirect reads here
+  if (indirectBuffer != VK_NULL_HANDLE) {
+    vk::BarrierBatch barriers;
+    mAsyncCompute.AddAcquireBarrier(
+        &barriers, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+    barriers.Flush(commandBuffer);
+  }
+  mRenderGraph.Execute(commandBuffer);
+
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+    printf("failed to record command buffer\n");
+    assert(0);
   }
 }
 
-void TriangleApp::MainLoop()
+void TriangleApp::BuildDrawPackets(u32 drawCount, u32 instanceCount, std::vector<DrawPacket> *packets)
 {
-  while (!glfwWindowShouldClose(mWindow)) {
-    glfwPollEvents();
-    DrawFrame();
+  packets->clear();
+  for (u32 i = 0; i < drawCount; i++) {
+    packets->push_back({(u32)indices.size(), instanceCount, 0, 0});
   }
-  vkDeviceWaitIdle(mDevice);
 }
 
-void TriangleApp::DrawFrame()
+void TriangleApp::MainLoop()
 {
-  vkWaitForFences(mDevice, 1, &mInFlightFences[mCurrentFrame], VK_TRUE, UINT64_MAX);
-  u32 imageIndex = 0;
-  VkResult result = vkAcquireNextImageKHR(
-      mDevice, mSwapChain, UINT64_MAX, mImageAvailableSemaphores[mCurrentFrame], VK_NULL_HANDLE, &imageIndex);
+  mRenderThread = std::thread(&TriangleApp::RenderLoop, this);
 
-  if (mImagesInFlight[imageIndex] != VK_NULL_HANDLE) {
-    vkWaitForFences(mDevice, 1, &mImagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+  bool quit = false;
+  while (!quit) {
+    // before polling, input is sampled as close to the frame starting as the pacer allows
+    mPacer.WaitForNextFrame(glfwGetWindowAttrib(mWindow, GLFW_FOCUSED));
+    glfwPollEvents();
+    auto inputTime = FramePacer::Clock::now();
+    quit = glfwWindowShouldClose(mWindow);
+    s32 width = 0;
+    s32 height = 0;
+    glfwGetFramebufferSize(mWindow, &width, &height);
+    // minimised, there's no swap chain to draw to until it comes back
+    if (!quit && (width == 0 || height == 0)) {
+      glfwWaitEvents();
+      continue;
+    }
+
+    auto waitStart = std::chrono::high_resolution_clock::now();
+    auto &list = mRenderCommands.BeginWrite();
+    mMainThreadWait +=
+        std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - waitStart).count();
+    list.mQuit = quit;
+    if (!quit) {
+      BuildRenderCommands(&list, {(u32)width, (u32)height});
+      list.mInputTime = inputTime;
+    }
+    mRenderCommands.EndWrite();
+    mPacer.FrameIssued();
   }
-  mImagesInFlight[imageIndex] = mInFlightFences[mCurrentFrame];
+  mRenderThread.join();
 
-  UpdateUniformBuffer(imageIndex);
+  // an upload batch submitted after the last frame would still be sitting in the batch
+  mGraphicsSubmits.Flush();
+  vkDeviceWaitIdle(mDevice);
+}
 
-  VkSubmitInfo submitInfo{};
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+void TriangleApp::BuildRenderCommands(RenderCommandList *list, VkExtent2D framebufferExtent)
+{
+  list->mCamera = AnimateScene(framebufferExtent);
+  BuildDrawPackets(mDrawCount, 1, &list->mPackets);
+  list->mFramebufferExtent = framebufferExtent;
+  list->mFramebufferResized = mFramebufferResized;
+  list->mFramesInFlight = mFramesInFlightRequest;
+  list->mPresentMode = mPresentModeSetting;
+  list->mLowLatency = mPacer.IsLowLatency();
+  mFramebufferResized = false;
+  mFramesInFlightRequest = 0;
+}
 
-  VkSemaphore waitSemaphores[] = {mImageAvailableSemaphores[mCurrentFrame]};
-  VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-  submitInfo.waitSemaphoreCount = 1;
-  submitInfo.pWaitSemaphores = waitSemaphores;
-  submitInfo.pWaitDstStageMask = waitStages;
+void TriangleApp::RenderLoop()
+{
+  for (;;) {
+    auto waitStart = std::chrono::high_resolution_clock::now();
+    const auto &list = mRenderCommands.BeginRead();
+    mRenderThreadWait +=
+        std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - waitStart).count();
+    if (list.mQuit) {
+      mRenderCommands.EndRead();
+      mPacer.FrameRetired();
+      return;
+    }
+    // the list stays ours until EndRead, the main thread is filling the other one meanwhile
+    DrawFrame(list);
+    if (list.mLowLatency) {
+      mGraphicsTimeline.Wait(mGraphicsTimeline.GetLastSignaled());
+    }
+    mRenderCommands.EndRead();
+    mPacer.FrameRetired();
+    mRenderedFrames++;
+  }
+}
 
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &mCommandBuffers[imageIndex];
+void TriangleApp::DrawFrame(const RenderCommandList &list)
+{
+  if (list.mFramesInFlight != 0) {
+    SetFramesInFlight(list.mFramesInFlight);
+  }
+  // picked up by RecreateSwapChain once this frame is presented
+  bool presentModeChanged = list.mPresentMode != mPresentMode;
+  if (presentModeChanged) {
+    mPresentMode = list.mPresentMode;
+  }
+  mFramebufferExtent = list.mFramebufferExtent;
+  mUploadManager.Update();
+  if (mSwapChainDeferred) {
+    RecreateSwapChain();
+    // still minimised, the frame is dropped rather than drawn to a swap chain that's out of date
+    if (mSwapChainDeferred) {
+      return;
+    }
+  }
 
-  VkSemaphore signalSemaphores[] = {mRenderFinishedSemaphores[mCurrentFrame]};
-  submitInfo.signalSemaphoreCount = 1;
-  submitInfo.pSignalSemaphores = signalSemaphores;
+  // the only CPU wait of the frame, for the GPU to finish the frame that last used this slot N frames ago
+  auto &frame = mFrames[mCurrentFrame];
+  mGraphicsTimeline.Wait(frame.mSubmitted);
+  mDeletionQueue.Update();
+  // on a queue of its own this starts straight away, alongside the previous frame still rendering and the acquire
+  if (mGpuCulling) {
+    DispatchCulling(mCurrentFrame, list.mCamera, list.mPackets);
+  }
 
-  vkResetFences(mDevice, 1, &mInFlightFences[mCurrentFrame]);
-  if (vkQueueSubmit(mGraphicsQueue, 1, &submitInfo, mInFlightFences[mCurrentFrame]) != VK_SUCCESS) {
-    printf("failed to submit draw command buffer\n");
+  u32 imageIndex = 0;
+  VkResult result =
+      vkAcquireNextImageKHR(mDevice, mSwapChain, UINT64_MAX, frame.mImageAvailable, VK_NULL_HANDLE, &imageIndex);
+  // nothing was acquired and the semaphore won't be signalled, this frame can't be drawn
+  if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+    RecreateSwapChain();
+    return;
+  } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+    printf("failed to acquire swap chain image\n");
     assert(0);
   }
 
+  u32 uniformOffset = UpdateUniformBuffer(mCurrentFrame, list.mCamera);
+  vkResetCommandPool(mDevice, frame.mCommandPool, 0);
+  mRecorder.BeginFrame(mCurrentFrame);
+  RecordCommandBuffer(frame.mCommandBuffer, mSwapChainImages[imageIndex], mSwapChainImageViews[imageIndex],
+      mSwapChainExtent, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, uniformOffset, list.mPackets,
+      mGpuCulling ? frame.mIndirectBuffer : VK_NULL_HANDLE);
+
+  SubmitFrame(&frame, frame.mImageAvailable, frame.mRenderFinished);
+  mPacer.FrameSubmitted(list.mInputTime);
+
   VkPresentInfoKHR presentInfo{};
   presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
   presentInfo.waitSemaphoreCount = 1;
-  presentInfo.pWaitSemaphores = signalSemaphores;
+  presentInfo.pWaitSemaphores = &frame.mRenderFinished;
 
   VkSwapchainKHR swapChains[] = {mSwapChain};
   presentInfo.swapchainCount = 1;
@@ -866,58 +1323,93 @@ void TriangleApp::DrawFrame()
 
   presentInfo.pResults = nullptr;
 
-  vkQueuePresentKHR(mPresentQueue, &presentInfo);
-  if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || mFramebufferResized) {
-    mFramebufferResized = false;
+  VkResult presentResult = vkQueuePresentKHR(mPresentQueue, &presentInfo);
+  if (result == VK_SUBOPTIMAL_KHR || presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR
+      || list.mFramebufferResized || presentModeChanged) {
     RecreateSwapChain();
-    return;
-  } else if (result != VK_SUCCESS) {
-    printf("failed to acquire swap chain image\n");
+  } else if (presentResult != VK_SUCCESS) {
+    printf("failed to present swap chain image\n");
     assert(0);
   }
 
-  vkQueueWaitIdle(mPresentQueue);
-  mCurrentFrame = (mCurrentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+  mCurrentFrame = (mCurrentFrame + 1) % mFramesInFlight;
 }
 
-void TriangleApp::CleanupSwapChain()
+void TriangleApp::SubmitFrame(FrameSlot *frame, VkSemaphore imageAvailable, VkSemaphore renderFinished)
 {
-  for (auto frameBuffer : mSwapChainFramebuffers) {
-    vkDestroyFramebuffer(mDevice, frameBuffer, nullptr);
+  // binary semaphores ignore their value, it's only there to keep the value arrays in step with the semaphores
+  vk::Submission submission = {
+      .mCommandBuffers = {frame->mCommandBuffer},
+      .mSignalSemaphores = {mGraphicsTimeline.Get()},
+      .mSignalValues = {mGraphicsTimeline.Next()},
+  };
+  // culling only has to be done by the time the draws read their commands
+  mAsyncCompute.AddGraphicsWait(&submission, frame->mCulled, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT);
+  frame->mCulled = 0;
+  if (imageAvailable != VK_NULL_HANDLE) {
+    submission.mWaitSemaphores.push_back(imageAvailable);
+    submission.mWaitValues.push_back(0);
+    submission.mWaitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+  }
+  if (renderFinished != VK_NULL_HANDLE) {
+    submission.mSignalSemaphores.push_back(renderFinished);
+    submission.mSignalValues.push_back(0);
   }
-  vkFreeCommandBuffers(mDevice, mCommandPool, (u32)mCommandBuffers.size(), mCommandBuffers.data());
-  vkDestroyPipeline(mDevice, mGraphicsPipeline, nullptr);
-  vkDestroyPipelineLayout(mDevice, mPipelineLayout, nullptr);
-  vkDestroyRenderPass(mDevice, mRenderPass, nullptr);
+  frame->mSubmitted = submission.mSignalValues[0];
+
+  // goes out together with any upload batches queued since the last frame
+  mGraphicsSubmits.Add(std::move(submission));
+  mGraphicsSubmits.Flush();
+  mFramesSubmitted++;
+}
+
+void TriangleApp::CleanupSwapChain()
+{
   for (auto imageView : mSwapChainImageViews) {
     vkDestroyImageView(mDevice, imageView, nullptr);
   }
   vkDestroySwapchainKHR(mDevice, mSwapChain, nullptr);
-  for (u64 i = 0; i < mSwapChainImages.size(); i++) {
-    vkDestroyBuffer(mDevice, mUniformBuffers[i], nullptr);
-    vkFreeMemory(mDevice, mUniformBuffersMemory[i], nullptr);
-  }
-  vkDestroyDescriptorPool(mDevice, mDescriptorPool, nullptr);
 }
 
 void TriangleApp::CleanUp()
 {
+  // MainLoop left the device idle
   CleanupSwapChain();
-  vkDestroySampler(mDevice, mTextureSampler, nullptr);
-  vkDestroyImageView(mDevice, mTextureImageView, nullptr);
-  vkDestroyImage(mDevice, mTextureImage, nullptr);
-  vkFreeMemory(mDevice, mTextureImageMemory, nullptr);
-  vkDestroyDescriptorSetLayout(mDevice, mDescriptorSetLayout, nullptr);
-  vkDestroyBuffer(mDevice, mIndexBuffer, nullptr);
-  vkFreeMemory(mDevice, mIndexBufferMemory, nullptr);
-  vkDestroyBuffer(mDevice, mVertexBuffer, nullptr);
-  vkFreeMemory(mDevice, mVertexBufferMemory, nullptr);
-  for (u64 i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    vkDestroySemaphore(mDevice, mRenderFinishedSemaphores[i], nullptr);
-    vkDestroySemaphore(mDevice, mImageAvailableSemaphores[i], nullptr);
-    vkDestroyFence(mDevice, mInFlightFences[i], nullptr);
-  }
-  vkDestroyCommandPool(mDevice, mCommandPool, nullptr);
+  mRenderGraph.PrintStats();
+  mRenderGraph.Destroy();
+  mUniformRing.Destroy();
+  vkDestroyDescriptorPool(mDevice, mDescriptorPool, nullptr);
+  DestroyFrameSlots();
+  mAsyncCompute.PrintStats();
+  mAsyncCompute.Destroy();
+  vkDestroyDescriptorPool(mDevice, mCullDescriptorPool, nullptr);
+  // before the cache, the compiles still running use it
+  mPipelines.PrintStats();
+  mPipelines.Destroy();
+  mPipelineCache.Destroy();
+  mUploadManager.PrintStats();
+  mUploadManager.Destroy();
+  mResources.PrintStats();
+  mResources.Destroy();
+  mLayouts.PrintStats();
+  mLayouts.Destroy();
+  mDeletionQueue.PrintStats();
+  mDeletionQueue.Destroy();
+  PrintSyncStats("total", {}, mFramesSubmitted);
+  mPacer.PrintStats();
+  if (mRenderedFrames > 0) {
+    fmt::print("render thread: {} frames, main thread waited {:.3f} ms/frame, render thread waited {:.3f} ms/frame\n",
+        mRenderedFrames, mMainThreadWait / mRenderedFrames, mRenderThreadWait / mRenderedFrames);
+  }
+  mGraphicsTimeline.Destroy();
+  if (mTransferTimeline.IsValid()) {
+    mTransferTimeline.Destroy();
+  }
+  if (mComputeTimeline.IsValid()) {
+    mComputeTimeline.Destroy();
+  }
+  mAllocator.PrintStats();
+  mAllocator.Destroy();
   vkDestroyDevice(mDevice, nullptr);
   if (mEnableValidationLayers) {
     DestroyDebugUtilsMessengerEXT(mInstance, mDebugMessenger, nullptr);
@@ -931,45 +1423,27 @@ void TriangleApp::CleanUp()
 void TriangleApp::CreateVertexBuffer()
 {
   VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
-  CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, &stagingBufferMemory);
-
-  void *data;
-  vkMapMemory(mDevice, stagingBufferMemory, 0, bufferSize, 0, &data);
-  memcpy(data, vertices.data(), (u64)bufferSize);
-  vkUnmapMemory(mDevice, stagingBufferMemory);
-
-  CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &mVertexBuffer, &mVertexBufferMemory);
-
-  CopyBuffer(stagingBuffer, mVertexBuffer, bufferSize);
-
-  vkDestroyBuffer(mDevice, stagingBuffer, nullptr);
-  vkFreeMemory(mDevice, stagingBufferMemory, nullptr);
+  mVertexBuffer = CreateDeviceLocalBuffer(vertices.data(), bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
 }
 
-u32 TriangleApp::FindMemoryType(u32 typeFilter, VkMemoryPropertyFlags properties)
+u32 TriangleApp::FindMemoryType(u32 typeFilter, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred)
 {
-  VkPhysicalDeviceMemoryProperties memProperties;
-  vkGetPhysicalDeviceMemoryProperties(mPhysicalDevice, &memProperties);
-  for (u32 i = 0; i < memProperties.memoryTypeCount; i++) {
-    if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-      return i;
-    }
-  }
-  assert(0 && "failed to find suitable memory type");
+  return mAllocator.FindMemoryType(typeFilter, required, preferred);
 }
 
 void TriangleApp::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-    VkBuffer *buffer, VkDeviceMemory *bufferMemory)
+    VkBuffer *buffer, vk::Allocation *bufferAllocation, const std::vector<u32> &sharedFamilies)
 {
   VkBufferCreateInfo bufferInfo{};
   bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
   bufferInfo.size = size;
   bufferInfo.usage = usage;
   bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  if (sharedFamilies.size() > 1) {
+    bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferInfo.queueFamilyIndexCount = (u32)sharedFamilies.size();
+    bufferInfo.pQueueFamilyIndices = sharedFamilies.data();
+  }
 
   if (vkCreateBuffer(mDevice, &bufferInfo, nullptr, buffer) != VK_SUCCESS) {
     assert(0 && "failed to create buffer");
@@ -978,131 +1452,60 @@ void TriangleApp::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMe
   VkMemoryRequirements memReqirements;
   vkGetBufferMemoryRequirements(mDevice, *buffer, &memReqirements);
 
-  VkMemoryAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-  allocInfo.allocationSize = memReqirements.size;
-  allocInfo.memoryTypeIndex = FindMemoryType(memReqirements.memoryTypeBits, properties);
-
-  if (vkAllocateMemory(mDevice, &allocInfo, nullptr, bufferMemory) != VK_SUCCESS) {
-    assert(0 && "failed to allocate buffer memory");
-  }
-
-  vkBindBufferMemory(mDevice, *buffer, *bufferMemory, 0);
-}
-
-void TriangleApp::CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
-{
-  auto commandBuffer = BeginSingleTimeCommands();
-
-  VkBufferCopy copyRegion{};
-  copyRegion.size = size;
-  vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-  EndSingleTimeCommands(commandBuffer);
-}
-
-VkCommandBuffer TriangleApp::BeginSingleTimeCommands()
-{
-  VkCommandBufferAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandPool = mCommandPool;
-  allocInfo.commandBufferCount = 1;
-
-  VkCommandBuffer commandBuffer;
-  vkAllocateCommandBuffers(mDevice, &allocInfo, &commandBuffer);
+  *bufferAllocation =
+      mAllocator.Allocate(memReqirements, FindMemoryType(memReqirements.memoryTypeBits, properties), true);
 
-  VkCommandBufferBeginInfo beginInfo{};
-  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-  vkBeginCommandBuffer(commandBuffer, &beginInfo);
-  return commandBuffer;
+  vkBindBufferMemory(mDevice, *buffer, bufferAllocation->mMemory, bufferAllocation->mOffset);
 }
 
-void TriangleApp::EndSingleTimeCommands(VkCommandBuffer commandBuffer)
+vk::BufferHandle TriangleApp::CreateDeviceLocalBuffer(const void *data, VkDeviceSize size, VkBufferUsageFlags usage)
 {
-  vkEndCommandBuffer(commandBuffer);
-
-  VkSubmitInfo submitInfo{};
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &commandBuffer;
-  vkQueueSubmit(mGraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-  vkQueueWaitIdle(mGraphicsQueue);
-  vkFreeCommandBuffers(mDevice, mCommandPool, 1, &commandBuffer);
+  VkBuffer buffer;
+  vk::Allocation allocation;
+  if (mAllocator.IsUnifiedMemory()) {
+    CreateBuffer(size, usage,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+            | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        &buffer, &allocation);
+    memcpy(allocation.mMapped, data, size);
+  } else {
+    CreateBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &buffer,
+        &allocation);
+    mUploadManager.UploadBuffer(buffer, 0, data, size);
+  }
+  return mResources.AddBuffer(buffer, allocation, size);
 }
 
 void TriangleApp::CreateIndexBuffer()
 {
   VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
-
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
-  CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, &stagingBufferMemory);
-
-  void *data;
-  vkMapMemory(mDevice, stagingBufferMemory, 0, bufferSize, 0, &data);
-  memcpy(data, indices.data(), (u64)bufferSize);
-  vkUnmapMemory(mDevice, stagingBufferMemory);
-
-  CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &mIndexBuffer, &mIndexBufferMemory);
-
-  CopyBuffer(stagingBuffer, mIndexBuffer, bufferSize);
-
-  vkDestroyBuffer(mDevice, stagingBuffer, nullptr);
-  vkFreeMemory(mDevice, stagingBufferMemory, nullptr);
+  mIndexBuffer = CreateDeviceLocalBuffer(indices.data(), bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
 }
 
 void TriangleApp::CreateDescriptorSetLayout()
 {
-  VkDescriptorSetLayoutBinding uboLayoutBinding{};
-  uboLayoutBinding.binding = 0;
-  uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-  uboLayoutBinding.descriptorCount = 1;
-
-  uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
-  uboLayoutBinding.pImmutableSamplers = nullptr;
-
-  VkDescriptorSetLayoutBinding samplerLayoutBinding = {
-      .binding = 1,
-      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-      .descriptorCount = 1,
-      .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
-      .pImmutableSamplers = nullptr,
-  };
-
-  std::array<VkDescriptorSetLayoutBinding, 2> bindings = {
-      uboLayoutBinding,
-      samplerLayoutBinding,
-  };
-
-  VkDescriptorSetLayoutCreateInfo layoutInfo{};
-  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-  layoutInfo.bindingCount = (u32)bindings.size();
-  layoutInfo.pBindings = bindings.data();
-
-  assert(vkCreateDescriptorSetLayout(mDevice, &layoutInfo, nullptr, &mDescriptorSetLayout) == VK_SUCCESS);
+  // every variant declares the same bindings, so the fallback speaks for them all
+  const auto *variant = mTriangleShaders.Get(mFallbackVariant);
+  if (!variant) {
+    printf("the fallback triangle shaders failed to compile\n");
+    assert(0);
+    return;
+  }
+  mGraphicsReflection = {};
+  for (const auto &spirv : variant->mSpirv) {
+    mGraphicsReflection.Merge(vk::ReflectShader(*spirv));
+  }
+  // the uniforms are bound at an offset into the uniform ring, which the shader has no way of saying
+  mGraphicsReflection.SetDynamic(0, 0);
+  mDescriptorSetLayout = mLayouts.GetSetLayout(mGraphicsReflection.mSets[0]);
 }
 
 void TriangleApp::CreateUniformBuffers()
 {
-  VkDeviceSize bufferSize = sizeof(UniformBufferObject);
-
-  mUniformBuffers.resize(mSwapChainImages.size());
-  mUniformBuffersMemory.resize(mSwapChainImages.size());
-
-  for (u64 i = 0; i < mSwapChainImages.size(); i++) {
-    CreateBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &mUniformBuffers[i],
-        &mUniformBuffersMemory[i]);
-  }
+  mUniformRing = vk::UniformRing(mPhysicalDevice, mDevice, &mAllocator, UNIFORM_FRAME_SIZE, MAX_FRAMES_IN_FLIGHT);
 }
 
-void TriangleApp::UpdateUniformBuffer(u32 currentImage)
+UniformBufferObject TriangleApp::AnimateScene(VkExtent2D extent)
 {
   static auto startTime = std::chrono::high_resolution_clock::now();
   auto currentTime = std::chrono::high_resolution_clock::now();
@@ -1111,120 +1514,173 @@ void TriangleApp::UpdateUniformBuffer(u32 currentImage)
   UniformBufferObject ubo{};
   ubo.mModel = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
   ubo.mView = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-  ubo.mProj = glm::perspective(glm::radians(45.0f), mSwapChainExtent.width / (f32)mSwapChainExtent.height, 0.1f, 10.0f);
+  ubo.mProj = glm::perspective(glm::radians(45.0f), extent.width / (f32)extent.height, 0.1f, 10.0f);
   ubo.mProj[1][1] *= -1;
+  return ubo;
+}
 
-  void *data;
-  vkMapMemory(mDevice, mUniformBuffersMemory[currentImage], 0, sizeof(ubo), 0, &data);
-  memcpy(data, &ubo, sizeof(ubo));
-  vkUnmapMemory(mDevice, mUniformBuffersMemory[currentImage]);
+u32 TriangleApp::UpdateUniformBuffer(u32 frameSlot, const UniformBufferObject &ubo)
+{
+  // the slot's last timeline value has been reached so the GPU is done with its partition
+  mUniformRing.BeginFrame(frameSlot);
+  return mUniformRing.Push(ubo);
 }
 
 void TriangleApp::CreateDescriptorPool()
 {
-  std::array<VkDescriptorPoolSize, 2> poolSizes;
-
-  poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-  poolSizes[0].descriptorCount = (u32)mSwapChainImages.size();
-  poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-  poolSizes[1].descriptorCount = (u32)mSwapChainImages.size();
-
-  VkDescriptorPoolCreateInfo poolInfo{};
-  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-  poolInfo.poolSizeCount = (u32)poolSizes.size();
-  poolInfo.pPoolSizes = poolSizes.data();
-
-  poolInfo.maxSets = (u32)mSwapChainImages.size();
-
+  auto poolSizes = mGraphicsReflection.GetPoolSizes(0, 1);
+  VkDescriptorPoolCreateInfo poolInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+      .maxSets = 1,
+      .poolSizeCount = (u32)poolSizes.size(),
+      .pPoolSizes = poolSizes.data(),
+  };
   assert(vkCreateDescriptorPool(mDevice, &poolInfo, nullptr, &mDescriptorPool) == VK_SUCCESS
          && "failed to create descriptor pool");
 }
 
 void TriangleApp::CreateDescriptorSets()
 {
-  std::vector<VkDescriptorSetLayout> layouts(mSwapChainImages.size(), mDescriptorSetLayout);
   VkDescriptorSetAllocateInfo allocInfo{};
   allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
   allocInfo.descriptorPool = mDescriptorPool;
-  allocInfo.descriptorSetCount = (u32)mSwapChainImages.size();
-  allocInfo.pSetLayouts = layouts.data();
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &mDescriptorSetLayout;
 
-  mDescriptorSets.resize(mSwapChainImages.size());
-  assert(vkAllocateDescriptorSets(mDevice, &allocInfo, mDescriptorSets.data()) == VK_SUCCESS
+  assert(vkAllocateDescriptorSets(mDevice, &allocInfo, &mDescriptorSet) == VK_SUCCESS
          && "failed to allocate descriptor sets");
+  UpdateDescriptorSets();
+}
 
-  for (u64 i = 0; i < mSwapChainImages.size(); i++) {
-    VkDescriptorBufferInfo bufferInfo{};
-    bufferInfo.buffer = mUniformBuffers[i];
-    bufferInfo.offset = 0;
-    bufferInfo.range = sizeof(UniformBufferObject);
-
-    VkDescriptorImageInfo imageInfo = {
-        .sampler = mTextureSampler,
-        .imageView = mTextureImageView,
-        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-    };
-
-    std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
-    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[0].dstSet = mDescriptorSets[i];
-    descriptorWrites[0].dstBinding = 0;
-    descriptorWrites[0].dstArrayElement = 0;
-    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    descriptorWrites[0].descriptorCount = 1;
-    descriptorWrites[0].pBufferInfo = &bufferInfo;
+void TriangleApp::UpdateDescriptorSets()
+{
 
-    descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[1].dstSet = mDescriptorSets[i];
-    descriptorWrites[1].dstBinding = 1;
-    descriptorWrites[1].dstArrayElement = 0;
-    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    descriptorWrites[1].descriptorCount = 1;
+  // the offset into the ring is supplied as a dynamic offset at bind time
+  VkDescriptorBufferInfo bufferInfo{};
+  bufferInfo.buffer = mUniformRing.GetBuffer();
+  bufferInfo.offset = 0;
+  bufferInfo.range = sizeof(UniformBufferObject);
 
-    descriptorWrites[1].pImageInfo = &imageInfo;
-    descriptorWrites[1].pTexelBufferView = nullptr;
+  VkDescriptorImageInfo imageInfo = {
+      .sampler = mResources.GetSampler(mTextureSampler),
+      .imageView = mResources.GetImageView(mTexture),
+      .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+  };
 
-    vkUpdateDescriptorSets(mDevice, (u32)descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
-  }
+  std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+  descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[0].dstSet = mDescriptorSet;
+  descriptorWrites[0].dstBinding = 0;
+  descriptorWrites[0].dstArrayElement = 0;
+  descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  descriptorWrites[0].descriptorCount = 1;
+  descriptorWrites[0].pBufferInfo = &bufferInfo;
+
+  descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrites[1].dstSet = mDescriptorSet;
+  descriptorWrites[1].dstBinding = 1;
+  descriptorWrites[1].dstArrayElement = 0;
+  descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  descriptorWrites[1].descriptorCount = 1;
+
+  descriptorWrites[1].pImageInfo = &imageInfo;
+  descriptorWrites[1].pTexelBufferView = nullptr;
+
+  vkUpdateDescriptorSets(mDevice, (u32)descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
 }
 
 void TriangleApp::CreateTextureImage()
 {
-  s32 texWidth = 0;
-  s32 texHeight = 0;
-  s32 texChannels = 0;
-  u8 *pixels = stbi_load("../textures/statue.jpg", &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-  VkDeviceSize imageSize = texWidth * texHeight * 4;
+  mJobs.Wait(&mTextureDecodeCounter);
+  u8 *pixels = mTextureDecode.mPixels;
+  s32 texWidth = mTextureDecode.mWidth;
+  s32 texHeight = mTextureDecode.mHeight;
   assert(pixels && "failed to load texture image");
 
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
-  CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &stagingBuffer, &stagingBufferMemory);
-
-  void *data;
-  vkMapMemory(mDevice, stagingBufferMemory, 0, imageSize, 0, &data);
-  memcpy(data, pixels, (size_t)imageSize);
-  vkUnmapMemory(mDevice, stagingBufferMemory);
+  auto path = ChooseTextureUpload(VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight);
+  VkImage image;
+  vk::Allocation allocation;
+  CreateTexture(path, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, pixels, &image, &allocation);
+  mTexture = mResources.AddImage(
+      image, VK_NULL_HANDLE, allocation, {(u32)texWidth, (u32)texHeight}, VK_FORMAT_R8G8B8A8_SRGB);
   stbi_image_free(pixels);
+}
 
-  CreateImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
-      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &mTextureImage,
-      &mTextureImageMemory);
+TriangleApp::TextureUpload TriangleApp::ChooseTextureUpload(VkFormat format, u32 width, u32 height)
+{
+  if (mHostImageCopy.CanCopy(format, width, height)) {
+    return TextureUpload::HostImageCopy;
+  }
+  // on unified memory a linear image can be written in place, skipping the staging buffer and the copy
+  if (mAllocator.IsUnifiedMemory() && CanSampleLinearImage(format, width, height)) {
+    return TextureUpload::LinearHostWrite;
+  }
+  return TextureUpload::Staged;
+}
 
-  TransitionImageLayout(
-      mTextureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-  CopyBufferToImage(stagingBuffer, mTextureImage, (u32)texWidth, (u32)texHeight);
-  TransitionImageLayout(mTextureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+void TriangleApp::CreateTexture(TextureUpload path, VkFormat format, u32 width, u32 height, const void *pixels,
+    VkImage *image, vk::Allocation *imageAllocation)
+{
+  // only 4 byte texel formats are loaded for now
+  VkDeviceSize imageSize = (VkDeviceSize)width * height * 4;
+
+  switch (path) {
+  case TextureUpload::HostImageCopy:
+    CreateImage(width, height, format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT | vk::HostImageCopy::sUsage,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageAllocation);
+    mHostImageCopy.CopyToImage(*image, width, height, pixels);
+    break;
+
+  case TextureUpload::LinearHostWrite: {
+    CreateImage(width, height, format, VK_IMAGE_TILING_LINEAR, VK_IMAGE_USAGE_SAMPLED_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+            | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        image, imageAllocation);
+
+    VkImageSubresource subresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0};
+    VkSubresourceLayout layout;
+    vkGetImageSubresourceLayout(mDevice, *image, &subresource, &layout);
+    u8 *dst = (u8 *)imageAllocation->mMapped + layout.offset;
+    u64 rowSize = (u64)width * 4;
+    for (u32 row = 0; row < height; row++) {
+      memcpy(dst + row * layout.rowPitch, (const u8 *)pixels + row * rowSize, rowSize);
+    }
+    mUploadManager.TransitionHostWrittenImage(*image);
+    break;
+  }
 
-  vkDestroyBuffer(mDevice, stagingBuffer, nullptr);
-  vkFreeMemory(mDevice, stagingBufferMemory, nullptr);
+  case TextureUpload::Staged:
+    CreateImage(width, height, format, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image,
+        imageAllocation);
+    mUploadManager.UploadImage(*image, width, height, pixels, imageSize);
+    break;
+  }
+}
+
+bool TriangleApp::CanSampleLinearImage(VkFormat format, u32 width, u32 height)
+{
+  // the sampler filters linearly, so the format needs that on linear tiling too
+  VkFormatProperties formatProperties;
+  vkGetPhysicalDeviceFormatProperties(mPhysicalDevice, format, &formatProperties);
+  constexpr VkFormatFeatureFlags required =
+      VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+  if ((formatProperties.linearTilingFeatures & required) != required) {
+    return false;
+  }
+
+  VkImageFormatProperties imageProperties;
+  if (vkGetPhysicalDeviceImageFormatProperties(mPhysicalDevice, format, VK_IMAGE_TYPE_2D, VK_IMAGE_TILING_LINEAR,
+          VK_IMAGE_USAGE_SAMPLED_BIT, 0, &imageProperties)
+      != VK_SUCCESS) {
+    return false;
+  }
+  return width <= imageProperties.maxExtent.width && height <= imageProperties.maxExtent.height;
 }
 
 void TriangleApp::CreateTextureImageView()
 {
-  mTextureImageView = CreateImageView(mTextureImage, VK_FORMAT_R8G8B8A8_SRGB);
+  mResources.SetImageView(mTexture, CreateImageView(mResources.GetImage(mTexture), mResources.GetFormat(mTexture)));
 }
 VkImageView TriangleApp::CreateImageView(VkImage image, VkFormat format)
 {
@@ -1268,12 +1724,13 @@ void TriangleApp::CreateTextureSampler()
       .borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
       .unnormalizedCoordinates = VK_FALSE,
   };
-  assert(vkCreateSampler(mDevice, &samplerInfo, nullptr, &mTextureSampler) == VK_SUCCESS
-         && "failed to create texture sampler");
+  VkSampler sampler;
+  assert(vkCreateSampler(mDevice, &samplerInfo, nullptr, &sampler) == VK_SUCCESS && "failed to create texture sampler");
+  mTextureSampler = mResources.AddSampler(sampler);
 }
 
 void TriangleApp::CreateImage(u32 width, u32 height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
-    VkMemoryPropertyFlags properties, VkImage *image, VkDeviceMemory *imageMemory)
+    VkMemoryPropertyFlags properties, VkImage *image, vk::Allocation *imageAllocation)
 {
   VkImageCreateInfo imageInfo = {
       .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
@@ -1287,95 +1744,693 @@ void TriangleApp::CreateImage(u32 width, u32 height, VkFormat format, VkImageTil
       .tiling = tiling,
       .usage = usage,
       .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      // linear images may be written by the CPU before their first transition, which only PREINITIALIZED preserves
+      .initialLayout = tiling == VK_IMAGE_TILING_LINEAR ? VK_IMAGE_LAYOUT_PREINITIALIZED : VK_IMAGE_LAYOUT_UNDEFINED,
   };
   assert(vkCreateImage(mDevice, &imageInfo, nullptr, image) == VK_SUCCESS && "failed to create image");
 
   VkMemoryRequirements memRequirements;
   vkGetImageMemoryRequirements(mDevice, *image, &memRequirements);
 
-  VkMemoryAllocateInfo allocInfo = {
-      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-      .allocationSize = memRequirements.size,
-      .memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties),
+  *imageAllocation = mAllocator.Allocate(memRequirements,
+      FindMemoryType(memRequirements.memoryTypeBits, properties), tiling == VK_IMAGE_TILING_LINEAR);
+  vkBindImageMemory(mDevice, *image, imageAllocation->mMemory, imageAllocation->mOffset);
+}
+void TriangleApp::RunBenchmarks()
+{
+  constexpr u64 iterations = 100000;
+  UniformBufferObject ubo{};
+
+  // the old path, a map + memcpy + unmap of a standalone host visible allocation every frame
+  {
+    VkBuffer buffer;
+    VkBufferCreateInfo bufferInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = sizeof(ubo),
+        .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    assert(vkCreateBuffer(mDevice, &bufferInfo, nullptr, &buffer) == VK_SUCCESS);
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(mDevice, buffer, &requirements);
+    VkMemoryAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = requirements.size,
+        .memoryTypeIndex = FindMemoryType(requirements.memoryTypeBits,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+    };
+    VkDeviceMemory memory;
+    assert(vkAllocateMemory(mDevice, &allocInfo, nullptr, &memory) == VK_SUCCESS);
+
+    Bench("uniform update: vkMapMemory + memcpy + vkUnmapMemory", iterations, [&](u64) {
+      void *data;
+      vkMapMemory(mDevice, memory, 0, sizeof(ubo), 0, &data);
+      memcpy(data, &ubo, sizeof(ubo));
+      vkUnmapMemory(mDevice, memory);
+    });
+
+    vkDestroyBuffer(mDevice, buffer, nullptr);
+    vkFreeMemory(mDevice, memory, nullptr);
+  }
+
+  Bench("uniform update: ring bump + memcpy", iterations, [&](u64 i) {
+    mUniformRing.BeginFrame((u32)(i % MAX_FRAMES_IN_FLIGHT));
+    (void)mUniformRing.Push(ubo);
+  });
+
+  // N mesh sized uploads, waiting on each one like EndSingleTimeCommands did versus one batch for all of them
+  {
+    constexpr u64 uploadCount = 64;
+    constexpr VkDeviceSize uploadSize = 1024 * 1024;
+    std::vector<u8> payload(uploadSize, 0xab);
+    VkBuffer buffer;
+    vk::Allocation allocation;
+    CreateBuffer(uploadSize * uploadCount, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        &buffer, &allocation);
+
+    Bench("upload 1MiB: submit + wait per upload", uploadCount, [&](u64 i) {
+      mUploadManager.UploadBuffer(buffer, i * uploadSize, payload.data(), uploadSize);
+      mUploadManager.Wait(mUploadManager.Submit());
+    });
+    Bench("upload 1MiB: batched, one submit", uploadCount, [&](u64 i) {
+      mUploadManager.UploadBuffer(buffer, i * uploadSize, payload.data(), uploadSize);
+      if (i == uploadCount - 1) {
+        mUploadManager.Wait(mUploadManager.Submit());
+      }
+    });
+
+    vkDestroyBuffer(mDevice, buffer, nullptr);
+    mAllocator.Free(allocation);
+  }
+
+  // a large mesh going through the staging ring and a copy, versus written in place on unified memory
+  {
+    constexpr u64 meshCount = 16;
+    constexpr VkDeviceSize meshSize = 16 * 1024 * 1024;
+    std::vector<u8> mesh(meshSize, 0xcd);
+    VkBuffer buffer;
+    vk::Allocation allocation;
+
+    CreateBuffer(meshSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &buffer, &allocation);
+    Bench("16MiB mesh: staged copy", meshCount, [&](u64) {
+      mUploadManager.UploadBuffer(buffer, 0, mesh.data(), meshSize);
+      mUploadManager.Wait(mUploadManager.Submit());
+    });
+    vkDestroyBuffer(mDevice, buffer, nullptr);
+    mAllocator.Free(allocation);
+
+    if (mAllocator.IsUnifiedMemory()) {
+      CreateBuffer(meshSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+              | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+          &buffer, &allocation);
+      Bench("16MiB mesh: direct write", meshCount, [&](u64) { memcpy(allocation.mMapped, mesh.data(), meshSize); });
+      vkDestroyBuffer(mDevice, buffer, nullptr);
+      mAllocator.Free(allocation);
+    } else {
+      fmt::print("[bench] 16MiB mesh: direct write skipped, device has no host visible device local heap\n");
+    }
+  }
+
+  // texture upload throughput of every path the device supports, from decoded pixels to an image the graphics
+  // queue can sample. Creation and destruction are included since a streaming loader pays for them too.
+  {
+    constexpr u64 textureCount = 16;
+    constexpr u32 textureSize = 2048;
+    constexpr VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+    constexpr f64 textureBytes = (f64)textureSize * textureSize * 4;
+    std::vector<u8> pixels((u64)textureSize * textureSize * 4, 0x7f);
+
+    auto benchTexture = [&](TextureUpload path, const char *name) {
+      f64 ns = Bench(name, textureCount, [&](u64) {
+        VkImage image;
+        vk::Allocation allocation;
+        CreateTexture(path, format, textureSize, textureSize, pixels.data(), &image, &allocation);
+        // host copies and host writes are done on return, the other paths are done once their batch is
+        mUploadManager.Wait(mUploadManager.Submit());
+        vkDestroyImage(mDevice, image, nullptr);
+        mAllocator.Free(allocation);
+      });
+      fmt::print("[bench] {}: {:.1f} MB/s\n", name, textureBytes / ns * 1e3);
+    };
+
+    benchTexture(TextureUpload::Staged, "2048^2 texture: staged copy");
+    if (ChooseTextureUpload(format, textureSize, textureSize) == TextureUpload::HostImageCopy) {
+      benchTexture(TextureUpload::HostImageCopy, "2048^2 texture: host image copy");
+    } else {
+      fmt::print("[bench] 2048^2 texture: host image copy skipped, VK_EXT_host_image_copy unavailable\n");
+    }
+    if (mAllocator.IsUnifiedMemory() && CanSampleLinearImage(format, textureSize, textureSize)) {
+      benchTexture(TextureUpload::LinearHostWrite, "2048^2 texture: linear host write");
+    } else {
+      fmt::print("[bench] 2048^2 texture: linear host write skipped, no host visible device local heap\n");
+    }
+  }
+
+  RunFramePipeliningBenchmark();
+  RunParallelRecordingBenchmark();
+  RunJobBenchmarks();
+  RunRenderGraphBenchmark();
+  RunSyncBatchingBenchmark();
+  RunRenderThreadBenchmark();
+  RunFramePacingBenchmark();
+  RunAsyncComputeBenchmark();
+  RunHandlePoolBenchmark();
+}
+
+void TriangleApp::RunHandlePoolBenchmark()
+{
+  // The registry's buffer pool layout with made up objects, nothing here touches the device. Lookups go in a
+  // shuffled order so they miss the cache the way scattered draws would, and are compared with the hash map of ids
+  // that the usual alternative to handles comes down to.
+  using Pool = HandlePool<struct BenchTag, VkBuffer, vk::Allocation, VkDeviceSize>;
+  constexpr u32 liveCount = 1'000'000;
+  constexpr u64 lookupCount = 4'000'000;
+  constexpr u64 churnCount = 4'000'000;
+
+  Pool pool;
+  std::vector<Pool::HandleType> handles(liveCount);
+  Bench("handles: create", liveCount, [&](u64 i) {
+    handles[i] = pool.Create((VkBuffer)(i + 1), vk::Allocation{.mSize = i}, (VkDeviceSize)i * 256);
+  });
+
+  std::vector<u32> order(liveCount);
+  u32 seed = 0x9e3779b9;
+  for (u32 i = 0; i < liveCount; i++) {
+    order[i] = i;
+  }
+  for (u32 i = liveCount - 1; i > 0; i--) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    std::swap(order[i], order[seed % (i + 1)]);
+  }
+
+  u64 sum = 0;
+  Bench("handles: lookup one field, shuffled", lookupCount, [&](u64 i) {
+    sum += pool.Get<2>(handles[order[i % liveCount]]);
+  });
+
+  struct Record {
+    VkBuffer mBuffer;
+    vk::Allocation mAllocation;
+    VkDeviceSize mSize;
   };
-  assert(
-      vkAllocateMemory(mDevice, &allocInfo, nullptr, imageMemory) == VK_SUCCESS && "failed to allocate image memory");
-  vkBindImageMemory(mDevice, *image, *imageMemory, 0);
-}
-void TriangleApp::TransitionImageLayout(
-    VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout)
-{
-  auto commandBuffer = BeginSingleTimeCommands();
-  VkImageMemoryBarrier barrier = {
-      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-      .srcAccessMask = 0,
-      .dstAccessMask = 0,
-      .oldLayout = oldLayout,
-      .newLayout = newLayout,
-      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-      .image = image,
-      .subresourceRange =
-          {
-              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-              .baseMipLevel = 0,
-              .levelCount = 1,
-              .baseArrayLayer = 0,
-              .layerCount = 1,
-          },
+  std::unordered_map<u32, Record> map;
+  map.reserve(liveCount);
+  for (u32 i = 0; i < liveCount; i++) {
+    map[i] = {(VkBuffer)(u64)(i + 1), vk::Allocation{.mSize = i}, (VkDeviceSize)i * 256};
+  }
+  Bench("handles: unordered_map lookup, shuffled", lookupCount, [&](u64 i) {
+    sum += map.find(order[i % liveCount])->second.mSize;
+  });
+
+  // every other handle goes stale, each lookup has to tell which
+  for (u32 i = 0; i < liveCount; i += 2) {
+    pool.Destroy(handles[i]);
+  }
+  u64 stale = 0;
+  Bench("handles: validate, half stale", lookupCount, [&](u64 i) {
+    stale += pool.TryGet<2>(handles[order[i % liveCount]]) == nullptr;
+  });
+
+  // destroy and recreate in place, the free list hands back the slots freed longest ago
+  Bench("handles: destroy + create", churnCount, [&](u64 i) {
+    auto &handle = handles[(i * 2 + 1) % liveCount];
+    pool.Destroy(handle);
+    handle = pool.Create((VkBuffer)(i + 1), {}, (VkDeviceSize)i);
+  });
+  fmt::print("[bench] handles: {} live, {} slots, {} retired, {} stale lookups caught (checksum {})\n",
+      pool.GetCount(), pool.GetCapacity(), pool.GetRetiredSlotCount(), stale, sum);
+}
+
+void TriangleApp::RunAsyncComputeBenchmark()
+{
+  // Offscreen frames that cull a large batch of packets and draw the first of them heavily instanced. With the
+  // culling on the graphics queue each frame costs the dispatch plus the draw, on a queue of its own the dispatch for
+  // one frame runs while the previous frame is still drawing. Most of the culled packets are never drawn, they're
+  // only there to give the dispatch enough work to show up next to the draw.
+  constexpr u64 frameCount = 300;
+  constexpr VkExtent2D extent = {1024, 1024};
+  constexpr u32 cullCount = 256 * 1024;
+  constexpr u32 instanceCount = 2048;
+  auto target = CreateOffscreenTarget(extent);
+  std::vector<DrawPacket> packets;
+  BuildDrawPackets(cullCount, 1, &packets);
+  packets[0].mInstanceCount = instanceCount;
+  std::vector<DrawPacket> drawn(packets.begin(), packets.begin() + 1);
+
+  auto measure = [&](bool cull) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (u64 i = 0; i < frameCount; i++) {
+      auto &frame = mFrames[mCurrentFrame];
+      mGraphicsTimeline.Wait(frame.mSubmitted);
+      auto camera = AnimateScene(extent);
+      if (cull) {
+        DispatchCulling(mCurrentFrame, camera, packets);
+      }
+      u32 uniformOffset = UpdateUniformBuffer(mCurrentFrame, camera);
+      vkResetCommandPool(mDevice, frame.mCommandPool, 0);
+      mRecorder.BeginFrame(mCurrentFrame);
+      RecordCommandBuffer(frame.mCommandBuffer, target.mImage, target.mView, extent,
+          VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, uniformOffset, drawn,
+          cull ? frame.mIndirectBuffer : VK_NULL_HANDLE);
+      SubmitFrame(&frame, VK_NULL_HANDLE, VK_NULL_HANDLE);
+      mCurrentFrame = (mCurrentFrame + 1) % mFramesInFlight;
+    }
+    mGraphicsTimeline.Wait(mGraphicsTimeline.GetLastSignaled());
+    return std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+           / frameCount;
   };
 
-  VkPipelineStageFlags sourceStage;
-  VkPipelineStageFlags destinationStage;
+  f64 drawOnly = measure(false);
+  fmt::print("[bench] draw only:                       {:>6.3f} ms/frame\n", drawOnly);
+  // first, so the cull buffers are created shared with the compute family
+  if (mAsyncCompute.IsAsync()) {
+    fmt::print("[bench] cull {}k on its own queue:     {:>6.3f} ms/frame\n", cullCount / 1024, measure(true));
+  } else {
+    fmt::print("[bench] cull on its own queue skipped, no compute queue apart from the graphics one\n");
+  }
 
-  if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-    barrier.srcAccessMask = 0;
-    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  vk::AsyncCompute serial(mDevice, *FindQueueFamilies(mPhysicalDevice).mGraphicsFamily, mGraphicsQueue,
+      mGraphicsQueue, &mGraphicsTimeline, &mGraphicsTimeline, &mGraphicsSubmits, MAX_FRAMES_IN_FLIGHT);
+  std::swap(mAsyncCompute, serial);
+  fmt::print("[bench] cull {}k on the graphics queue:  {:>6.3f} ms/frame\n", cullCount / 1024, measure(true));
+  std::swap(mAsyncCompute, serial);
+  serial.Destroy();
+  DestroyOffscreenTarget(target);
+}
 
-    sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-  } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
-             && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+void TriangleApp::RunFramePacingBenchmark()
+{
+  // How evenly the limiter spaces frames with nothing else going on, sleeping all the way to the deadline versus
+  // sleeping most of the way and spinning the rest. The spread is what shows up as stutter.
+  constexpr f64 frameRate = 240.0;
+  constexpr u64 frameCount = 240;
+
+  auto measure = [&](const char *name, bool spin) {
+    FramePacer pacer;
+    pacer.SetFrameRate(frameRate);
+    if (!spin) {
+      pacer.SetSpinMargin(FramePacer::Clock::duration::zero());
+    }
+    pacer.WaitForNextFrame(true);
+    auto last = FramePacer::Clock::now();
+    f64 sum = 0.0;
+    f64 sumSquares = 0.0;
+    f64 worst = 0.0;
+    for (u64 i = 0; i < frameCount; i++) {
+      pacer.WaitForNextFrame(true);
+      auto now = FramePacer::Clock::now();
+      f64 interval = std::chrono::duration<f64, std::milli>(now - last).count();
+      last = now;
+      sum += interval;
+      sumSquares += interval * interval;
+      worst = std::max(worst, interval);
+    }
+    f64 mean = sum / frameCount;
+    f64 stdDev = std::sqrt(std::max(0.0, sumSquares / frameCount - mean * mean));
+    fmt::print("[bench] limiter {} fps, {}: {:.3f} ms +- {:.3f} (max {:.3f}, target {:.3f})\n", frameRate, name, mean,
+        stdDev, worst, 1000.0 / frameRate);
+  };
+  measure("sleep only", false);
+  measure("sleep + spin", true);
+}
 
-    sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-  } else {
-    assert(false && "unsopported layout transition");
+void TriangleApp::RunRenderThreadBenchmark()
+{
+  // The same offscreen frames with a fixed slice of main thread work each, first simulated and rendered one after the
+  // other on one thread, then handed to a render thread through double buffered command lists. With the render
+  // thread the frame time drops from the sum of the two sides towards the longer of them.
+  constexpr u64 frameCount = 300;
+  constexpr VkExtent2D extent = {1024, 1024};
+  constexpr u32 drawCount = 512;
+  constexpr u32 instanceCount = 16;
+  constexpr auto cpuWork = std::chrono::microseconds(2000);
+  auto target = CreateOffscreenTarget(extent);
+
+  auto simulate = [&](RenderCommandList *list) {
+    auto start = std::chrono::high_resolution_clock::now();
+    while (std::chrono::high_resolution_clock::now() - start < cpuWork) {
+    }
+    list->mCamera = AnimateScene(extent);
+    BuildDrawPackets(drawCount, instanceCount, &list->mPackets);
+  };
+  auto render = [&](const RenderCommandList &list) {
+    auto &frame = mFrames[mCurrentFrame];
+    mGraphicsTimeline.Wait(frame.mSubmitted);
+    u32 uniformOffset = UpdateUniformBuffer(mCurrentFrame, list.mCamera);
+    vkResetCommandPool(mDevice, frame.mCommandPool, 0);
+    mRecorder.BeginFrame(mCurrentFrame);
+    RecordCommandBuffer(frame.mCommandBuffer, target.mImage, target.mView, extent,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, uniformOffset, list.mPackets);
+    SubmitFrame(&frame, VK_NULL_HANDLE, VK_NULL_HANDLE);
+    mCurrentFrame = (mCurrentFrame + 1) % mFramesInFlight;
+  };
+
+  RenderCommandList list;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (u64 i = 0; i < frameCount; i++) {
+    simulate(&list);
+    render(list);
+  }
+  mGraphicsTimeline.Wait(mGraphicsTimeline.GetLastSignaled());
+  f64 serial = std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+  DoubleBuffer<RenderCommandList> lists;
+  start = std::chrono::high_resolution_clock::now();
+  std::thread renderThread([&] {
+    for (u64 i = 0; i < frameCount; i++) {
+      render(lists.BeginRead());
+      lists.EndRead();
+    }
+  });
+  for (u64 i = 0; i < frameCount; i++) {
+    simulate(&lists.BeginWrite());
+    lists.EndWrite();
   }
+  renderThread.join();
+  mGraphicsTimeline.Wait(mGraphicsTimeline.GetLastSignaled());
+  f64 threaded = std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+  fmt::print("[bench] main + render on one thread: {:>6.3f} ms/frame\n", serial / frameCount);
+  fmt::print("[bench] render thread:               {:>6.3f} ms/frame ({:.2f}x)\n", threaded / frameCount,
+      serial / threaded);
+  DestroyOffscreenTarget(target);
+}
 
-  vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+void TriangleApp::PrintSyncStats(const char *label, const vk::SyncStats &before, u64 frames)
+{
+  auto stats = vk::GetSyncStats();
+  u64 barriers = stats.mBarriers - before.mBarriers;
+  u64 barrierCalls = stats.mBarrierCalls - before.mBarrierCalls;
+  u64 submissions = stats.mSubmissions - before.mSubmissions;
+  u64 queueSubmits = stats.mQueueSubmits - before.mQueueSubmits;
+  fmt::print("Sync {}: {} barriers in {} vkCmdPipelineBarrier calls, {} submissions as {} VkSubmitInfos in {} "
+             "vkQueueSubmit calls",
+      label, barriers, barrierCalls, submissions, stats.mSubmitInfos - before.mSubmitInfos, queueSubmits);
+  if (frames > 0) {
+    fmt::print(", {:.2f} barrier calls and {:.2f} vkQueueSubmit calls per frame", (f64)barrierCalls / frames,
+        (f64)queueSubmits / frames);
+  }
+  fmt::print("\n");
+}
 
-  EndSingleTimeCommands(commandBuffer);
+void TriangleApp::RunSyncBatchingBenchmark()
+{
+  // A batch of small textures used to cost a barrier per image on top of the release, and every upload batch and
+  // frame was a vkQueueSubmit of its own. Both are counted here rather than timed, the win is in driver and GPU
+  // overhead that a CPU timer around the calls doesn't see.
+  constexpr u32 imageCount = 16;
+  constexpr u32 imageSize = 64;
+  constexpr u32 frameCount = 64;
+  constexpr VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+  std::vector<u8> pixels((u64)imageSize * imageSize * 4, 0x3f);
+  std::vector<VkImage> images(imageCount);
+  std::vector<vk::Allocation> allocations(imageCount);
+
+  auto before = vk::GetSyncStats();
+  for (u32 i = 0; i < imageCount; i++) {
+    CreateTexture(TextureUpload::Staged, format, imageSize, imageSize, pixels.data(), &images[i], &allocations[i]);
+  }
+  mUploadManager.Wait(mUploadManager.Submit());
+  fmt::print("[bench] ");
+  PrintSyncStats("16 texture uploads", before, 0);
+
+  // an upload every frame, the batch leaves in the frame's vkQueueSubmit instead of one of its own
+  auto target = CreateOffscreenTarget(mSwapChainExtent);
+  std::vector<DrawPacket> packets;
+  BuildDrawPackets(1, 1, &packets);
+  before = vk::GetSyncStats();
+  for (u32 i = 0; i < frameCount; i++) {
+    auto &frame = mFrames[mCurrentFrame];
+    mGraphicsTimeline.Wait(frame.mSubmitted);
+    mUploadManager.Update();
+    // the previous upload into this image finished frames ago, the timeline wait above covers it
+    mUploadManager.UploadImage(images[i % imageCount], imageSize, imageSize, pixels.data(), pixels.size());
+    mUploadManager.Submit();
+
+    u32 uniformOffset = UpdateUniformBuffer(mCurrentFrame, AnimateScene(mSwapChainExtent));
+    vkResetCommandPool(mDevice, frame.mCommandPool, 0);
+    mRecorder.BeginFrame(mCurrentFrame);
+    RecordCommandBuffer(frame.mCommandBuffer, target.mImage, target.mView, mSwapChainExtent,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, uniformOffset, packets);
+    SubmitFrame(&frame, VK_NULL_HANDLE, VK_NULL_HANDLE);
+    mCurrentFrame = (mCurrentFrame + 1) % mFramesInFlight;
+  }
+  mGraphicsTimeline.Wait(mGraphicsTimeline.GetLastSignaled());
+  fmt::print("[bench] ");
+  PrintSyncStats("frames with an upload each", before, frameCount);
+
+  DestroyOffscreenTarget(target);
+  for (u32 i = 0; i < imageCount; i++) {
+    vkDestroyImage(mDevice, images[i], nullptr);
+    mAllocator.Free(allocations[i]);
+  }
 }
 
-void TriangleApp::CopyBufferToImage(VkBuffer buffer, VkImage image, u32 width, u32 height)
+void TriangleApp::RunRenderGraphBenchmark()
 {
-  auto commandBuffer = BeginSingleTimeCommands();
-  VkBufferImageCopy region = {
-      .bufferOffset = 0,
-      .bufferRowLength = 0,
-      .bufferImageHeight = 0,
-      .imageSubresource =
-          {
-              .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-              .mipLevel = 0,
-              .baseArrayLayer = 0,
-              .layerCount = 1,
-          },
-      .imageOffset = {0, 0, 0},
-      .imageExtent =
-          {
-              .width = width,
-              .height = height,
-              .depth = 1,
-          },
+  // A deferred style frame with nothing drawn, only the graph's own work is measured. The debug pass writes an image
+  // nobody reads so it gets culled, which ends the gbuffer's lifetime early enough for the bloom target to reuse its
+  // memory.
+  constexpr VkExtent2D extent = {1920, 1080};
+  constexpr VkExtent2D halfExtent = {extent.width / 2, extent.height / 2};
+  auto target = CreateOffscreenTarget(extent);
+  vk::RenderGraph graph(mDevice, &mAllocator, &mGraphicsTimeline, &mDeletionQueue);
+
+  auto build = [&] {
+    graph.Reset();
+    vk::RenderGraph::ImageState targetState = {VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT};
+    auto output = graph.ImportImage("output", target.mImage, target.mView, {mSwapChainImageFormat, extent},
+        targetState, {VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0});
+    auto albedo = graph.CreateImage("albedo", {VK_FORMAT_R8G8B8A8_UNORM, extent});
+    auto normals = graph.CreateImage("normals", {VK_FORMAT_R8G8B8A8_UNORM, extent});
+    auto lighting = graph.CreateImage("lighting", {VK_FORMAT_R16G16B16A16_SFLOAT, extent});
+    auto bloom = graph.CreateImage("bloom", {VK_FORMAT_R16G16B16A16_SFLOAT, halfExtent});
+    auto debug = graph.CreateImage("debug", {VK_FORMAT_R8G8B8A8_UNORM, extent});
+
+    VkClearColorValue clear = {};
+    auto nothing = [](const vk::RenderGraph::PassContext &) {};
+    graph.AddPass("gbuffer", VK_SUBPASS_CONTENTS_INLINE, nothing)
+        .WriteColor(albedo, &clear)
+        .WriteColor(normals, &clear);
+    graph.AddPass("lighting", VK_SUBPASS_CONTENTS_INLINE, nothing)
+        .ReadTexture(albedo)
+        .ReadTexture(normals)
+        .WriteColor(lighting, &clear);
+    graph.AddPass("bloom", VK_SUBPASS_CONTENTS_INLINE, nothing).ReadTexture(lighting).WriteColor(bloom, &clear);
+    graph.AddPass("debug", VK_SUBPASS_CONTENTS_INLINE, nothing).ReadTexture(albedo).WriteColor(debug, &clear);
+    graph.AddPass("composite", VK_SUBPASS_CONTENTS_INLINE, nothing)
+        .ReadTexture(lighting)
+        .ReadTexture(bloom)
+        .WriteColor(output, &clear);
   };
-  vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 
-  EndSingleTimeCommands(commandBuffer);
+  Bench("render graph: build + compile 5 passes", 10000, [&](u64) {
+    build();
+    graph.Compile();
+  });
+
+  // Real frames through every frame slot, so the barriers and render passes go through the driver and validation
+  // with earlier frames still using the same transients. Nothing waits between frames but the slot being reused.
+  constexpr u64 frameCount = 64;
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  auto name = fmt::format("render graph: 5 pass frame, {} in flight", mFramesInFlight);
+  Bench(name.c_str(), frameCount, [&](u64) {
+    auto &frame = mFrames[mCurrentFrame];
+    mGraphicsTimeline.Wait(frame.mSubmitted);
+    vkResetCommandPool(mDevice, frame.mCommandPool, 0);
+    vkBeginCommandBuffer(frame.mCommandBuffer, &beginInfo);
+    build();
+    graph.Compile();
+    graph.Execute(frame.mCommandBuffer);
+    vkEndCommandBuffer(frame.mCommandBuffer);
+    SubmitFrame(&frame, VK_NULL_HANDLE, VK_NULL_HANDLE);
+    mCurrentFrame = (mCurrentFrame + 1) % mFramesInFlight;
+  });
+  mGraphicsTimeline.Wait(mGraphicsTimeline.GetLastSignaled());
+
+  fmt::print("[bench] ");
+  graph.PrintStats();
+  graph.Destroy();
+  DestroyOffscreenTarget(target);
+}
+
+void TriangleApp::RunJobBenchmarks()
+{
+  // cost of pushing, stealing and finishing a job that does nothing
+  {
+    constexpr u64 jobCount = 200000;
+    JobCounter counter;
+    Bench("jobs: run + wait, empty job", jobCount, [&](u64 i) {
+      mJobs.Run([] {}, &counter);
+      if (i == jobCount - 1) {
+        mJobs.Wait(&counter);
+      }
+    });
+
+    std::atomic<u64> sum = 0;
+    Bench("jobs: parallel for, 1 item grains", 1, [&](u64) {
+      mJobs.ParallelFor((u32)jobCount, 1, [&](u32 begin, u32 end) { sum += end - begin; });
+    });
+    fmt::print("[bench] jobs: parallel for ran {} items\n", sum.load());
+  }
+
+  // a compute bound parallel for on 1..N threads, each thread count gets a job system of its own
+  {
+    constexpr u32 itemCount = 1 << 22;
+    constexpr u32 grainSize = 4096;
+    std::vector<f32> values(itemCount);
+    f64 singleThreaded = 0.0;
+    for (u32 threads = 1;; threads = std::min(threads * 2, mJobs.GetThreadCount())) {
+      // the single threaded run calls the kernel directly, its job system is never used
+      JobSystem jobs(std::max(1u, threads - 1));
+      std::string name = fmt::format("jobs: parallel for scaling, {} threads", threads);
+      auto kernel = [&](u32 begin, u32 end) {
+        for (u32 i = begin; i < end; i++) {
+          f32 x = (f32)i;
+          for (u32 j = 0; j < 32; j++) {
+            x = x * 0.999f + 1.0f / (1.0f + x);
+          }
+          values[i] = x;
+        }
+      };
+      f64 ns = Bench(name.c_str(), 4, [&](u64) {
+        if (threads == 1) {
+          kernel(0, itemCount);
+        } else {
+          jobs.ParallelFor(itemCount, grainSize, kernel);
+        }
+      });
+      if (threads == 1) {
+        singleThreaded = ns;
+      }
+      fmt::print("[bench] jobs: {} threads {:.2f}x\n", threads, singleThreaded / ns);
+      if (threads == mJobs.GetThreadCount()) {
+        break;
+      }
+    }
+  }
 }
 
-// next is Samplers
+void TriangleApp::RunFramePipeliningBenchmark()
+{
+  // Renders to an offscreen image instead of the swap chain so presentation and vsync don't hide the overlap. Each
+  // frame burns a fixed amount of CPU time standing in for game logic, and draws the quad enough times to give the
+  // GPU comparable work. With one frame in flight the two add up, with more they overlap.
+  constexpr u64 frameCount = 300;
+  constexpr VkExtent2D extent = {1024, 1024};
+  constexpr u32 instanceCount = 2048;
+  constexpr auto cpuWork = std::chrono::microseconds(2000);
+  auto target = CreateOffscreenTarget(extent);
+  std::vector<DrawPacket> packets;
+  BuildDrawPackets(1, instanceCount, &packets);
+
+  u32 savedFramesInFlight = mFramesInFlight;
+  for (u32 framesInFlight = 1; framesInFlight <= 3; framesInFlight++) {
+    SetFramesInFlight(framesInFlight);
+    std::vector<std::chrono::high_resolution_clock::time_point> submitTimes(MAX_FRAMES_IN_FLIGHT);
+    f64 totalLatency = 0.0;
+    u64 latencySamples = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (u64 i = 0; i < frameCount; i++) {
+      auto &frame = mFrames[mCurrentFrame];
+      mGraphicsTimeline.Wait(frame.mSubmitted);
+      auto now = std::chrono::high_resolution_clock::now();
+      // submit to the CPU seeing the frame complete, which is what input to display latency grows with
+      if (frame.mSubmitted != 0 && i >= framesInFlight) {
+        totalLatency += std::chrono::duration<f64, std::milli>(now - submitTimes[mCurrentFrame]).count();
+        latencySamples++;
+      }
+
+      while (std::chrono::high_resolution_clock::now() - now < cpuWork) {
+      }
+
+      u32 uniformOffset = UpdateUniformBuffer(mCurrentFrame, AnimateScene(mSwapChainExtent));
+      vkResetCommandPool(mDevice, frame.mCommandPool, 0);
+      mRecorder.BeginFrame(mCurrentFrame);
+      RecordCommandBuffer(frame.mCommandBuffer, target.mImage, target.mView, extent,
+          VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, uniformOffset, packets);
+      SubmitFrame(&frame, VK_NULL_HANDLE, VK_NULL_HANDLE);
+      submitTimes[mCurrentFrame] = std::chrono::high_resolution_clock::now();
+
+      mCurrentFrame = (mCurrentFrame + 1) % mFramesInFlight;
+    }
+    mGraphicsTimeline.Wait(mGraphicsTimeline.GetLastSignaled());
+    auto end = std::chrono::high_resolution_clock::now();
+
+    f64 seconds = std::chrono::duration<f64>(end - start).count();
+    fmt::print("[bench] frames in flight {}: {:>8.1f} frames/s, {:>6.2f} ms avg submit to completion latency\n",
+        framesInFlight, frameCount / seconds, latencySamples ? totalLatency / latencySamples : 0.0);
+  }
+  SetFramesInFlight(savedFramesInFlight);
+  DestroyOffscreenTarget(target);
+}
+
+void TriangleApp::RunParallelRecordingBenchmark()
+{
+  // CPU time to record a 10k draw frame as the recording threads go up, GPU time isn't part of it
+  constexpr u64 frameCount = 100;
+  constexpr u32 drawCount = 10000;
+  constexpr VkExtent2D extent = {256, 256};
+  auto target = CreateOffscreenTarget(extent);
+  std::vector<DrawPacket> packets;
+  BuildDrawPackets(drawCount, 1, &packets);
+
+  f64 singleThreaded = 0.0;
+  for (u32 threads = 1;; threads = std::min(threads * 2, mRecorder.GetThreadCount())) {
+    mRecorder.SetActiveThreads(threads);
+    f64 recordTime = 0.0;
+    for (u64 i = 0; i < frameCount; i++) {
+      auto &frame = mFrames[mCurrentFrame];
+      mGraphicsTimeline.Wait(frame.mSubmitted);
+
+      auto start = std::chrono::high_resolution_clock::now();
+      u32 uniformOffset = UpdateUniformBuffer(mCurrentFrame, AnimateScene(mSwapChainExtent));
+      vkResetCommandPool(mDevice, frame.mCommandPool, 0);
+      mRecorder.BeginFrame(mCurrentFrame);
+      RecordCommandBuffer(frame.mCommandBuffer, target.mImage, target.mView, extent,
+          VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, uniformOffset, packets);
+      recordTime += std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+      SubmitFrame(&frame, VK_NULL_HANDLE, VK_NULL_HANDLE);
+      mCurrentFrame = (mCurrentFrame + 1) % mFramesInFlight;
+    }
+
+    f64 average = recordTime / frameCount;
+    if (threads == 1) {
+      singleThreaded = average;
+    }
+    fmt::print("[bench] record {} draws on {:>2} threads: {:>8.3f} ms/frame ({:.2f}x)\n", drawCount, threads, average,
+        singleThreaded / average);
+    if (threads == mRecorder.GetThreadCount()) {
+      break;
+    }
+  }
+  mGraphicsTimeline.Wait(mGraphicsTimeline.GetLastSignaled());
+  mRecorder.SetActiveThreads(mRecorder.GetThreadCount());
+  DestroyOffscreenTarget(target);
+}
+
+TriangleApp::OffscreenTarget TriangleApp::CreateOffscreenTarget(VkExtent2D extent)
+{
+  OffscreenTarget target;
+  CreateImage(extent.width, extent.height, mSwapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &target.mImage, &target.mAllocation);
+  target.mView = CreateImageView(target.mImage, mSwapChainImageFormat);
+  return target;
+}
+
+void TriangleApp::DestroyOffscreenTarget(const OffscreenTarget &target)
+{
+  // the graph has framebuffers wrapping the view, a later view could be handed the same handle
+  mRenderGraph.ReleaseFramebuffers();
+  vkDestroyImageView(mDevice, target.mView, nullptr);
+  vkDestroyImage(mDevice, target.mImage, nullptr);
+  mAllocator.Free(target.mAllocation);
+}
@@ -1,5 +1,26 @@
 #pragma once
+#include "DoubleBuffer.hpp"
+#include "FramePacer.hpp"
+#include "JobSystem.hpp"
 #include "common.h"
+#include "vkAllocator.hpp"
+#include "vkAsyncCompute.hpp"
+#include "vkDeletionQueue.hpp"
+#include "vkHostImageCopy.hpp"
+#include "vkParallelRecorder.hpp"
+#include "vkPresentMode.hpp"
+#include "vkPipelineCache.hpp"
+#include "vkPipelineManager.hpp"
+#include "vkQueues.hpp"
+#include "vkReflection.hpp"
+#include "vkRenderGraph.hpp"
+#include "vkResources.hpp"
+#include "vkShaderCompiler.hpp"
+#include "vkShaderVariants.hpp"
+#include "vkSync.hpp"
+#include "vkTimeline.hpp"
+#include "vkUniformRing.hpp"
+#include "vkUploadManager.hpp"
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -11,6 +32,7 @@
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 #include <optional>
+#include <thread>
 #include <vector>
 #include <vulkan/vulkan.h>
 
@@ -21,48 +43,42 @@ struct UniformBufferObject
   alignas(16) glm::mat4 mProj;
 };
 
+// one indexed draw from the scene's vertex and index buffers
+struct DrawPacket
+{
+  u32 mIndexCount;
+  u32 mInstanceCount;
+  u32 mFirstIndex;
+  s32 mVertexOffset;
+};
+
 struct Vertex
 {
   glm::vec2 mPos;
   glm::vec3 mColor;
   glm::vec2 mTexCoord;
-
-  static VkVertexInputBindingDescription GetBindingDescription()
-  {
-    VkVertexInputBindingDescription bindingDescription{};
-
-    bindingDescription.binding = 0;
-    bindingDescription.stride = sizeof(Vertex);
-    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-    return bindingDescription;
-  }
-
-  static std::array<VkVertexInputAttributeDescription, 3> GetAttributeDescriptions()
-  {
-    std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions{};
-
-    attributeDescriptions[0].binding = 0;
-    attributeDescriptions[0].location = 0;
-    attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
-    attributeDescriptions[0].offset = offsetof(Vertex, mPos);
-
-    attributeDescriptions[1].binding = 0;
-    attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[1].offset = offsetof(Vertex, mColor);
-
-    attributeDescriptions[2].binding = 0;
-    attributeDescriptions[2].location = 2;
-    attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-    attributeDescriptions[2].offset = offsetof(Vertex, mTexCoord);
-
-    return attributeDescriptions;
-  }
 };
 
 class TriangleApp
 {
+  struct DecodedImage
+  {
+    u8 *mPixels = nullptr;
+    s32 mWidth = 0;
+    s32 mHeight = 0;
+  };
+
+  // ways of getting decoded pixels into a sampled texture, fastest first
+  enum class TextureUpload {
+    // VK_EXT_host_image_copy straight into an optimal image, no command buffers at all
+    HostImageCopy,
+    // memcpy into a linear image in host visible device local memory
+    LinearHostWrite,
+    // staging ring + vkCmdCopyBufferToImage on the transfer queue
+    Staged,
+  };
+
+  JobSystem mJobs;
   GLFWwindow *mWindow{nullptr};
   VkInstance mInstance{};
   VkDebugUtilsMessengerEXT mDebugMessenger{};
@@ -71,39 +87,162 @@ class TriangleApp
   VkQueue mGraphicsQueue{};
   VkSurfaceKHR mSurface{};
   VkQueue mPresentQueue{};
+  VkQueue mTransferQueue{};
+  VkQueue mComputeQueue{};
+  // one per queue, every submission signals the next value. The transfer and compute timelines are only created when
+  // uploads and dispatches have a queue of their own.
+  vk::Timeline mGraphicsTimeline;
+  vk::Timeline mTransferTimeline;
+  vk::Timeline mComputeTimeline;
+  // Everything for the graphics queue goes through mGraphicsSubmits, upload batches and dispatches queued during a
+  // frame leave with the frame's own vkQueueSubmit. The transfer and compute batches are only used when they have a
+  // queue of their own.
+  vk::SubmitBatch mGraphicsSubmits;
+  vk::SubmitBatch mTransferSubmits;
+  vk::SubmitBatch mComputeSubmits;
+  u64 mFramesSubmitted = 0;
   VkSwapchainKHR mSwapChain{};
   std::vector<VkImage> mSwapChainImages;
   VkFormat mSwapChainImageFormat;
   VkExtent2D mSwapChainExtent;
   std::vector<VkImageView> mSwapChainImageViews;
+  // owned by mRenderGraph, only there for the pipeline to be created against
   VkRenderPass mRenderPass;
-  VkPipelineLayout mPipelineLayout;
-  VkPipeline mGraphicsPipeline;
-  std::vector<VkFramebuffer> mSwapChainFramebuffers;
-  VkCommandPool mCommandPool;
-  std::vector<VkCommandBuffer> mCommandBuffers;
-  std::vector<VkSemaphore> mImageAvailableSemaphores;
-  std::vector<VkSemaphore> mRenderFinishedSemaphores;
-  std::vector<VkFence> mInFlightFences;
-  std::vector<VkFence> mImagesInFlight;
-  u64 mCurrentFrame = 0;
-  VkBuffer mVertexBuffer;
-  VkDeviceMemory mVertexBufferMemory;
-  VkBuffer mIndexBuffer;
-  VkDeviceMemory mIndexBufferMemory;
+  // the fallback variant, built up front and drawn with until mTrianglePipeline has compiled
+  vk::PipelineHandle mGraphicsPipeline;
+  // the variant asked for, invalid when it's the fallback
+  vk::PipelineFuture mTrianglePipeline;
+
+  // Everything one frame in flight owns. Indexed by frame slot rather than swap chain image, so recording a frame
+  // only ever waits for the frame that used the same slot N frames earlier.
+  struct FrameSlot
+  {
+    // reset as a whole every time the slot comes round
+    VkCommandPool mCommandPool = VK_NULL_HANDLE;
+    VkCommandBuffer mCommandBuffer = VK_NULL_HANDLE;
+    // the swap chain only takes binary semaphores
+    VkSemaphore mImageAvailable = VK_NULL_HANDLE;
+    VkSemaphore mRenderFinished = VK_NULL_HANDLE;
+    // graphics timeline value of the last submission from this slot, 0 if never
+    u64 mSubmitted = 0;
+    // the frame's draw packets and the indirect commands culling turns them into, grown to the largest frame so far
+    VkBuffer mPacketBuffer = VK_NULL_HANDLE;
+    vk::Allocation mPacketAllocation;
+    VkBuffer mIndirectBuffer = VK_NULL_HANDLE;
+    vk::Allocation mIndirectAllocation;
+    u32 mPacketCapacity = 0;
+    VkDescriptorSet mCullDescriptorSet = VK_NULL_HANDLE;
+    // compute timeline value the frame's culling signals, waited on by its graphics submission and then cleared
+    u64 mCulled = 0;
+  };
+  // always MAX_FRAMES_IN_FLIGHT slots, only the first mFramesInFlight are cycled through
+  std::vector<FrameSlot> mFrames;
+  u32 mFramesInFlight = 2;
+  u32 mCurrentFrame = 0;
+  // per slot, per thread pools for the secondary command buffers the render pass is recorded into
+  vk::ParallelRecorder mRecorder;
+  // how many times the quad is drawn each frame, one draw call each, stands in for a real scene
+  u32 mDrawCount = 1;
+  // Frustum culling on the compute queue, turns the frame's packets into indirect draws while the graphics queue is
+  // still busy with the previous frame. FOCUS_GPU_CULLING=0 draws the packets directly instead.
+  vk::AsyncCompute mAsyncCompute;
+  bool mGpuCulling = true;
+  // culled draws are issued up to this many per vkCmdDrawIndexedIndirect, 1 without multiDrawIndirect
+  u32 mMaxDrawIndirectCount = 1;
+  VkDescriptorSetLayout mCullSetLayout = VK_NULL_HANDLE;
+  vk::PipelineHandle mCullPipeline;
+  // invocations per workgroup, read from the shader
+  u32 mCullGroupSize = 1;
+  VkDescriptorPool mCullDescriptorPool = VK_NULL_HANDLE;
+  // model space bounding sphere of the quad, xyz centre and w radius
+  glm::vec4 mSceneBounds = {};
+
+  // Everything the render thread needs for a frame, built by the main thread. Lists are reused, once the packet
+  // vector has grown to the scene building one doesn't allocate.
+  struct RenderCommandList
+  {
+    UniformBufferObject mCamera;
+    std::vector<DrawPacket> mPackets;
+    // the framebuffer when the list was built, never zero sized
+    VkExtent2D mFramebufferExtent = {};
+    bool mFramebufferResized = false;
+    // 0 leaves it as it is
+    u32 mFramesInFlight = 0;
+    // the swap chain is recreated when this changes
+    VkPresentModeKHR mPresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+    // the render thread waits for the GPU to finish the frame before taking the next list
+    bool mLowLatency = false;
+    // when the main thread polled input for the frame
+    FramePacer::Clock::time_point mInputTime;
+    // nothing to draw, the render thread exits
+    bool mQuit = false;
+  };
+  // The main thread polls input and builds lists, the render thread records, submits and presents them. Only the
+  // render thread touches Vulkan while MainLoop runs, and only the main thread touches GLFW.
+  DoubleBuffer<RenderCommandList> mRenderCommands;
+  std::thread mRenderThread;
+  // framebuffer size from the latest list, what the swap chain is created at when the surface leaves it up to us
+  VkExtent2D mFramebufferExtent = {};
+  // the surface was 0x0 when the swap chain needed recreating, the old one is kept and frames are dropped until it
+  // isn't, render thread
+  bool mSwapChainDeferred = false;
+  // time each side spent blocked on the other, in ms
+  f64 mMainThreadWait = 0.0;
+  f64 mRenderThreadWait = 0.0;
+  u64 mRenderedFrames = 0;
+  // main thread
+  FramePacer mPacer;
+  // what F switches the limit to
+  f64 mFrameRateLimit = 60.0;
+  // render thread once MainLoop runs, the mode asked for and the one the surface gave us
+  VkPresentModeKHR mPresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+  VkPresentModeKHR mSwapChainPresentMode = VK_PRESENT_MODE_MAX_ENUM_KHR;
+  // requests from GLFW callbacks, main thread only, passed on with the next render command list
+  u32 mFramesInFlightRequest = 0;
+  VkPresentModeKHR mPresentModeSetting = VK_PRESENT_MODE_MAILBOX_KHR;
+
+  vk::Allocator mAllocator;
+  // anything replaced while frames may still use it, updated once per frame on the render thread
+  vk::DeletionQueue mDeletionQueue;
+  // buffers, images, samplers and pipelines behind generational handles
+  vk::ResourceRegistry mResources;
+  vk::HostImageCopy mHostImageCopy;
+  vk::PipelineCache mPipelineCache;
+  vk::PipelineManager mPipelines;
+  // descriptor set and pipeline layouts built from shader reflection, shared by every pipeline that matches
+  vk::LayoutCache mLayouts;
+  // rebuilt every frame, keeps the render passes, framebuffers and transient images between frames
+  vk::RenderGraph mRenderGraph;
+  vk::UploadManager mUploadManager;
+  vk::BufferHandle mVertexBuffer;
+  vk::BufferHandle mIndexBuffer;
   VkDescriptorSetLayout mDescriptorSetLayout;
-  std::vector<VkBuffer> mUniformBuffers;
-  std::vector<VkDeviceMemory> mUniformBuffersMemory;
+  vk::UniformRing mUniformRing;
   VkDescriptorPool mDescriptorPool;
-  std::vector<VkDescriptorSet> mDescriptorSets;
-  VkImage mTextureImage;
-  VkDeviceMemory mTextureImageMemory;
-  VkImageView mTextureImageView;
-  VkSampler mTextureSampler;
+  VkDescriptorSet mDescriptorSet;
+  // decoded on a worker while the device and pipeline are being set up
+  JobCounter mTextureDecodeCounter;
+  DecodedImage mTextureDecode;
+  vk::ImageHandle mTexture;
+  vk::SamplerHandle mTextureSampler;
+  // compiled on workers alongside device creation, kept around for pipelines rebuilt later
+  vk::ShaderCompiler mShaderCompiler;
+  JobCounter mShaderCounter;
+  std::vector<char> mCullSpirv;
+  // every permutation of the triangle shaders, only the ones drawn with are built
+  vk::ShaderVariants mTriangleShaders;
+  vk::VariantKey mTriangleVariant = 0;
+  // generic enough to stand in for any variant while it compiles
+  vk::VariantKey mFallbackVariant = 0;
+  // the triangle shaders' stages merged, the uniform buffer switched to dynamic
+  vk::ShaderReflection mGraphicsReflection;
 
   const u32 WIDTH = 600;
   const u32 HEIGHT = 800;
-  const s32 MAX_FRAMES_IN_FLIGHT = 2;
+  // upper bound for SetFramesInFlight, the uniform ring has a partition per slot
+  const u32 MAX_FRAMES_IN_FLIGHT = 4;
+  // size of each frame's partition of the uniform ring
+  const VkDeviceSize UNIFORM_FRAME_SIZE = 16 * 1024;
 
   const std::vector<const char *> mValidationLayers = {"VK_LAYER_KHRONOS_validation"};
   const std::vector<const char *> mDeviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
@@ -121,6 +260,10 @@ class TriangleApp
   {
     std::optional<u32> mGraphicsFamily;
     std::optional<u32> mPresentFamily;
+    // always found once there is a graphics family, both fall back to sharing the graphics queue
+    vk::QueueSelection mTransfer;
+    vk::QueueSelection mCompute;
+    u32 mFamilyCount = 0;
 
     bool IsComplete() const
     {
@@ -140,12 +283,25 @@ class TriangleApp
   };
 
 public:
+  // set from GLFW callbacks on the main thread and passed on with the next render command list
   bool mFramebufferResized = false;
   void Run();
+  // Keyboard controls, main thread:
+  //  1-4 frames in flight
+  //  P   cycles present modes
+  //  L   toggles low latency mode
+  //  F   toggles the frame rate limit between off and FOCUS_FRAME_RATE_LIMIT, 60 if that isn't set
+  void OnKeyPressed(s32 key);
+  // Takes effect from the next frame, clamped to [1, MAX_FRAMES_IN_FLIGHT]. Render thread only once MainLoop is
+  // running, the main thread goes through mFramesInFlightRequest.
+  void SetFramesInFlight(u32 count);
 
 private:
   void InitWindow();
   void InitVulkan();
+  // present mode, frame rate limit and low latency mode from FOCUS_PRESENT_MODE, FOCUS_FRAME_RATE_LIMIT and
+  // FOCUS_LOW_LATENCY
+  void ConfigurePacing();
 
   void CreateInstance();
 
@@ -168,61 +324,112 @@ private:
 
   QueueFamilyIndices FindQueueFamilies(VkPhysicalDevice device);
   void CreateLogicalDevice();
+  void CreateAllocator();
+  void CreateRenderGraph();
+  void CreatePipelineCache();
 
   void CreateSurface();
 
   VkSurfaceFormatKHR
   ChooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR> &availableFormats);
 
-  VkPresentModeKHR
-  ChooseSwapPresentMode(const std::vector<VkPresentModeKHR> &availablePresentModes);
-
   void CreateSwapChain();
 
   void CreateRenderPass();
+  // declares the triangle shaders' features and starts building the variant in use on a worker
+  void CreateTriangleShaders();
+  // the fallback pipeline now and the variant asked for on a worker
   void CreateGraphicsPipeline();
+  // safe on a worker, returns VK_NULL_HANDLE if the driver fails to create it
+  NODISCARD VkPipeline BuildGraphicsPipeline(
+      vk::VariantKey variantKey, VkPipelineLayout pipelineLayout, VkRenderPass renderPass);
   void CreateImageViews();
 
   void CreateImage(
       u32 width, u32 height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
-      VkMemoryPropertyFlags properties, VkImage *image, VkDeviceMemory *imageMemory);
-  void TransitionImageLayout(
-      VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout);
-  void CopyBufferToImage(VkBuffer buffer, VkImage image, u32 width, u32 height);
+      VkMemoryPropertyFlags properties, VkImage *image, vk::Allocation *imageAllocation);
   VkShaderModule CreateShaderModule(const std::vector<char> &code);
 
-  void CreateFrameBuffers();
-
-  void CreateCommandBuffers();
-
-  void CreateSyncObjects();
-
-  void CreateCommandPool();
+  void CreateFrameSlots();
+  void DestroyFrameSlots();
+  void CreateAsyncCompute();
+  void CreateCullPipeline();
+  // grows the slot's packet and indirect buffers to hold packetCount, the GPU must be done with the slot
+  void ReserveCullBuffers(FrameSlot *frame, u32 packetCount);
+  // Queues frustum culling of packets into the slot's indirect buffer on the compute queue, the slot's next
+  // SubmitFrame waits for it. The GPU must be done with the slot's previous frame.
+  void DispatchCulling(u32 frameSlot, const UniformBufferObject &camera, const std::vector<DrawPacket> &packets);
+  // Builds the frame's render graph around target and records it, the packets are split across the recording
+  // threads. The target is left in finalLayout. With an indirect buffer packet i is drawn from command i in it
+  // rather than from the packet itself.
+  void RecordCommandBuffer(VkCommandBuffer commandBuffer, VkImage target, VkImageView targetView, VkExtent2D extent,
+      VkImageLayout finalLayout, u32 uniformOffset, const std::vector<DrawPacket> &packets,
+      VkBuffer indirectBuffer = VK_NULL_HANDLE);
+  // drawCount draws of the quad, instanceCount instances each
+  void BuildDrawPackets(u32 drawCount, u32 instanceCount, std::vector<DrawPacket> *packets);
+  // Submits the slot's command buffer to the graphics queue and records the timeline value it signals. The binary
+  // semaphores are for the swap chain and may be null when rendering offscreen.
+  void SubmitFrame(FrameSlot *frame, VkSemaphore imageAvailable, VkSemaphore renderFinished);
+
+
+  void CreateUploadManager();
 
   void RecreateSwapChain();
   void MainLoop();
-
-  void DrawFrame();
+  // main thread side, the scene simulation and everything else that doesn't need Vulkan
+  void BuildRenderCommands(RenderCommandList *list, VkExtent2D framebufferExtent);
+  void RenderLoop();
+  void DrawFrame(const RenderCommandList &list);
 
   void CleanupSwapChain();
   void CleanUp();
   void CreateVertexBuffer();
-  u32 FindMemoryType(u32 typeFilter, VkMemoryPropertyFlags properties);
+  u32 FindMemoryType(u32 typeFilter, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred = 0);
+  // sharedFamilies are the queue families using the buffer concurrently, exclusive if there are fewer than two
   void CreateBuffer(
       VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-      VkBuffer *buffer, VkDeviceMemory *bufferMemory);
+      VkBuffer *buffer, vk::Allocation *bufferAllocation, const std::vector<u32> &sharedFamilies = {});
+  // creates a device local buffer holding data, written in place on unified memory and staged otherwise
+  NODISCARD vk::BufferHandle CreateDeviceLocalBuffer(const void *data, VkDeviceSize size, VkBufferUsageFlags usage);
+  bool CanSampleLinearImage(VkFormat format, u32 width, u32 height);
 
-  void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-  VkCommandBuffer BeginSingleTimeCommands();
-  void EndSingleTimeCommands(VkCommandBuffer commandBuffer);
   void CreateIndexBuffer();
   void CreateDescriptorSetLayout();
   void CreateUniformBuffers();
-  void UpdateUniformBuffer(u32 imageIndex);
+  // the spinning quad and the camera looking at it, aspect ratio from extent
+  NODISCARD UniformBufferObject AnimateScene(VkExtent2D extent);
+  // pushes this frame's uniforms into the slot's partition of the ring, returns the dynamic offset to bind
+  NODISCARD u32 UpdateUniformBuffer(u32 frameSlot, const UniformBufferObject &ubo);
   void CreateDescriptorPool();
   void CreateDescriptorSets();
+  // points the descriptor set at the current uniform ring and texture
+  void UpdateDescriptorSets();
   void CreateTextureImage();
+  NODISCARD TextureUpload ChooseTextureUpload(VkFormat format, u32 width, u32 height);
+  void CreateTexture(TextureUpload path, VkFormat format, u32 width, u32 height, const void *pixels, VkImage *image,
+      vk::Allocation *imageAllocation);
   void CreateTextureImageView();
   VkImageView CreateImageView(VkImage image, VkFormat format);
   void CreateTextureSampler();
+
+  void RunBenchmarks();
+  // a colour target outside the swap chain for the benchmarks to render into
+  struct OffscreenTarget
+  {
+    VkImage mImage = VK_NULL_HANDLE;
+    vk::Allocation mAllocation;
+    VkImageView mView = VK_NULL_HANDLE;
+  };
+  NODISCARD OffscreenTarget CreateOffscreenTarget(VkExtent2D extent);
+  void DestroyOffscreenTarget(const OffscreenTarget &target);
+  void RunFramePipeliningBenchmark();
+  void RunParallelRecordingBenchmark();
+  void RunJobBenchmarks();
+  void RunRenderGraphBenchmark();
+  void RunRenderThreadBenchmark();
+  void RunFramePacingBenchmark();
+  void RunAsyncComputeBenchmark();
+  void RunHandlePoolBenchmark();
+  void RunSyncBatchingBenchmark();
+  void PrintSyncStats(const char *label, const vk::SyncStats &before, u64 frames);
 };
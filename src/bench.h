@@ -0,0 +1,26 @@
+#pragma once
+#include "common.h"
+
+#include <chrono>
+#include <fmt/core.h>
+
+// Benchmarks are run from TriangleApp::RunBenchmarks when FOCUS_BENCH is set in the environment
+inline bool BenchmarksEnabled()
+{
+  return getenv("FOCUS_BENCH") != nullptr;
+}
+
+// Times `iterations` calls of func and prints the average cost of one call, returns the average in nanoseconds
+template<typename Func>
+f64 Bench(const char *name, u64 iterations, Func &&func)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  for (u64 i = 0; i < iterations; i++) {
+    func(i);
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  f64 total = std::chrono::duration<f64, std::nano>(end - start).count();
+  f64 average = total / (f64)iterations;
+  fmt::print("[bench] {:<48} {:>12.1f} ns/iter ({} iters)\n", name, average, iterations);
+  return average;
+}
@@ -2,10 +2,17 @@
 #include "common.h"
 #include "vkCore.hpp"
 
+#include <cstring>
+
 int main(int argc, char **argv)
 {
-  //  TriangleApp triangleApp;
-  //  triangleApp.Run();
-  vk::Core core(true);
+  // --core only brings up vk::Core and exits, it has nothing to draw with yet
+  if (argc > 1 && strcmp(argv[1], "--core") == 0) {
+    vk::Core core(true);
+    return 0;
+  }
+  // FOCUS_BENCH runs the benchmarks once TriangleApp is initialised, then carries on rendering
+  TriangleApp triangleApp;
+  triangleApp.Run();
   return 0;
 }
@@ -0,0 +1,280 @@
+#include "vkAllocator.hpp"
+
+#include "common.h"
+
+#include <algorithm>
+#include <cassert>
+#include <fmt/core.h>
+
+namespace vk
+{
+
+static VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+Allocator::Allocator(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize) :
+    mDevice(device), mBlockSize(blockSize)
+{
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &mMemoryProperties);
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  mBufferImageGranularity = properties.limits.bufferImageGranularity;
+  mMaxAllocationCount = properties.limits.maxMemoryAllocationCount;
+
+  // the largest device local heap is where resources live, if a coherent host visible type sits on it the CPU can
+  // write resources in place. A small BAR heap on a discrete card doesn't count.
+  constexpr VkMemoryPropertyFlags direct =
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  VkDeviceSize largestDeviceHeap = 0;
+  for (u32 i = 0; i < mMemoryProperties.memoryHeapCount; i++) {
+    if (mMemoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+      largestDeviceHeap = std::max(largestDeviceHeap, mMemoryProperties.memoryHeaps[i].size);
+    }
+  }
+  for (u32 i = 0; i < mMemoryProperties.memoryTypeCount; i++) {
+    const auto &type = mMemoryProperties.memoryTypes[i];
+    if ((type.propertyFlags & direct) == direct
+        && mMemoryProperties.memoryHeaps[type.heapIndex].size == largestDeviceHeap) {
+      mUnifiedMemory = true;
+    }
+  }
+}
+
+u32 Allocator::FindMemoryType(u32 typeFilter, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) const
+{
+  u32 best = UINT32_MAX;
+  s32 bestScore = INT32_MIN;
+  for (u32 i = 0; i < mMemoryProperties.memoryTypeCount; i++) {
+    auto flags = mMemoryProperties.memoryTypes[i].propertyFlags;
+    if (!(typeFilter & (1 << i)) || (flags & required) != required) {
+      continue;
+    }
+    s32 score = 2 * __builtin_popcount(flags & preferred) - __builtin_popcount(flags & ~(required | preferred));
+    if (score > bestScore) {
+      best = i;
+      bestScore = score;
+    }
+  }
+  passert("failed to find suitable memory type\n", (best != UINT32_MAX));
+  return best;
+}
+
+Allocation Allocator::Allocate(const VkMemoryRequirements &requirements, u32 memoryType, bool linear)
+{
+  assert(memoryType < mMemoryProperties.memoryTypeCount);
+  Allocation allocation;
+
+  // Anything that would take up most of a block gets its own allocation so it can't fragment the shared blocks
+  if (requirements.size > mBlockSize / 2) {
+    u32 blockIndex = CreateBlock(memoryType, requirements.size, linear, true);
+    bool allocated = TryAllocateFromBlock(blockIndex, requirements.size, requirements.alignment, &allocation);
+    passert("failed to allocate from dedicated block\n", allocated);
+    return allocation;
+  }
+
+  for (u32 i = 0; i < mBlocks.size(); i++) {
+    const auto &block = mBlocks[i];
+    // with a granularity of 1 linear and optimal resources can sit next to each other freely
+    bool granularityConflict = block.mLinear != linear && mBufferImageGranularity > 1;
+    if (block.mMemory == VK_NULL_HANDLE || block.mDedicated || block.mMemoryType != memoryType
+        || granularityConflict) {
+      continue;
+    }
+    if (TryAllocateFromBlock(i, requirements.size, requirements.alignment, &allocation)) {
+      return allocation;
+    }
+  }
+
+  // clamp the block size so small heaps (e.g. the 256MB BAR heap) don't get eaten by a couple of blocks
+  const auto &heap = mMemoryProperties.memoryHeaps[mMemoryProperties.memoryTypes[memoryType].heapIndex];
+  VkDeviceSize blockSize = std::min(mBlockSize, heap.size / 8);
+  blockSize = std::max(blockSize, requirements.size);
+  u32 blockIndex = CreateBlock(memoryType, blockSize, linear, false);
+  bool allocated = TryAllocateFromBlock(blockIndex, requirements.size, requirements.alignment, &allocation);
+  passert("failed to allocate from new block\n", allocated);
+  return allocation;
+}
+
+void Allocator::Free(const Allocation &allocation)
+{
+  if (allocation.mMemory == VK_NULL_HANDLE) {
+    return;
+  }
+  assert(allocation.mBlockIndex < mBlocks.size());
+  auto &block = mBlocks[allocation.mBlockIndex];
+  assert(block.mMemory == allocation.mMemory);
+
+  block.mUsed -= allocation.mSize;
+  block.mAllocationCount--;
+  if (block.mDedicated) {
+    DestroyBlock(allocation.mBlockIndex);
+    return;
+  }
+  if (block.mAllocationCount == 0) {
+    // keep a single empty block per memory type around so short lived staging buffers don't churn vkAllocateMemory
+    for (u32 i = 0; i < mBlocks.size(); i++) {
+      const auto &other = mBlocks[i];
+      if (i != allocation.mBlockIndex && other.mMemory != VK_NULL_HANDLE && other.mAllocationCount == 0
+          && !other.mDedicated && other.mMemoryType == block.mMemoryType && other.mLinear == block.mLinear) {
+        DestroyBlock(allocation.mBlockIndex);
+        return;
+      }
+    }
+    block.mFreeRanges.clear();
+    block.mFreeRanges.push_back({0, block.mSize});
+    return;
+  }
+
+  // insert the range back in offset order and merge it with its neighbours
+  auto it = std::lower_bound(block.mFreeRanges.begin(), block.mFreeRanges.end(), allocation.mOffset,
+      [](const Range &range, VkDeviceSize offset) { return range.mOffset < offset; });
+  it = block.mFreeRanges.insert(it, {allocation.mOffset, allocation.mSize});
+  auto next = it + 1;
+  if (next != block.mFreeRanges.end() && it->mOffset + it->mSize == next->mOffset) {
+    it->mSize += next->mSize;
+    block.mFreeRanges.erase(next);
+  }
+  if (it != block.mFreeRanges.begin()) {
+    auto prev = it - 1;
+    if (prev->mOffset + prev->mSize == it->mOffset) {
+      prev->mSize += it->mSize;
+      block.mFreeRanges.erase(it);
+    }
+  }
+}
+
+AllocatorStats Allocator::GetStats() const
+{
+  AllocatorStats stats;
+  VkDeviceSize totalFree = 0;
+  for (const auto &block : mBlocks) {
+    if (block.mMemory == VK_NULL_HANDLE) {
+      continue;
+    }
+    stats.mBlockCount++;
+    stats.mAllocationCount += block.mAllocationCount;
+    stats.mBytesAllocated += block.mSize;
+    stats.mBytesUsed += block.mUsed;
+    for (const auto &range : block.mFreeRanges) {
+      totalFree += range.mSize;
+      stats.mLargestFreeRange = std::max(stats.mLargestFreeRange, range.mSize);
+    }
+  }
+  if (totalFree > 0) {
+    stats.mFragmentation = 1.0f - ((f32)stats.mLargestFreeRange / (f32)totalFree);
+  }
+  return stats;
+}
+
+void Allocator::PrintStats() const
+{
+  auto stats = GetStats();
+  fmt::print("Allocator: {} blocks, {} allocations, {}/{} KiB used, largest free {} KiB, fragmentation {:.2f}\n",
+      stats.mBlockCount, stats.mAllocationCount, stats.mBytesUsed / 1024, stats.mBytesAllocated / 1024,
+      stats.mLargestFreeRange / 1024, stats.mFragmentation);
+}
+
+void Allocator::Destroy()
+{
+  for (u32 i = 0; i < mBlocks.size(); i++) {
+    if (mBlocks[i].mMemory != VK_NULL_HANDLE) {
+      DestroyBlock(i);
+    }
+  }
+  mBlocks.clear();
+}
+
+bool Allocator::TryAllocateFromBlock(u32 blockIndex, VkDeviceSize size, VkDeviceSize alignment, Allocation *allocation)
+{
+  auto &block = mBlocks[blockIndex];
+  for (u64 i = 0; i < block.mFreeRanges.size(); i++) {
+    Range range = block.mFreeRanges[i];
+    VkDeviceSize offset = AlignUp(range.mOffset, alignment);
+    if (offset + size > range.mOffset + range.mSize) {
+      continue;
+    }
+
+    // split the range into the leading alignment padding and the tail, dropping whichever ends up empty
+    Range head = {range.mOffset, offset - range.mOffset};
+    Range tail = {offset + size, (range.mOffset + range.mSize) - (offset + size)};
+    block.mFreeRanges.erase(block.mFreeRanges.begin() + i);
+    if (tail.mSize > 0) {
+      block.mFreeRanges.insert(block.mFreeRanges.begin() + i, tail);
+    }
+    if (head.mSize > 0) {
+      block.mFreeRanges.insert(block.mFreeRanges.begin() + i, head);
+    }
+
+    block.mUsed += size;
+    block.mAllocationCount++;
+    *allocation = {
+        .mMemory = block.mMemory,
+        .mOffset = offset,
+        .mSize = size,
+        .mMemoryType = block.mMemoryType,
+        .mBlockIndex = blockIndex,
+        .mLinear = block.mLinear,
+        .mMapped = block.mMapped ? (u8 *)block.mMapped + offset : nullptr,
+    };
+    return true;
+  }
+  return false;
+}
+
+u32 Allocator::CreateBlock(u32 memoryType, VkDeviceSize size, bool linear, bool dedicated)
+{
+  u32 liveBlocks = 0;
+  u32 blockIndex = (u32)mBlocks.size();
+  for (u32 i = 0; i < mBlocks.size(); i++) {
+    if (mBlocks[i].mMemory != VK_NULL_HANDLE) {
+      liveBlocks++;
+    } else if (blockIndex == mBlocks.size()) {
+      blockIndex = i;
+    }
+  }
+  bool underLimit = liveBlocks < mMaxAllocationCount;
+  passert("hit maxMemoryAllocationCount\n", underLimit);
+  if (blockIndex == mBlocks.size()) {
+    mBlocks.emplace_back();
+  }
+
+  auto &block = mBlocks[blockIndex];
+  block = {};
+  block.mSize = size;
+  block.mMemoryType = memoryType;
+  block.mLinear = linear;
+  block.mDedicated = dedicated;
+  block.mFreeRanges.push_back({0, size});
+
+  VkMemoryAllocateInfo allocInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .allocationSize = size,
+      .memoryTypeIndex = memoryType,
+  };
+  if (vkAllocateMemory(mDevice, &allocInfo, nullptr, &block.mMemory) != VK_SUCCESS) {
+    fmt::print("failed to allocate memory block\n");
+    assert(0);
+  }
+
+  if (mMemoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    if (vkMapMemory(mDevice, block.mMemory, 0, VK_WHOLE_SIZE, 0, &block.mMapped) != VK_SUCCESS) {
+      fmt::print("failed to map memory block\n");
+      assert(0);
+    }
+  }
+  return blockIndex;
+}
+
+void Allocator::DestroyBlock(u32 blockIndex)
+{
+  auto &block = mBlocks[blockIndex];
+  if (block.mMapped) {
+    vkUnmapMemory(mDevice, block.mMemory);
+  }
+  vkFreeMemory(mDevice, block.mMemory, nullptr);
+  block = {};
+}
+
+} // namespace vk
@@ -0,0 +1,95 @@
+#pragma once
+#include "common.h"
+
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace vk
+{
+
+// A sub-allocated range of a larger VkDeviceMemory block
+struct Allocation {
+  VkDeviceMemory mMemory = VK_NULL_HANDLE;
+  VkDeviceSize mOffset = 0;
+  VkDeviceSize mSize = 0;
+  u32 mMemoryType = 0;
+  u32 mBlockIndex = 0;
+  bool mLinear = true;
+  // only set when the memory type is HOST_VISIBLE, blocks are mapped once for their whole lifetime
+  void *mMapped = nullptr;
+};
+
+struct AllocatorStats {
+  u32 mBlockCount = 0;
+  u32 mAllocationCount = 0;
+  VkDeviceSize mBytesAllocated = 0;
+  VkDeviceSize mBytesUsed = 0;
+  VkDeviceSize mLargestFreeRange = 0;
+  // 0 means all free space is contiguous, approaches 1 as the free space gets split into small ranges
+  f32 mFragmentation = 0.0f;
+};
+
+class Allocator
+{
+  static constexpr VkDeviceSize sDefaultBlockSize = 64ull * 1024 * 1024;
+
+  struct Range {
+    VkDeviceSize mOffset;
+    VkDeviceSize mSize;
+  };
+
+  struct Block {
+    VkDeviceMemory mMemory = VK_NULL_HANDLE;
+    VkDeviceSize mSize = 0;
+    VkDeviceSize mUsed = 0;
+    u32 mMemoryType = 0;
+    u32 mAllocationCount = 0;
+    // linear (buffers, linear images) and optimal (tiled images) resources only share a block when
+    // bufferImageGranularity is 1, so neighbouring allocations never need padding out to the granularity
+    bool mLinear = true;
+    bool mDedicated = false;
+    void *mMapped = nullptr;
+    // sorted by offset, adjacent ranges are always merged
+    std::vector<Range> mFreeRanges;
+  };
+
+  VkDevice mDevice = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties mMemoryProperties = {};
+  VkDeviceSize mBufferImageGranularity = 1;
+  u32 mMaxAllocationCount = 0;
+  VkDeviceSize mBlockSize = sDefaultBlockSize;
+  bool mUnifiedMemory = false;
+
+  // indexed by Allocation::mBlockIndex, freed blocks leave an empty slot that gets reused
+  std::vector<Block> mBlocks;
+
+public:
+  Allocator() = default;
+  Allocator(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize = sDefaultBlockSize);
+
+  // Picks the memory type that has every required flag, as many preferred flags as possible and as few flags
+  // that weren't asked for, so e.g. staging buffers stay out of the small DEVICE_LOCAL | HOST_VISIBLE BAR heap
+  NODISCARD u32 FindMemoryType(
+      u32 typeFilter, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred = 0) const;
+
+  NODISCARD Allocation Allocate(const VkMemoryRequirements &requirements, u32 memoryType, bool linear);
+  void Free(const Allocation &allocation);
+
+  NODISCARD AllocatorStats GetStats() const;
+  void PrintStats() const;
+
+  // frees every block, all allocations must have been released by this point
+  void Destroy();
+
+  NODISCARD const VkPhysicalDeviceMemoryProperties &GetMemoryProperties() const { return mMemoryProperties; }
+  // true when the main device local heap can be written directly by the CPU (integrated GPUs, software drivers
+  // and resizable BAR), in which case uploads can skip the staging copy entirely
+  NODISCARD bool IsUnifiedMemory() const { return mUnifiedMemory; }
+
+private:
+  bool TryAllocateFromBlock(u32 blockIndex, VkDeviceSize size, VkDeviceSize alignment, Allocation *allocation);
+  u32 CreateBlock(u32 memoryType, VkDeviceSize size, bool linear, bool dedicated);
+  void DestroyBlock(u32 blockIndex);
+};
+
+} // namespace vk
@@ -0,0 +1,166 @@
+#include "vkAsyncCompute.hpp"
+
+#include "common.h"
+
+#include <cassert>
+#include <fmt/core.h>
+
+namespace vk
+{
+
+VkPipeline CreateComputePipeline(VkDevice device, VkPipelineCache cache, VkPipelineLayout layout,
+    const std::vector<char> &spirv, const char *entryPoint)
+{
+  VkShaderModuleCreateInfo moduleInfo = {
+      .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+      .codeSize = spirv.size(),
+      .pCode = (const u32 *)spirv.data(),
+  };
+  VkShaderModule module;
+  if (vkCreateShaderModule(device, &moduleInfo, nullptr, &module) != VK_SUCCESS) {
+    fmt::print("failed to create compute shader module\n");
+    assert(0);
+  }
+
+  VkComputePipelineCreateInfo pipelineInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+      .stage =
+          {
+              .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+              .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+              .module = module,
+              .pName = entryPoint,
+          },
+      .layout = layout,
+      .basePipelineIndex = -1,
+  };
+  VkPipeline pipeline;
+  if (vkCreateComputePipelines(device, cache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+    fmt::print("failed to create compute pipeline\n");
+    assert(0);
+  }
+  vkDestroyShaderModule(device, module, nullptr);
+  return pipeline;
+}
+
+AsyncCompute::AsyncCompute(VkDevice device, u32 family, VkQueue queue, VkQueue graphicsQueue, Timeline *timeline,
+    Timeline *graphicsTimeline, SubmitBatch *submits, u32 slotCount) :
+    mDevice(device),
+    mFamily(family),
+    mQueue(queue),
+    mGraphicsQueue(graphicsQueue),
+    mTimeline(timeline),
+    mGraphicsTimeline(graphicsTimeline),
+    mSubmits(submits)
+{
+  mSlots.resize(slotCount);
+  for (auto &slot : mSlots) {
+    VkCommandPoolCreateInfo poolInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = mFamily,
+    };
+    if (vkCreateCommandPool(mDevice, &poolInfo, nullptr, &slot.mCommandPool) != VK_SUCCESS) {
+      fmt::print("failed to create compute command pool\n");
+      assert(0);
+    }
+    VkCommandBufferAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = slot.mCommandPool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    if (vkAllocateCommandBuffers(mDevice, &allocInfo, &slot.mCommandBuffer) != VK_SUCCESS) {
+      fmt::print("failed to allocate compute command buffer\n");
+      assert(0);
+    }
+  }
+}
+
+void AsyncCompute::Destroy()
+{
+  for (auto &slot : mSlots) {
+    vkDestroyCommandPool(mDevice, slot.mCommandPool, nullptr);
+  }
+  mSlots.clear();
+}
+
+VkCommandBuffer AsyncCompute::Begin(u32 slot)
+{
+  assert(slot < mSlots.size() && mRecording == ~0u);
+  auto &current = mSlots[slot];
+  // on the graphics queue the submission can still be sitting in the batch if its frame was never submitted
+  if (!mTimeline->IsComplete(current.mSubmitted)) {
+    mSubmits->Flush();
+    mTimeline->Wait(current.mSubmitted);
+  }
+  vkResetCommandPool(mDevice, current.mCommandPool, 0);
+
+  VkCommandBufferBeginInfo beginInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+  };
+  if (vkBeginCommandBuffer(current.mCommandBuffer, &beginInfo) != VK_SUCCESS) {
+    fmt::print("failed to begin compute command buffer\n");
+    assert(0);
+  }
+  mRecording = slot;
+  return current.mCommandBuffer;
+}
+
+u64 AsyncCompute::Submit(u64 graphicsValue, VkPipelineStageFlags waitStages)
+{
+  assert(mRecording != ~0u);
+  auto &current = mSlots[mRecording];
+  mRecording = ~0u;
+  if (vkEndCommandBuffer(current.mCommandBuffer) != VK_SUCCESS) {
+    fmt::print("failed to record compute command buffer\n");
+    assert(0);
+  }
+
+  Submission submission = {
+      .mCommandBuffers = {current.mCommandBuffer},
+      .mSignalSemaphores = {mTimeline->Get()},
+      .mSignalValues = {mTimeline->Next()},
+  };
+  // on the graphics queue everything before it in submission order has been waited on already
+  if (IsAsync() && graphicsValue != 0) {
+    submission.mWaitSemaphores.push_back(mGraphicsTimeline->Get());
+    submission.mWaitValues.push_back(graphicsValue);
+    submission.mWaitStages.push_back(waitStages);
+  }
+  current.mSubmitted = submission.mSignalValues[0];
+  mSubmits->Add(std::move(submission));
+  if (IsAsync()) {
+    mSubmits->Flush();
+  }
+  mDispatches++;
+  return current.mSubmitted;
+}
+
+void AsyncCompute::AddGraphicsWait(Submission *graphics, u64 value, VkPipelineStageFlags dstStages) const
+{
+  if (!IsAsync() || value == 0) {
+    return;
+  }
+  graphics->mWaitSemaphores.push_back(mTimeline->Get());
+  graphics->mWaitValues.push_back(value);
+  graphics->mWaitStages.push_back(dstStages);
+}
+
+void AsyncCompute::AddAcquireBarrier(BarrierBatch *barriers, VkPipelineStageFlags dstStages,
+    VkAccessFlags dstAccess) const
+{
+  if (IsAsync()) {
+    return;
+  }
+  barriers->Memory(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dstStages, VK_ACCESS_SHADER_WRITE_BIT, dstAccess);
+}
+
+void AsyncCompute::PrintStats() const
+{
+  fmt::print("Async compute: {} submissions on {} queue (family {})\n", mDispatches,
+      IsAsync() ? "its own" : "the graphics", mFamily);
+}
+
+} // namespace vk
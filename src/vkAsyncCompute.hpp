@@ -0,0 +1,82 @@
+#pragma once
+#include "common.h"
+#include "vkSync.hpp"
+#include "vkTimeline.hpp"
+
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace vk
+{
+
+// a compute pipeline from SPIR-V, the module is only kept for as long as creation needs it
+NODISCARD VkPipeline CreateComputePipeline(VkDevice device, VkPipelineCache cache, VkPipelineLayout layout,
+    const std::vector<char> &spirv, const char *entryPoint = "main");
+
+// Dispatches compute work on a queue of its own so it runs alongside whatever the graphics queue is busy with, e.g.
+// culling for the frame about to be recorded while the previous one is still rendering, or post-processing a frame
+// the graphics queue has already moved on from. Every submission signals the compute timeline and can wait on a
+// graphics timeline value, graphics submissions wait on compute values the same way, so the two queues only meet
+// where the data actually flows.
+//
+// Without a separate queue the compute timeline and batch are the graphics ones. Submissions then go out with the
+// next graphics submit in order and the hand over is a pipeline barrier instead of a semaphore wait, callers don't
+// need to know which they got. Resources shared between the queues are expected to be created with
+// VK_SHARING_MODE_CONCURRENT when the families differ, dispatches are small and frequent enough that ownership
+// transfers would cost more than they save.
+class AsyncCompute
+{
+  struct Slot {
+    VkCommandPool mCommandPool = VK_NULL_HANDLE;
+    VkCommandBuffer mCommandBuffer = VK_NULL_HANDLE;
+    // compute timeline value of the last submission from this slot, 0 if never
+    u64 mSubmitted = 0;
+  };
+
+  VkDevice mDevice = VK_NULL_HANDLE;
+  u32 mFamily = 0;
+  VkQueue mQueue = VK_NULL_HANDLE;
+  VkQueue mGraphicsQueue = VK_NULL_HANDLE;
+  // the same timeline and batch when the two queues are the same
+  Timeline *mTimeline = nullptr;
+  Timeline *mGraphicsTimeline = nullptr;
+  SubmitBatch *mSubmits = nullptr;
+
+  std::vector<Slot> mSlots;
+  // slot being recorded, ~0u outside Begin() / Submit()
+  u32 mRecording = ~0u;
+
+  u64 mDispatches = 0;
+
+public:
+  AsyncCompute() = default;
+  AsyncCompute(VkDevice device, u32 family, VkQueue queue, VkQueue graphicsQueue, Timeline *timeline,
+      Timeline *graphicsTimeline, SubmitBatch *submits, u32 slotCount);
+
+  // the GPU must be done with every submission
+  void Destroy();
+
+  // false when dispatches share the graphics queue
+  NODISCARD bool IsAsync() const { return mQueue != mGraphicsQueue; }
+  NODISCARD u32 GetFamily() const { return mFamily; }
+  NODISCARD Timeline *GetTimeline() const { return mTimeline; }
+
+  // Begins the slot's command buffer. Waits on the CPU for the slot's previous submission, which has normally long
+  // finished since the graphics work consuming it has been waited on already.
+  NODISCARD VkCommandBuffer Begin(u32 slot);
+  // Ends and queues the slot's command buffer, returns the compute timeline value it signals. graphicsValue is waited
+  // on at waitStages first, 0 waits on nothing. On a queue of its own it's flushed straight away so it starts while
+  // the graphics queue is still busy.
+  u64 Submit(u64 graphicsValue = 0, VkPipelineStageFlags waitStages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+  // Makes a graphics submission wait for the compute submission that signals value before dstStages. On the graphics
+  // queue the submission order does it and the memory side goes in barriers instead, see AddAcquireBarrier().
+  void AddGraphicsWait(Submission *graphics, u64 value, VkPipelineStageFlags dstStages) const;
+  // the barrier a graphics command buffer needs in front of reading what a dispatch wrote, nothing on a queue of its
+  // own where the semaphore wait already covers it
+  void AddAcquireBarrier(BarrierBatch *barriers, VkPipelineStageFlags dstStages, VkAccessFlags dstAccess) const;
+
+  void PrintStats() const;
+};
+
+} // namespace vk
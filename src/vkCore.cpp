@@ -1,6 +1,7 @@
 #include "vkCore.hpp"
 
 #include "common.h"
+#include "vkPresentMode.hpp"
 
 #include <GLFW/glfw3.h>
 #include <cassert>
@@ -167,18 +168,23 @@ void Core::FindDevices()
 }
 void Core::CreateLogicalDevice()
 {
-  mFamilyPair = FindQueueFamily();
+  mQueueFamilies = FindQueueFamily();
   std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-  std::unordered_set<u32> uniqueQueueFamilies = {(u32)mFamilyPair.first, (u32)mFamilyPair.second};
+  auto queueCounts = CountQueuesPerFamily(mQueueFamilies.mFamilyCount,
+      {{(u32)mQueueFamilies.mGraphics, 0}, {(u32)mQueueFamilies.mPresent, 0}, mQueueFamilies.mTransfer,
+          mQueueFamilies.mCompute});
 
   // TODO: add some sort of queue priority
-  f32 queuePriorite = 1.0f;
-  for (auto queueFamily : uniqueQueueFamilies) {
+  f32 queuePriorities[] = {1.0f, 1.0f, 1.0f};
+  for (u32 queueFamily = 0; queueFamily < queueCounts.size(); queueFamily++) {
+    if (queueCounts[queueFamily] == 0) {
+      continue;
+    }
     queueCreateInfos.push_back({
         .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
         .queueFamilyIndex = queueFamily,
-        .queueCount = 1,
-        .pQueuePriorities = &queuePriorite,
+        .queueCount = queueCounts[queueFamily],
+        .pQueuePriorities = queuePriorities,
     });
   }
 
@@ -197,14 +203,17 @@ void Core::CreateLogicalDevice()
   passert("Failed to create logical device",
       vkCreateDevice(mPhysicalDevice, &createInfo, nullptr, &mLogicalDevice) == VK_SUCCESS);
 
-  vkGetDeviceQueue(mLogicalDevice, mFamilyPair.first, 0, &mGraphicsQueue);
-  vkGetDeviceQueue(mLogicalDevice, mFamilyPair.first, 0, &mPresentQueue);
+  vkGetDeviceQueue(mLogicalDevice, mQueueFamilies.mGraphics, 0, &mGraphicsQueue);
+  vkGetDeviceQueue(mLogicalDevice, mQueueFamilies.mPresent, 0, &mPresentQueue);
+  vkGetDeviceQueue(
+      mLogicalDevice, mQueueFamilies.mTransfer.mFamily, mQueueFamilies.mTransfer.mIndex, &mTransferQueue);
+  vkGetDeviceQueue(
+      mLogicalDevice, mQueueFamilies.mCompute.mFamily, mQueueFamilies.mCompute.mIndex, &mComputeQueue);
 }
 
-std::pair<s32, s32> Core::FindQueueFamily()
+Core::QueueFamilies Core::FindQueueFamily()
 {
-  // TODO: refractor into a more useful struct
-  std::pair<s32, s32> ret{-1, -1};
+  QueueFamilies ret;
 
   u32 queueFamilyCount = 0;
   vkGetPhysicalDeviceQueueFamilyProperties(mPhysicalDevice, &queueFamilyCount, nullptr);
@@ -214,15 +223,20 @@ std::pair<s32, s32> Core::FindQueueFamily()
     VkBool32 presentSupport = false;
     vkGetPhysicalDeviceSurfaceSupportKHR(mPhysicalDevice, i, mWindowSurface, &presentSupport);
     if (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-      ret.first = i;
+      ret.mGraphics = i;
     }
     if (presentSupport) {
-      ret.second = i;
+      ret.mPresent = i;
     }
-    if (ret.first != -1 && ret.second != -1) {
+    if (ret.mGraphics != -1 && ret.mPresent != -1) {
       break;
     }
   }
+  ret.mFamilyCount = queueFamilyCount;
+  if (ret.mGraphics != -1) {
+    ret.mTransfer = SelectTransferQueue(queueFamilies, (u32)ret.mGraphics);
+    ret.mCompute = SelectComputeQueue(queueFamilies, (u32)ret.mGraphics, ret.mTransfer);
+  }
   return ret;
 }
 
@@ -260,13 +274,7 @@ void Core::CreateSwapChain()
   }
 
   // find the the "best" present mode for the swap chain
-  mSwapChainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
-  for (const auto &availablePresentMode : mSwapChainSupportDetails.mPresentModes) {
-    if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-      mSwapChainPresentMode = availablePresentMode;
-      break;
-    }
-  }
+  mSwapChainPresentMode = ChoosePresentMode(mSwapChainSupportDetails.mPresentModes, VK_PRESENT_MODE_MAILBOX_KHR);
 
   // find the extent for the swap chain
   if (mSwapChainSupportDetails.mCapabilities.currentExtent.width != UINT32_MAX) {
@@ -290,7 +298,7 @@ void Core::CreateSwapChain()
   }
 
   // TODO: use c-style construction
-  u32 queueFamilyIndices[] = {(u32)mFamilyPair.first, (u32)mFamilyPair.second};
+  u32 queueFamilyIndices[] = {(u32)mQueueFamilies.mGraphics, (u32)mQueueFamilies.mPresent};
   VkSwapchainCreateInfoKHR createInfo = {
       .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
       .surface = mWindowSurface,
@@ -307,7 +315,7 @@ void Core::CreateSwapChain()
       .oldSwapchain = VK_NULL_HANDLE,
   };
 
-  if (mFamilyPair.first != mFamilyPair.second) {
+  if (mQueueFamilies.mGraphics != mQueueFamilies.mPresent) {
     createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
     createInfo.queueFamilyIndexCount = 2;
     createInfo.pQueueFamilyIndices = queueFamilyIndices;
@@ -1,5 +1,6 @@
 #pragma once
 #include "common.h"
+#include "vkQueues.hpp"
 
 #include <optional>
 #include <vector>
@@ -28,8 +29,17 @@ class Core
 
   VkQueue mGraphicsQueue;
   VkQueue mPresentQueue;
-
-  std::pair<s32, s32> mFamilyPair;
+  VkQueue mTransferQueue;
+  // the graphics queue when there is no other compute capable queue to overlap with
+  VkQueue mComputeQueue;
+
+  struct QueueFamilies {
+    s32 mGraphics = -1;
+    s32 mPresent = -1;
+    QueueSelection mTransfer;
+    QueueSelection mCompute;
+    u32 mFamilyCount = 0;
+  } mQueueFamilies;
 
   struct SwapChainSupportDetails {
     VkSurfaceCapabilitiesKHR mCapabilities;
@@ -61,8 +71,7 @@ private:
   void FindDevices();
   void CreateLogicalDevice();
 
-  // the first will be the graphics family, second present family
-  std::pair<s32, s32> FindQueueFamily();
+  QueueFamilies FindQueueFamily();
 
   void CreateSwapChain();
   VkImageView CreateImageView(VkImage image, VkFormat format);
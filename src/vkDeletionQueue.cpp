@@ -0,0 +1,184 @@
+#include "vkDeletionQueue.hpp"
+
+#include "common.h"
+
+#include <cassert>
+#include <fmt/core.h>
+
+namespace vk
+{
+
+DeletionQueue::DeletionQueue(VkDevice device, Allocator *allocator) : mDevice(device), mAllocator(allocator) {}
+
+void DeletionQueue::Destroy()
+{
+  for (auto &timeline : mTimelines) {
+    for (const auto &entry : timeline.mEntries) {
+      DestroyEntry(entry);
+    }
+  }
+  mTimelines.clear();
+}
+
+void DeletionQueue::Buffer(Timeline *timeline, u64 value, VkBuffer buffer, const Allocation &allocation)
+{
+  Push(timeline, {value, VK_OBJECT_TYPE_BUFFER, (u64)buffer, 0, allocation});
+}
+
+void DeletionQueue::Image(Timeline *timeline, u64 value, VkImage image, const Allocation &allocation)
+{
+  Push(timeline, {value, VK_OBJECT_TYPE_IMAGE, (u64)image, 0, allocation});
+}
+
+void DeletionQueue::ImageView(Timeline *timeline, u64 value, VkImageView view)
+{
+  Push(timeline, {value, VK_OBJECT_TYPE_IMAGE_VIEW, (u64)view, 0, {}});
+}
+
+void DeletionQueue::Sampler(Timeline *timeline, u64 value, VkSampler sampler)
+{
+  Push(timeline, {value, VK_OBJECT_TYPE_SAMPLER, (u64)sampler, 0, {}});
+}
+
+void DeletionQueue::Framebuffer(Timeline *timeline, u64 value, VkFramebuffer framebuffer)
+{
+  Push(timeline, {value, VK_OBJECT_TYPE_FRAMEBUFFER, (u64)framebuffer, 0, {}});
+}
+
+void DeletionQueue::RenderPass(Timeline *timeline, u64 value, VkRenderPass renderPass)
+{
+  Push(timeline, {value, VK_OBJECT_TYPE_RENDER_PASS, (u64)renderPass, 0, {}});
+}
+
+void DeletionQueue::Pipeline(Timeline *timeline, u64 value, VkPipeline pipeline)
+{
+  Push(timeline, {value, VK_OBJECT_TYPE_PIPELINE, (u64)pipeline, 0, {}});
+}
+
+void DeletionQueue::PipelineLayout(Timeline *timeline, u64 value, VkPipelineLayout layout)
+{
+  Push(timeline, {value, VK_OBJECT_TYPE_PIPELINE_LAYOUT, (u64)layout, 0, {}});
+}
+
+void DeletionQueue::DescriptorSetLayout(Timeline *timeline, u64 value, VkDescriptorSetLayout layout)
+{
+  Push(timeline, {value, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT, (u64)layout, 0, {}});
+}
+
+void DeletionQueue::DescriptorPool(Timeline *timeline, u64 value, VkDescriptorPool pool)
+{
+  Push(timeline, {value, VK_OBJECT_TYPE_DESCRIPTOR_POOL, (u64)pool, 0, {}});
+}
+
+void DeletionQueue::DescriptorSet(Timeline *timeline, u64 value, VkDescriptorPool pool, VkDescriptorSet set)
+{
+  Push(timeline, {value, VK_OBJECT_TYPE_DESCRIPTOR_SET, (u64)set, (u64)pool, {}});
+}
+
+void DeletionQueue::CommandPool(Timeline *timeline, u64 value, VkCommandPool pool)
+{
+  Push(timeline, {value, VK_OBJECT_TYPE_COMMAND_POOL, (u64)pool, 0, {}});
+}
+
+void DeletionQueue::SwapChain(Timeline *timeline, u64 value, VkSwapchainKHR swapChain)
+{
+  Push(timeline, {value, VK_OBJECT_TYPE_SWAPCHAIN_KHR, (u64)swapChain, 0, {}});
+}
+
+void DeletionQueue::Memory(Timeline *timeline, u64 value, const Allocation &allocation)
+{
+  Push(timeline, {value, VK_OBJECT_TYPE_UNKNOWN, 0, 0, allocation});
+}
+
+void DeletionQueue::Push(Timeline *timeline, const Entry &entry)
+{
+  if (entry.mHandle == 0 && entry.mAllocation.mMemory == VK_NULL_HANDLE) {
+    return;
+  }
+  mQueued++;
+  for (auto &entries : mTimelines) {
+    if (entries.mTimeline == timeline) {
+      entries.mEntries.push_back(entry);
+      return;
+    }
+  }
+  mTimelines.push_back({timeline, {entry}});
+}
+
+void DeletionQueue::Update()
+{
+  for (auto &timeline : mTimelines) {
+    if (timeline.mEntries.empty()) {
+      continue;
+    }
+    // one query per timeline, entries behind a later value wait for it even if their own has been reached
+    u64 completed = timeline.mTimeline->GetCompleted();
+    while (!timeline.mEntries.empty() && timeline.mEntries.front().mValue <= completed) {
+      DestroyEntry(timeline.mEntries.front());
+      timeline.mEntries.pop_front();
+    }
+  }
+}
+
+void DeletionQueue::DestroyEntry(const Entry &entry)
+{
+  switch (entry.mType) {
+  case VK_OBJECT_TYPE_BUFFER:
+    vkDestroyBuffer(mDevice, (VkBuffer)entry.mHandle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_IMAGE:
+    vkDestroyImage(mDevice, (VkImage)entry.mHandle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_IMAGE_VIEW:
+    vkDestroyImageView(mDevice, (VkImageView)entry.mHandle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_SAMPLER:
+    vkDestroySampler(mDevice, (VkSampler)entry.mHandle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_FRAMEBUFFER:
+    vkDestroyFramebuffer(mDevice, (VkFramebuffer)entry.mHandle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_RENDER_PASS:
+    vkDestroyRenderPass(mDevice, (VkRenderPass)entry.mHandle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_PIPELINE:
+    vkDestroyPipeline(mDevice, (VkPipeline)entry.mHandle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_PIPELINE_LAYOUT:
+    vkDestroyPipelineLayout(mDevice, (VkPipelineLayout)entry.mHandle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT:
+    vkDestroyDescriptorSetLayout(mDevice, (VkDescriptorSetLayout)entry.mHandle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_DESCRIPTOR_POOL:
+    vkDestroyDescriptorPool(mDevice, (VkDescriptorPool)entry.mHandle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_DESCRIPTOR_SET: {
+    auto set = (VkDescriptorSet)entry.mHandle;
+    vkFreeDescriptorSets(mDevice, (VkDescriptorPool)entry.mPool, 1, &set);
+    break;
+  }
+  case VK_OBJECT_TYPE_COMMAND_POOL:
+    vkDestroyCommandPool(mDevice, (VkCommandPool)entry.mHandle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_SWAPCHAIN_KHR:
+    vkDestroySwapchainKHR(mDevice, (VkSwapchainKHR)entry.mHandle, nullptr);
+    break;
+  case VK_OBJECT_TYPE_UNKNOWN:
+    break;
+  default:
+    fmt::print("deletion queue can't destroy object type {}\n", (u32)entry.mType);
+    assert(0);
+  }
+  if (entry.mAllocation.mMemory != VK_NULL_HANDLE) {
+    mAllocator->Free(entry.mAllocation);
+  }
+  mDestroyed++;
+}
+
+void DeletionQueue::PrintStats() const
+{
+  fmt::print("DeletionQueue: {} objects destroyed, {} pending\n", mDestroyed, GetPendingCount());
+}
+
+} // namespace vk
@@ -0,0 +1,83 @@
+#pragma once
+#include "common.h"
+#include "vkAllocator.hpp"
+#include "vkTimeline.hpp"
+
+#include <deque>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace vk
+{
+
+// Destroys Vulkan objects once the GPU is done with them instead of waiting for the device to go idle. Everything is
+// queued with the timeline value of the last submission that used it, frames are values on the graphics timeline, and
+// Update() destroys whatever its timeline has passed. Objects used on several queues go under the timeline of the
+// one that finishes with them last, usually the one that waits on the others.
+//
+// Objects queued against one timeline are destroyed in the order they were queued, so an image queued before the
+// memory it's bound to is always gone first. Not thread safe, only the thread submitting to the timelines queues
+// and updates.
+class DeletionQueue
+{
+  struct Entry {
+    u64 mValue;
+    VkObjectType mType;
+    // non-dispatchable handles are 64 bits everywhere
+    u64 mHandle;
+    // the pool a descriptor set goes back to
+    u64 mPool;
+    // freed after the object is destroyed, or on its own for VK_OBJECT_TYPE_UNKNOWN
+    Allocation mAllocation;
+  };
+
+  struct TimelineEntries {
+    Timeline *mTimeline;
+    std::deque<Entry> mEntries;
+  };
+
+  VkDevice mDevice = VK_NULL_HANDLE;
+  Allocator *mAllocator = nullptr;
+  // one per timeline anything has been queued against, there are only ever a handful
+  std::vector<TimelineEntries> mTimelines;
+
+  u64 mQueued = 0;
+  u64 mDestroyed = 0;
+
+public:
+  DeletionQueue() = default;
+  DeletionQueue(VkDevice device, Allocator *allocator);
+
+  // destroys everything still queued, the GPU must be idle
+  void Destroy();
+
+  // allocations are freed after the object they back is destroyed, an empty one is ignored
+  void Buffer(Timeline *timeline, u64 value, VkBuffer buffer, const Allocation &allocation = {});
+  void Image(Timeline *timeline, u64 value, VkImage image, const Allocation &allocation = {});
+  void ImageView(Timeline *timeline, u64 value, VkImageView view);
+  void Sampler(Timeline *timeline, u64 value, VkSampler sampler);
+  void Framebuffer(Timeline *timeline, u64 value, VkFramebuffer framebuffer);
+  void RenderPass(Timeline *timeline, u64 value, VkRenderPass renderPass);
+  void Pipeline(Timeline *timeline, u64 value, VkPipeline pipeline);
+  void PipelineLayout(Timeline *timeline, u64 value, VkPipelineLayout layout);
+  void DescriptorSetLayout(Timeline *timeline, u64 value, VkDescriptorSetLayout layout);
+  void DescriptorPool(Timeline *timeline, u64 value, VkDescriptorPool pool);
+  // the pool has to be created with VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT
+  void DescriptorSet(Timeline *timeline, u64 value, VkDescriptorPool pool, VkDescriptorSet set);
+  void CommandPool(Timeline *timeline, u64 value, VkCommandPool pool);
+  void SwapChain(Timeline *timeline, u64 value, VkSwapchainKHR swapChain);
+  // a suballocation on its own, e.g. memory several aliased images were bound to
+  void Memory(Timeline *timeline, u64 value, const Allocation &allocation);
+
+  // destroys everything whose timeline has reached its value, call once per frame
+  void Update();
+
+  NODISCARD u64 GetPendingCount() const { return mQueued - mDestroyed; }
+  void PrintStats() const;
+
+private:
+  void Push(Timeline *timeline, const Entry &entry);
+  void DestroyEntry(const Entry &entry);
+};
+
+} // namespace vk
@@ -0,0 +1,156 @@
+#include "vkHostImageCopy.hpp"
+
+#include "common.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fmt/core.h>
+
+namespace vk
+{
+
+// the extension depends on these two before Vulkan 1.3, neither is in the vendored headers either
+static const char *sHostImageCopyExtensions[] = {
+    sHostImageCopyExtensionName,
+    "VK_KHR_copy_commands2",
+    "VK_KHR_format_feature_flags2",
+};
+
+HostImageCopy::HostImageCopy(VkPhysicalDevice physicalDevice) : mPhysicalDevice(physicalDevice)
+{
+  u32 extensionCount = 0;
+  vkEnumerateDeviceExtensionProperties(mPhysicalDevice, nullptr, &extensionCount, nullptr);
+  std::vector<VkExtensionProperties> available(extensionCount);
+  vkEnumerateDeviceExtensionProperties(mPhysicalDevice, nullptr, &extensionCount, available.data());
+  for (const char *name : sHostImageCopyExtensions) {
+    bool found = std::any_of(available.begin(), available.end(),
+        [&](const VkExtensionProperties &extension) { return strcmp(extension.extensionName, name) == 0; });
+    if (!found) {
+      return;
+    }
+  }
+
+  VkPhysicalDeviceFeatures2 features = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+      .pNext = &mFeatures,
+  };
+  vkGetPhysicalDeviceFeatures2(mPhysicalDevice, &features);
+  mSupported = mFeatures.hostImageCopy == VK_TRUE;
+  if (!mSupported) {
+    return;
+  }
+
+  VkPhysicalDeviceHostImageCopyPropertiesEXT copyProperties = {
+      .sType = sPhysicalDeviceHostImageCopyPropertiesType,
+  };
+  VkPhysicalDeviceProperties2 properties = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      .pNext = &copyProperties,
+  };
+  vkGetPhysicalDeviceProperties2(mPhysicalDevice, &properties);
+  std::vector<VkImageLayout> dstLayouts(copyProperties.copyDstLayoutCount);
+  copyProperties.pCopyDstLayouts = dstLayouts.data();
+  vkGetPhysicalDeviceProperties2(mPhysicalDevice, &properties);
+  // GENERAL is always in the list
+  if (std::find(dstLayouts.begin(), dstLayouts.end(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) != dstLayouts.end()) {
+    mCopyLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  }
+}
+
+void *HostImageCopy::Enable(std::vector<const char *> *extensions, void *next)
+{
+  if (!mSupported) {
+    return next;
+  }
+  for (const char *name : sHostImageCopyExtensions) {
+    if (std::find_if(extensions->begin(), extensions->end(), [&](const char *enabled) {
+          return strcmp(enabled, name) == 0;
+        }) == extensions->end()) {
+      extensions->push_back(name);
+    }
+  }
+  mFeatures.pNext = next;
+  mEnabled = true;
+  return &mFeatures;
+}
+
+void HostImageCopy::Init(VkDevice device)
+{
+  mDevice = device;
+  if (!mEnabled) {
+    return;
+  }
+  mCopyMemoryToImage = (PFN_vkCopyMemoryToImageEXT)vkGetDeviceProcAddr(mDevice, "vkCopyMemoryToImageEXT");
+  mTransitionImageLayout = (PFN_vkTransitionImageLayoutEXT)vkGetDeviceProcAddr(mDevice, "vkTransitionImageLayoutEXT");
+  mEnabled = mCopyMemoryToImage && mTransitionImageLayout;
+}
+
+bool HostImageCopy::CanCopy(VkFormat format, u32 width, u32 height) const
+{
+  if (!mEnabled) {
+    return false;
+  }
+  VkImageFormatProperties imageProperties;
+  if (vkGetPhysicalDeviceImageFormatProperties(mPhysicalDevice, format, VK_IMAGE_TYPE_2D, VK_IMAGE_TILING_OPTIMAL,
+          VK_IMAGE_USAGE_SAMPLED_BIT | sUsage, 0, &imageProperties)
+      != VK_SUCCESS) {
+    return false;
+  }
+  return width <= imageProperties.maxExtent.width && height <= imageProperties.maxExtent.height;
+}
+
+void HostImageCopy::CopyToImage(VkImage image, u32 width, u32 height, const void *data, VkImageLayout finalLayout)
+{
+  assert(mEnabled);
+  constexpr VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+  VkHostImageLayoutTransitionInfoEXT toCopy = {
+      .sType = sHostImageLayoutTransitionInfoType,
+      .image = image,
+      .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      .newLayout = mCopyLayout,
+      .subresourceRange = range,
+  };
+  if (mTransitionImageLayout(mDevice, 1, &toCopy) != VK_SUCCESS) {
+    fmt::print("failed to transition image for host copy\n");
+    assert(0);
+  }
+
+  VkMemoryToImageCopyEXT region = {
+      .sType = sMemoryToImageCopyType,
+      .pHostPointer = data,
+      .memoryRowLength = 0,
+      .memoryImageHeight = 0,
+      .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+      .imageOffset = {0, 0, 0},
+      .imageExtent = {width, height, 1},
+  };
+  VkCopyMemoryToImageInfoEXT copyInfo = {
+      .sType = sCopyMemoryToImageInfoType,
+      .dstImage = image,
+      .dstImageLayout = mCopyLayout,
+      .regionCount = 1,
+      .pRegions = &region,
+  };
+  if (mCopyMemoryToImage(mDevice, &copyInfo) != VK_SUCCESS) {
+    fmt::print("failed to host copy into image\n");
+    assert(0);
+  }
+
+  if (finalLayout != mCopyLayout) {
+    VkHostImageLayoutTransitionInfoEXT toFinal = {
+        .sType = sHostImageLayoutTransitionInfoType,
+        .image = image,
+        .oldLayout = mCopyLayout,
+        .newLayout = finalLayout,
+        .subresourceRange = range,
+    };
+    if (mTransitionImageLayout(mDevice, 1, &toFinal) != VK_SUCCESS) {
+      fmt::print("failed to transition image after host copy\n");
+      assert(0);
+    }
+  }
+}
+
+} // namespace vk
@@ -0,0 +1,114 @@
+#pragma once
+#include "common.h"
+
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace vk
+{
+
+// VK_EXT_host_image_copy is newer than the vendored 1.2.141 headers, so the little of it used here is declared by hand.
+// Same layouts as the registry, in namespace vk so newer headers that do declare them don't clash.
+static constexpr const char *sHostImageCopyExtensionName = "VK_EXT_host_image_copy";
+static constexpr VkStructureType sPhysicalDeviceHostImageCopyFeaturesType = (VkStructureType)1000270000;
+static constexpr VkStructureType sPhysicalDeviceHostImageCopyPropertiesType = (VkStructureType)1000270001;
+static constexpr VkStructureType sMemoryToImageCopyType = (VkStructureType)1000270002;
+static constexpr VkStructureType sCopyMemoryToImageInfoType = (VkStructureType)1000270005;
+static constexpr VkStructureType sHostImageLayoutTransitionInfoType = (VkStructureType)1000270006;
+static constexpr VkImageUsageFlags sImageUsageHostTransferBit = 0x00400000;
+
+struct VkPhysicalDeviceHostImageCopyFeaturesEXT {
+  VkStructureType sType;
+  void *pNext;
+  VkBool32 hostImageCopy;
+};
+
+struct VkPhysicalDeviceHostImageCopyPropertiesEXT {
+  VkStructureType sType;
+  void *pNext;
+  u32 copySrcLayoutCount;
+  VkImageLayout *pCopySrcLayouts;
+  u32 copyDstLayoutCount;
+  VkImageLayout *pCopyDstLayouts;
+  u8 optimalTilingLayoutUUID[VK_UUID_SIZE];
+  VkBool32 identicalMemoryTypeRequirements;
+};
+
+struct VkMemoryToImageCopyEXT {
+  VkStructureType sType;
+  const void *pNext;
+  const void *pHostPointer;
+  u32 memoryRowLength;
+  u32 memoryImageHeight;
+  VkImageSubresourceLayers imageSubresource;
+  VkOffset3D imageOffset;
+  VkExtent3D imageExtent;
+};
+
+struct VkCopyMemoryToImageInfoEXT {
+  VkStructureType sType;
+  const void *pNext;
+  VkFlags flags;
+  VkImage dstImage;
+  VkImageLayout dstImageLayout;
+  u32 regionCount;
+  const VkMemoryToImageCopyEXT *pRegions;
+};
+
+struct VkHostImageLayoutTransitionInfoEXT {
+  VkStructureType sType;
+  const void *pNext;
+  VkImage image;
+  VkImageLayout oldLayout;
+  VkImageLayout newLayout;
+  VkImageSubresourceRange subresourceRange;
+};
+
+using PFN_vkCopyMemoryToImageEXT = VkResult(VKAPI_PTR *)(VkDevice device, const VkCopyMemoryToImageInfoEXT *info);
+using PFN_vkTransitionImageLayoutEXT = VkResult(VKAPI_PTR *)(
+    VkDevice device, u32 transitionCount, const VkHostImageLayoutTransitionInfoEXT *transitions);
+
+// Copies pixels straight from host memory into optimally tiled images with VK_EXT_host_image_copy. There are no
+// command buffers, staging buffers or queue waits involved, so any thread that owns the image can call it, e.g. the
+// one that decoded the pixels. The layout changes are host side too and are visible to every later submission.
+//
+// IsEnabled() is false unless the device has the extension, its dependencies and the hostImageCopy feature, callers
+// fall back to the upload manager then.
+class HostImageCopy
+{
+  VkPhysicalDeviceHostImageCopyFeaturesEXT mFeatures = {
+      .sType = sPhysicalDeviceHostImageCopyFeaturesType,
+  };
+  PFN_vkCopyMemoryToImageEXT mCopyMemoryToImage = nullptr;
+  PFN_vkTransitionImageLayoutEXT mTransitionImageLayout = nullptr;
+  VkPhysicalDevice mPhysicalDevice = VK_NULL_HANDLE;
+  VkDevice mDevice = VK_NULL_HANDLE;
+  bool mSupported = false;
+  bool mEnabled = false;
+  // the layout images are copied in, SHADER_READ_ONLY when the driver allows it so no second transition is needed
+  VkImageLayout mCopyLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+public:
+  // usage images need to be created with to be copied into
+  static constexpr VkImageUsageFlags sUsage = sImageUsageHostTransferBit;
+
+  HostImageCopy() = default;
+  // checks the extension and its feature, before the device is created
+  explicit HostImageCopy(VkPhysicalDevice physicalDevice);
+
+  // adds the extension and its dependencies and chains the feature struct in front of next when supported.
+  // Returns the new head of the device create info pNext chain.
+  NODISCARD void *Enable(std::vector<const char *> *extensions, void *next);
+  // loads the entry points once the device exists
+  void Init(VkDevice device);
+
+  NODISCARD bool IsEnabled() const { return mEnabled; }
+  // whether a sampled image of this format and size can be host copied into
+  NODISCARD bool CanCopy(VkFormat format, u32 width, u32 height) const;
+
+  // moves the image out of UNDEFINED, copies tightly packed pixels into its first mip and leaves it in finalLayout
+  void CopyToImage(VkImage image, u32 width, u32 height, const void *data,
+      VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+};
+
+} // namespace vk
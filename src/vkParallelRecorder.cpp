@@ -0,0 +1,123 @@
+#include "vkParallelRecorder.hpp"
+
+#include "common.h"
+
+#include <algorithm>
+#include <cassert>
+#include <fmt/core.h>
+
+namespace vk
+{
+
+ParallelRecorder::ParallelRecorder(VkDevice device, u32 queueFamily, u32 frameCount, JobSystem *jobs) :
+    mDevice(device), mJobs(jobs)
+{
+  mThreadCount = mJobs->GetThreadCount();
+  mActiveThreads = mThreadCount;
+
+  mPools.resize(frameCount);
+  for (auto &framePools : mPools) {
+    framePools.resize(mThreadCount);
+    for (auto &pool : framePools) {
+      VkCommandPoolCreateInfo poolInfo = {
+          .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+          .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+          .queueFamilyIndex = queueFamily,
+      };
+      if (vkCreateCommandPool(mDevice, &poolInfo, nullptr, &pool.mPool) != VK_SUCCESS) {
+        fmt::print("failed to create recording thread command pool\n");
+        assert(0);
+      }
+    }
+  }
+}
+
+void ParallelRecorder::Destroy()
+{
+  for (auto &framePools : mPools) {
+    for (auto &pool : framePools) {
+      vkDestroyCommandPool(mDevice, pool.mPool, nullptr);
+    }
+  }
+  mPools.clear();
+}
+
+void ParallelRecorder::BeginFrame(u32 frame)
+{
+  assert(frame < mPools.size());
+  mFrame = frame;
+  for (auto &pool : mPools[mFrame]) {
+    if (pool.mUsed) {
+      vkResetCommandPool(mDevice, pool.mPool, 0);
+      pool.mUsed = 0;
+    }
+  }
+}
+
+void ParallelRecorder::SetActiveThreads(u32 count)
+{
+  mActiveThreads = std::clamp(count, 1u, mThreadCount);
+}
+
+VkCommandBuffer ParallelRecorder::AcquireSecondary(RangePool *pool)
+{
+  if (pool->mUsed == pool->mSecondaries.size()) {
+    VkCommandBufferAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = pool->mPool,
+        .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+        .commandBufferCount = 1,
+    };
+    VkCommandBuffer commandBuffer;
+    if (vkAllocateCommandBuffers(mDevice, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+      fmt::print("failed to allocate secondary command buffer\n");
+      assert(0);
+    }
+    pool->mSecondaries.push_back(commandBuffer);
+  }
+  return pool->mSecondaries[pool->mUsed++];
+}
+
+void ParallelRecorder::Record(VkCommandBuffer primary, const VkCommandBufferInheritanceInfo &inheritance, u32 count,
+    const RecordFunc &record)
+{
+  if (count == 0) {
+    return;
+  }
+  u32 rangeCount = std::min(mActiveThreads, std::max(1u, count / sMinItemsPerRange));
+  u32 rangeSize = (count + rangeCount - 1) / rangeCount;
+  std::vector<VkCommandBuffer> secondaries(rangeCount);
+
+  auto recordRange = [&](u32 range) {
+    u32 begin = range * rangeSize;
+    u32 end = std::min(count, begin + rangeSize);
+    VkCommandBuffer commandBuffer = AcquireSecondary(&mPools[mFrame][range]);
+
+    VkCommandBufferBeginInfo beginInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &inheritance,
+    };
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+      fmt::print("failed to begin secondary command buffer\n");
+      assert(0);
+    }
+    if (begin < end) {
+      record(commandBuffer, begin, end);
+    }
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+      fmt::print("failed to record secondary command buffer\n");
+      assert(0);
+    }
+    secondaries[range] = commandBuffer;
+  };
+
+  mJobs->ParallelFor(rangeCount, 1, [&](u32 begin, u32 end) {
+    for (u32 range = begin; range < end; range++) {
+      recordRange(range);
+    }
+  });
+  vkCmdExecuteCommands(primary, rangeCount, secondaries.data());
+}
+
+} // namespace vk
@@ -0,0 +1,66 @@
+#pragma once
+#include "JobSystem.hpp"
+#include "common.h"
+
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace vk
+{
+
+// Records the contents of a render pass across the job system's threads. Work is split into contiguous ranges, each
+// range is recorded into a secondary command buffer by one job, and the primary executes them in order. Every range
+// has its own command pool per frame slot and only one job records a range at a time, so nothing is shared while
+// recording.
+//
+// Pools are reset as a whole when their frame slot comes round again and the secondaries allocated from them are
+// reused, nothing is freed after startup.
+class ParallelRecorder
+{
+  // below this many items per range the cost of waking a thread outweighs recording on it
+  static constexpr u32 sMinItemsPerRange = 256;
+
+  struct RangePool {
+    VkCommandPool mPool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> mSecondaries;
+    // secondaries handed out since the last reset
+    u32 mUsed = 0;
+  };
+
+  VkDevice mDevice = VK_NULL_HANDLE;
+  JobSystem *mJobs = nullptr;
+  u32 mThreadCount = 0;
+  u32 mActiveThreads = 0;
+  u32 mFrame = 0;
+  // indexed [frame slot][range]
+  std::vector<std::vector<RangePool>> mPools;
+
+public:
+  // records [begin, end) into commandBuffer, which is already begun and inside the render pass
+  using RecordFunc = std::function<void(VkCommandBuffer commandBuffer, u32 begin, u32 end)>;
+
+  ParallelRecorder() = default;
+  // splits work into at most one range per job system thread
+  ParallelRecorder(VkDevice device, u32 queueFamily, u32 frameCount, JobSystem *jobs);
+
+  void Destroy();
+
+  // resets the slot's pools, the GPU must be done with the frame that last used it
+  void BeginFrame(u32 frame);
+
+  // Splits count items over the active threads and executes the results in primary, which must be inside a render
+  // pass begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS. Dynamic state isn't inherited, every range has to
+  // set what it uses.
+  void Record(VkCommandBuffer primary, const VkCommandBufferInheritanceInfo &inheritance, u32 count,
+      const RecordFunc &record);
+
+  NODISCARD u32 GetThreadCount() const { return mThreadCount; }
+  // limits how many threads Record() spreads work over, mostly for measuring scaling
+  void SetActiveThreads(u32 count);
+
+private:
+  NODISCARD VkCommandBuffer AcquireSecondary(RangePool *pool);
+};
+
+} // namespace vk
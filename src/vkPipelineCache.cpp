@@ -0,0 +1,175 @@
+#include "vkPipelineCache.hpp"
+
+#include "common.h"
+
+#include <cassert>
+#include <cstring>
+#include <fmt/core.h>
+
+namespace vk
+{
+
+static constexpr u32 sPipelineCacheMagic = 0x48435046; // "FPCH"
+static constexpr u32 sPipelineCacheFileVersion = 1;
+// far past anything a driver writes, a header claiming more is corrupt
+static constexpr u64 sPipelineCacheMaxDataSize = 256ull << 20;
+
+struct PipelineCacheFileHeader {
+  u32 mMagic;
+  u32 mFileVersion;
+  u32 mVendorID;
+  u32 mDeviceID;
+  u32 mDriverVersion;
+  u8 mPipelineCacheUUID[VK_UUID_SIZE];
+  u64 mDataSize;
+  u64 mChecksum;
+};
+
+// FNV-1a, only there to catch truncated or bit flipped files
+static u64 PipelineCacheChecksum(const u8 *data, Size size)
+{
+  u64 hash = 0xcbf29ce484222325ull;
+  for (Size i = 0; i < size; i++) {
+    hash = (hash ^ data[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+PipelineCache::PipelineCache(VkPhysicalDevice physicalDevice, VkDevice device, const char *path) :
+    mDevice(device), mPath(path)
+{
+  vkGetPhysicalDeviceProperties(physicalDevice, &mProperties);
+
+  auto data = Load();
+  mLoaded = !data.empty();
+  mSavedSize = data.size();
+
+  VkPipelineCacheCreateInfo cacheInfo = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+      .initialDataSize = data.size(),
+      .pInitialData = data.empty() ? nullptr : data.data(),
+  };
+  if (vkCreatePipelineCache(mDevice, &cacheInfo, nullptr, &mCache) != VK_SUCCESS) {
+    fmt::print("failed to create pipeline cache\n");
+    assert(0);
+  }
+}
+
+void PipelineCache::Destroy()
+{
+  Save();
+  vkDestroyPipelineCache(mDevice, mCache, nullptr);
+  mCache = VK_NULL_HANDLE;
+}
+
+std::vector<u8> PipelineCache::Load()
+{
+  FILE *file = fopen(mPath.c_str(), "rb");
+  if (!file) {
+    fmt::print("pipeline cache: no cache at {}, starting cold\n", mPath);
+    return {};
+  }
+
+  // mDataSize is only trusted up to what's actually left in the file
+  u64 fileSize = 0;
+  if (fseek(file, 0, SEEK_END) == 0) {
+    long end = ftell(file);
+    fileSize = end > 0 ? (u64)end : 0;
+  }
+  rewind(file);
+
+  std::vector<u8> data;
+  PipelineCacheFileHeader header;
+  const char *rejected = nullptr;
+  if (fread(&header, sizeof(header), 1, file) != 1) {
+    rejected = "truncated header";
+  } else if (header.mMagic != sPipelineCacheMagic || header.mFileVersion != sPipelineCacheFileVersion) {
+    rejected = "not a pipeline cache file";
+  } else if (header.mVendorID != mProperties.vendorID || header.mDeviceID != mProperties.deviceID
+             || header.mDriverVersion != mProperties.driverVersion
+             || memcmp(header.mPipelineCacheUUID, mProperties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+    rejected = "written by a different device or driver";
+  } else if (header.mDataSize > sPipelineCacheMaxDataSize || sizeof(header) + header.mDataSize > fileSize) {
+    rejected = "data size doesn't fit the file";
+  } else {
+    data.resize(header.mDataSize);
+    if (fread(data.data(), 1, data.size(), file) != data.size()) {
+      rejected = "truncated data";
+    } else if (PipelineCacheChecksum(data.data(), data.size()) != header.mChecksum) {
+      rejected = "checksum mismatch";
+    }
+  }
+  fclose(file);
+
+  // the driver's own header leads the blob (length, version, vendor, device, uuid), it has to agree with ours
+  if (!rejected) {
+    u32 driverHeader[4];
+    if (data.size() < sizeof(driverHeader) + VK_UUID_SIZE) {
+      rejected = "blob too small";
+    } else {
+      memcpy(driverHeader, data.data(), sizeof(driverHeader));
+      if (driverHeader[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE || driverHeader[2] != mProperties.vendorID
+          || driverHeader[3] != mProperties.deviceID
+          || memcmp(data.data() + sizeof(driverHeader), mProperties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+        rejected = "driver header mismatch";
+      }
+    }
+  }
+
+  if (rejected) {
+    fmt::print("pipeline cache: discarding {} ({}), starting cold\n", mPath, rejected);
+    return {};
+  }
+  fmt::print("pipeline cache: loaded {} bytes from {}\n", data.size(), mPath);
+  return data;
+}
+
+void PipelineCache::Save()
+{
+  Size size = 0;
+  if (vkGetPipelineCacheData(mDevice, mCache, &size, nullptr) != VK_SUCCESS || size == mSavedSize) {
+    return;
+  }
+  std::vector<u8> data(size);
+  if (vkGetPipelineCacheData(mDevice, mCache, &size, data.data()) != VK_SUCCESS) {
+    return;
+  }
+  data.resize(size);
+
+  PipelineCacheFileHeader header = {
+      .mMagic = sPipelineCacheMagic,
+      .mFileVersion = sPipelineCacheFileVersion,
+      .mVendorID = mProperties.vendorID,
+      .mDeviceID = mProperties.deviceID,
+      .mDriverVersion = mProperties.driverVersion,
+      .mPipelineCacheUUID = {},
+      .mDataSize = size,
+      .mChecksum = PipelineCacheChecksum(data.data(), size),
+  };
+  memcpy(header.mPipelineCacheUUID, mProperties.pipelineCacheUUID, VK_UUID_SIZE);
+
+  // written to the side and renamed over the old cache, readers only ever see a complete file
+  std::string tmpPath = mPath + ".tmp";
+  FILE *file = fopen(tmpPath.c_str(), "wb");
+  if (!file) {
+    fmt::print("pipeline cache: failed to open {} for writing\n", tmpPath);
+    return;
+  }
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(data.data(), 1, size, file) == size;
+  written = fflush(file) == 0 && written;
+  fclose(file);
+
+  std::error_code error;
+  if (written) {
+    fs::rename(tmpPath, mPath, error);
+  }
+  if (!written || error) {
+    fmt::print("pipeline cache: failed to save {}\n", mPath);
+    fs::remove(tmpPath, error);
+    return;
+  }
+  mSavedSize = size;
+  fmt::print("pipeline cache: saved {} bytes to {}\n", size, mPath);
+}
+
+} // namespace vk
@@ -0,0 +1,48 @@
+#pragma once
+#include "common.h"
+
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace vk
+{
+
+// A VkPipelineCache persisted to disk between runs.
+//
+// The blob is wrapped in a small header of our own with the vendor, device, driver version and pipelineCacheUUID it
+// was produced with, plus a checksum of the data. Anything truncated, corrupt or written by a different
+// device/driver is thrown away and the cache starts empty, handing the driver a blob it can't use is at best
+// wasted work and at worst a crash in buggy drivers.
+//
+// Saving writes a temporary file next to the cache and renames it over the old one, so a crash mid write never
+// leaves a half written cache behind.
+class PipelineCache
+{
+  VkDevice mDevice = VK_NULL_HANDLE;
+  VkPipelineCache mCache = VK_NULL_HANDLE;
+  std::string mPath;
+  VkPhysicalDeviceProperties mProperties = {};
+  bool mLoaded = false;
+  // size of the driver blob the last time it was loaded or saved, used to skip saves when nothing was added
+  Size mSavedSize = 0;
+
+public:
+  PipelineCache() = default;
+  PipelineCache(VkPhysicalDevice physicalDevice, VkDevice device, const char *path);
+
+  // saves if anything changed, then destroys the cache
+  void Destroy();
+
+  // writes the cache out if pipelines were added since the last load or save, cheap enough to call periodically
+  void Save();
+
+  NODISCARD VkPipelineCache Get() const { return mCache; }
+  // whether a valid blob was loaded from disk, i.e. pipeline creation should be warm
+  NODISCARD bool IsWarm() const { return mLoaded; }
+
+private:
+  NODISCARD std::vector<u8> Load();
+};
+
+} // namespace vk
@@ -0,0 +1,128 @@
+#include "vkPipelineManager.hpp"
+
+#include "common.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fmt/core.h>
+
+namespace vk
+{
+
+void PipelineManager::Init(VkDevice device, JobSystem *jobs, ResourceRegistry *resources)
+{
+  mDevice = device;
+  mJobs = jobs;
+  mResources = resources;
+}
+
+void PipelineManager::Destroy()
+{
+  mJobs->Wait(&mCounter);
+  for (auto &compile : mCompiles) {
+    if (!compile->mCollected && compile->mPipeline != VK_NULL_HANDLE) {
+      vkDestroyPipeline(mDevice, compile->mPipeline, nullptr);
+    }
+  }
+  mCompiles.clear();
+}
+
+PipelineFuture PipelineManager::CompileAsync(
+    std::function<VkPipeline()> build, VkPipelineLayout layout, VkPipelineBindPoint bindPoint)
+{
+  auto compile = std::make_unique<Compile>();
+  compile->mBuild = std::move(build);
+  compile->mLayout = layout;
+  compile->mBindPoint = bindPoint;
+  Compile *entry = compile.get();
+  mCompiles.push_back(std::move(compile));
+
+  mPeakInFlight = std::max(mPeakInFlight, ++mInFlight);
+  // background, so a frame waiting on its own jobs never picks up a compile
+  mJobs->RunBackground(
+      [this, entry] {
+        auto start = std::chrono::high_resolution_clock::now();
+        entry->mPipeline = entry->mBuild();
+        auto end = std::chrono::high_resolution_clock::now();
+        entry->mNs = (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        entry->mState.store(entry->mPipeline != VK_NULL_HANDLE ? State::Done : State::Failed);
+        mInFlight--;
+      },
+      &mCounter);
+  return {(u32)mCompiles.size() - 1};
+}
+
+void PipelineManager::Update()
+{
+  for (u32 i = 0; i < mCompiles.size(); i++) {
+    auto &compile = *mCompiles[i];
+    if (compile.mCollected || compile.mState.load() == State::Compiling) {
+      continue;
+    }
+    compile.mCollected = true;
+    compile.mBuild = nullptr;
+    if (compile.mState.load() == State::Failed) {
+      fmt::print("pipeline manager: compile {} failed, its draws stay on the fallback\n", i);
+      mFailed++;
+      continue;
+    }
+    mCompileNs.push_back(compile.mNs);
+    if (compile.mAbandoned) {
+      // never handed out, so nothing can be using it
+      vkDestroyPipeline(mDevice, compile.mPipeline, nullptr);
+      continue;
+    }
+    compile.mHandle = mResources->AddPipeline(compile.mPipeline, compile.mLayout, compile.mBindPoint);
+  }
+}
+
+PipelineHandle PipelineManager::Acquire(PipelineFuture future, PipelineHandle fallback)
+{
+  if (!future.IsValid()) {
+    return fallback;
+  }
+  const auto &compile = *mCompiles[future.mIndex];
+  if (!compile.mHandle.IsNull()) {
+    return compile.mHandle;
+  }
+  if (!compile.mCollected) {
+    // the draw goes ahead with the fallback, or not at all, rather than waiting for the compile
+    mFallbacks++;
+    mSkipped += fallback.IsNull() ? 1 : 0;
+  }
+  return fallback;
+}
+
+bool PipelineManager::IsReady(PipelineFuture future) const
+{
+  return future.IsValid() && !mCompiles[future.mIndex]->mHandle.IsNull();
+}
+
+void PipelineManager::Destroy(PipelineFuture future, Timeline *timeline, u64 value)
+{
+  if (!future.IsValid()) {
+    return;
+  }
+  auto &compile = *mCompiles[future.mIndex];
+  if (!compile.mHandle.IsNull()) {
+    mResources->Destroy(compile.mHandle, timeline, value);
+    compile.mHandle = {};
+  } else {
+    compile.mAbandoned = true;
+  }
+}
+
+void PipelineManager::PrintStats() const
+{
+  auto sorted = mCompileNs;
+  std::sort(sorted.begin(), sorted.end());
+  auto percentile = [&](f64 p) {
+    return sorted.empty() ? 0.0 : (f64)sorted[(u64)(p * (f64)(sorted.size() - 1))] / 1e6;
+  };
+  fmt::print("pipeline manager: {} compiles ({} failed, {} in flight, peak {}), {} stalls avoided ({} draws skipped)\n",
+      mCompiles.size(), mFailed, mInFlight.load(), mPeakInFlight, mFallbacks, mSkipped);
+  fmt::print("pipeline manager: compile time min {:.3f} ms, median {:.3f}, p90 {:.3f}, max {:.3f}\n", percentile(0.0),
+      percentile(0.5), percentile(0.9), percentile(1.0));
+}
+
+} // namespace vk
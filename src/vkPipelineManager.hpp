@@ -0,0 +1,90 @@
+#pragma once
+#include "JobSystem.hpp"
+#include "common.h"
+#include "vkResources.hpp"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace vk
+{
+
+// stands in for a pipeline that's still compiling, resolved with PipelineManager::Acquire()
+struct PipelineFuture {
+  u32 mIndex = UINT32_MAX;
+
+  NODISCARD bool IsValid() const { return mIndex != UINT32_MAX; }
+};
+
+// Compiles pipelines as background jobs so creating one never stalls a frame. CompileAsync() hands back a future
+// straight away, Update() moves finished pipelines into the resource registry on the render thread and Acquire()
+// resolves a future to its pipeline, or to a fallback while it's still compiling. A null fallback comes back as a
+// null handle and the caller skips the draws.
+//
+// The build functions run on workers, so whatever they read has to stay put until they're done, shader compiles they
+// kick off are background jobs too. Everything but the build itself happens on the render thread.
+class PipelineManager
+{
+  enum class State : u32 {
+    Compiling,
+    Done,
+    Failed,
+  };
+
+  struct Compile {
+    std::function<VkPipeline()> mBuild;
+    VkPipelineLayout mLayout;
+    VkPipelineBindPoint mBindPoint;
+    // written by the worker, mState is released after mPipeline and mNs so the render thread can read them
+    std::atomic<State> mState{State::Compiling};
+    VkPipeline mPipeline = VK_NULL_HANDLE;
+    u64 mNs = 0;
+    // set by Update() once the pipeline is in the registry
+    PipelineHandle mHandle;
+    bool mCollected = false;
+    // the owner let go before the compile finished, the pipeline is destroyed as soon as it's collected
+    bool mAbandoned = false;
+  };
+
+  VkDevice mDevice = VK_NULL_HANDLE;
+  JobSystem *mJobs = nullptr;
+  ResourceRegistry *mResources = nullptr;
+  // the workers hold pointers into the entries, so they're never moved
+  std::vector<std::unique_ptr<Compile>> mCompiles;
+  JobCounter mCounter;
+
+  std::atomic<u32> mInFlight{0};
+  u32 mPeakInFlight = 0;
+  u32 mFallbacks = 0;
+  u32 mSkipped = 0;
+  u32 mFailed = 0;
+  std::vector<u64> mCompileNs;
+
+public:
+  PipelineManager() = default;
+  PipelineManager(const PipelineManager &) = delete;
+  PipelineManager &operator=(const PipelineManager &) = delete;
+
+  void Init(VkDevice device, JobSystem *jobs, ResourceRegistry *resources);
+  // waits for the compiles still running, finished pipelines nobody collected are destroyed
+  void Destroy();
+
+  // build returns the pipeline, or VK_NULL_HANDLE if it failed, layout and bindPoint go to the registry with it
+  NODISCARD PipelineFuture CompileAsync(
+      std::function<VkPipeline()> build, VkPipelineLayout layout, VkPipelineBindPoint bindPoint);
+  // collects finished compiles, once a frame, never blocks
+  void Update();
+  // The future's pipeline if it's been collected, fallback otherwise. Each call that gets the fallback for a
+  // future still compiling is a stall avoided. An invalid future always gets the fallback.
+  NODISCARD PipelineHandle Acquire(PipelineFuture future, PipelineHandle fallback);
+  NODISCARD bool IsReady(PipelineFuture future) const;
+  // the pipeline goes through the deletion queue if it's been collected, or is destroyed once it's done if not
+  void Destroy(PipelineFuture future, Timeline *timeline, u64 value);
+
+  void PrintStats() const;
+};
+
+} // namespace vk
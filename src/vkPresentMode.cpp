@@ -0,0 +1,56 @@
+#include "vkPresentMode.hpp"
+
+#include "common.h"
+
+#include <algorithm>
+
+namespace vk
+{
+
+struct PresentModeName {
+  VkPresentModeKHR mMode;
+  const char *mName;
+};
+
+static constexpr PresentModeName sPresentModeNames[] = {
+    {VK_PRESENT_MODE_IMMEDIATE_KHR, "immediate"},
+    {VK_PRESENT_MODE_MAILBOX_KHR, "mailbox"},
+    {VK_PRESENT_MODE_FIFO_KHR, "fifo"},
+    {VK_PRESENT_MODE_FIFO_RELAXED_KHR, "fifo_relaxed"},
+};
+
+VkPresentModeKHR ChoosePresentMode(const std::vector<VkPresentModeKHR> &available, VkPresentModeKHR requested)
+{
+  auto supported = [&](VkPresentModeKHR mode) {
+    return std::find(available.begin(), available.end(), mode) != available.end();
+  };
+  if (supported(requested)) {
+    return requested;
+  }
+  if (requested == VK_PRESENT_MODE_IMMEDIATE_KHR && supported(VK_PRESENT_MODE_MAILBOX_KHR)) {
+    return VK_PRESENT_MODE_MAILBOX_KHR;
+  }
+  return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+const char *GetPresentModeName(VkPresentModeKHR mode)
+{
+  for (const auto &entry : sPresentModeNames) {
+    if (entry.mMode == mode) {
+      return entry.mName;
+    }
+  }
+  return "unknown";
+}
+
+VkPresentModeKHR ParsePresentMode(const char *name)
+{
+  for (const auto &entry : sPresentModeNames) {
+    if (strcmp(entry.mName, name) == 0) {
+      return entry.mMode;
+    }
+  }
+  return VK_PRESENT_MODE_MAX_ENUM_KHR;
+}
+
+} // namespace vk
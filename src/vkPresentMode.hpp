@@ -0,0 +1,21 @@
+#pragma once
+#include "common.h"
+
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace vk
+{
+
+// The requested mode if the surface supports it, otherwise the closest one that is. Every surface supports FIFO so
+// that's where everything ends up:
+//  - IMMEDIATE falls back to MAILBOX, both skip waiting for vblank
+//  - MAILBOX and FIFO_RELAXED fall back to FIFO
+NODISCARD VkPresentModeKHR ChoosePresentMode(
+    const std::vector<VkPresentModeKHR> &available, VkPresentModeKHR requested);
+
+NODISCARD const char *GetPresentModeName(VkPresentModeKHR mode);
+// accepts what GetPresentModeName returns, VK_PRESENT_MODE_MAX_ENUM_KHR for anything else
+NODISCARD VkPresentModeKHR ParsePresentMode(const char *name);
+
+} // namespace vk
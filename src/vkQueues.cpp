@@ -0,0 +1,66 @@
+#include "vkQueues.hpp"
+
+#include "common.h"
+
+#include <algorithm>
+
+namespace vk
+{
+
+QueueSelection SelectTransferQueue(const std::vector<VkQueueFamilyProperties> &families, u32 graphicsFamily)
+{
+  // graphics and compute queues implicitly support transfers even if they don't advertise the bit
+  constexpr VkQueueFlags transferCapable = VK_QUEUE_TRANSFER_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_GRAPHICS_BIT;
+
+  for (u32 i = 0; i < families.size(); i++) {
+    auto flags = families[i].queueFlags;
+    if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+      return {i, 0};
+    }
+  }
+  for (u32 i = 0; i < families.size(); i++) {
+    auto flags = families[i].queueFlags;
+    if ((flags & transferCapable) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+      return {i, 0};
+    }
+  }
+  if (families[graphicsFamily].queueCount > 1) {
+    return {graphicsFamily, 1};
+  }
+  return {graphicsFamily, 0};
+}
+
+QueueSelection SelectComputeQueue(
+    const std::vector<VkQueueFamilyProperties> &families, u32 graphicsFamily, const QueueSelection &transfer)
+{
+  // the first queue of family at or after first that transfer isn't using
+  auto freeIndex = [&](u32 family, u32 first) {
+    return transfer.mFamily == family && transfer.mIndex >= first ? transfer.mIndex + 1 : first;
+  };
+
+  for (u32 i = 0; i < families.size(); i++) {
+    auto flags = families[i].queueFlags;
+    if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+      u32 index = freeIndex(i, 0);
+      if (index < families[i].queueCount) {
+        return {i, index};
+      }
+    }
+  }
+  u32 index = freeIndex(graphicsFamily, 1);
+  if (index < families[graphicsFamily].queueCount) {
+    return {graphicsFamily, index};
+  }
+  return {graphicsFamily, 0};
+}
+
+std::vector<u32> CountQueuesPerFamily(u32 familyCount, const std::vector<QueueSelection> &selections)
+{
+  std::vector<u32> counts(familyCount, 0);
+  for (const auto &selection : selections) {
+    counts[selection.mFamily] = std::max(counts[selection.mFamily], selection.mIndex + 1);
+  }
+  return counts;
+}
+
+} // namespace vk
@@ -0,0 +1,34 @@
+#pragma once
+#include "common.h"
+
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace vk
+{
+
+// A queue family and the index of the queue within it that should be fetched with vkGetDeviceQueue
+struct QueueSelection {
+  u32 mFamily = 0;
+  u32 mIndex = 0;
+};
+
+// Picks the queue uploads should be streamed on. In order of preference:
+//  - a transfer only family (the DMA engines on discrete cards)
+//  - any family without graphics that can still do transfers
+//  - a second queue from the graphics family
+//  - the graphics queue itself
+NODISCARD QueueSelection SelectTransferQueue(const std::vector<VkQueueFamilyProperties> &families, u32 graphicsFamily);
+
+// Picks the queue async compute is dispatched on, never the one transfer got unless it's the graphics queue. In order
+// of preference:
+//  - a family with compute but not graphics (the async compute engines)
+//  - another queue from the graphics family, still overlaps if the hardware schedules queues concurrently
+//  - the graphics queue itself, dispatches are then ordered with the frames instead of overlapping them
+NODISCARD QueueSelection SelectComputeQueue(
+    const std::vector<VkQueueFamilyProperties> &families, u32 graphicsFamily, const QueueSelection &transfer);
+
+// How many queues need to be created for each family, indexed by family
+NODISCARD std::vector<u32> CountQueuesPerFamily(u32 familyCount, const std::vector<QueueSelection> &selections);
+
+} // namespace vk
@@ -0,0 +1,410 @@
+#include "vkReflection.hpp"
+
+#include "common.h"
+
+#include <algorithm>
+#include <fmt/core.h>
+#include <spirv_cross/spirv_cross.hpp>
+
+namespace vk
+{
+
+static VkShaderStageFlagBits StageFromExecutionModel(spv::ExecutionModel model)
+{
+  switch (model) {
+  case spv::ExecutionModelVertex:
+    return VK_SHADER_STAGE_VERTEX_BIT;
+  case spv::ExecutionModelTessellationControl:
+    return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+  case spv::ExecutionModelTessellationEvaluation:
+    return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+  case spv::ExecutionModelGeometry:
+    return VK_SHADER_STAGE_GEOMETRY_BIT;
+  case spv::ExecutionModelFragment:
+    return VK_SHADER_STAGE_FRAGMENT_BIT;
+  case spv::ExecutionModelGLCompute:
+    return VK_SHADER_STAGE_COMPUTE_BIT;
+  default:
+    fmt::print("reflection: unsupported execution model {}\n", (u32)model);
+    assert(0);
+    return VK_SHADER_STAGE_ALL;
+  }
+}
+
+static VkFormat VertexFormatFromType(const spirv_cross::SPIRType &type)
+{
+  static const VkFormat floats[] = {
+      VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT};
+  static const VkFormat ints[] = {
+      VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT};
+  static const VkFormat uints[] = {
+      VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT};
+  // matrices and arrays take a location per column or element, not supported until something needs them
+  if (type.width != 32 || type.columns != 1 || !type.array.empty() || type.vecsize < 1 || type.vecsize > 4) {
+    return VK_FORMAT_UNDEFINED;
+  }
+  switch (type.basetype) {
+  case spirv_cross::SPIRType::Float:
+    return floats[type.vecsize - 1];
+  case spirv_cross::SPIRType::Int:
+    return ints[type.vecsize - 1];
+  case spirv_cross::SPIRType::UInt:
+    return uints[type.vecsize - 1];
+  default:
+    return VK_FORMAT_UNDEFINED;
+  }
+}
+
+// the 32 bit formats above are the only ones the reflection hands out
+static u32 VertexFormatSize(VkFormat format)
+{
+  switch (format) {
+  case VK_FORMAT_R32_SFLOAT:
+  case VK_FORMAT_R32_SINT:
+  case VK_FORMAT_R32_UINT:
+    return 4;
+  case VK_FORMAT_R32G32_SFLOAT:
+  case VK_FORMAT_R32G32_SINT:
+  case VK_FORMAT_R32G32_UINT:
+    return 8;
+  case VK_FORMAT_R32G32B32_SFLOAT:
+  case VK_FORMAT_R32G32B32_SINT:
+  case VK_FORMAT_R32G32B32_UINT:
+    return 12;
+  default:
+    return 16;
+  }
+}
+
+static void AddBindings(const spirv_cross::Compiler &compiler,
+    const spirv_cross::SmallVector<spirv_cross::Resource> &resources, VkDescriptorType descriptorType,
+    VkDescriptorType texelBufferType, ShaderReflection *reflection)
+{
+  for (const auto &resource : resources) {
+    const auto &type = compiler.get_type(resource.type_id);
+    u32 count = 1;
+    for (u32 i = 0; i < (u32)type.array.size(); i++) {
+      // a runtime array needs descriptor indexing, which nothing here uses
+      if (type.array[i] == 0 || !type.array_size_literal[i]) {
+        fmt::print("reflection: {} is an unsized or specialised array, not supported\n", resource.name);
+        assert(0);
+      }
+      count *= type.array[i];
+    }
+    u32 set = compiler.get_decoration(resource.id, spv::DecorationDescriptorSet);
+    VkDescriptorSetLayoutBinding binding = {
+        .binding = compiler.get_decoration(resource.id, spv::DecorationBinding),
+        .descriptorType = type.image.dim == spv::DimBuffer ? texelBufferType : descriptorType,
+        .descriptorCount = count,
+        .stageFlags = reflection->mStages,
+    };
+    if (reflection->mSets.size() <= set) {
+      reflection->mSets.resize(set + 1);
+    }
+    reflection->mSets[set].push_back(binding);
+  }
+}
+
+ShaderReflection ReflectShader(const std::vector<char> &spirv)
+{
+  ShaderReflection reflection;
+  // spirv-cross reports malformed input by throwing, nothing past this function has to know
+  try {
+    spirv_cross::Compiler compiler((const u32 *)spirv.data(), spirv.size() / sizeof(u32));
+    auto stage = StageFromExecutionModel(compiler.get_execution_model());
+    reflection.mStages = stage;
+
+    auto resources = compiler.get_shader_resources();
+    AddBindings(compiler, resources.uniform_buffers, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &reflection);
+    AddBindings(compiler, resources.storage_buffers, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &reflection);
+    AddBindings(compiler, resources.sampled_images, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER, &reflection);
+    AddBindings(compiler, resources.separate_images, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+        VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER, &reflection);
+    AddBindings(compiler, resources.separate_samplers, VK_DESCRIPTOR_TYPE_SAMPLER, VK_DESCRIPTOR_TYPE_SAMPLER,
+        &reflection);
+    AddBindings(compiler, resources.storage_images, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+        VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER, &reflection);
+    AddBindings(compiler, resources.subpass_inputs, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT,
+        VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, &reflection);
+    for (auto &bindings : reflection.mSets) {
+      std::sort(bindings.begin(), bindings.end(),
+          [](const auto &a, const auto &b) { return a.binding < b.binding; });
+    }
+
+    // at most one block per stage
+    for (const auto &block : resources.push_constant_buffers) {
+      reflection.mPushConstants = {
+          .stageFlags = (VkShaderStageFlags)stage,
+          .offset = 0,
+          .size = (u32)compiler.get_declared_struct_size(compiler.get_type(block.base_type_id)),
+      };
+    }
+
+    if (stage == VK_SHADER_STAGE_VERTEX_BIT) {
+      for (const auto &input : resources.stage_inputs) {
+        VertexInput vertexInput = {
+            .mLocation = compiler.get_decoration(input.id, spv::DecorationLocation),
+            .mFormat = VertexFormatFromType(compiler.get_type(input.type_id)),
+        };
+        if (vertexInput.mFormat == VK_FORMAT_UNDEFINED) {
+          fmt::print("reflection: vertex input {} has a type with no vertex format\n", input.name);
+          assert(0);
+        }
+        reflection.mVertexInputs.push_back(vertexInput);
+      }
+      std::sort(reflection.mVertexInputs.begin(), reflection.mVertexInputs.end(),
+          [](const auto &a, const auto &b) { return a.mLocation < b.mLocation; });
+    }
+
+    for (const auto &constant : compiler.get_specialization_constants()) {
+      const auto &type = compiler.get_type(compiler.get_constant(constant.id).constant_type);
+      reflection.mSpecConstants.push_back({
+          .mId = constant.constant_id,
+          // bools are 32 bits as far as VkSpecializationInfo goes
+          .mSize = type.basetype == spirv_cross::SPIRType::Boolean ? (u32)sizeof(VkBool32) : type.width / 8,
+          .mName = compiler.get_name(constant.id),
+      });
+    }
+    std::sort(reflection.mSpecConstants.begin(), reflection.mSpecConstants.end(),
+        [](const auto &a, const auto &b) { return a.mId < b.mId; });
+
+    if (stage == VK_SHADER_STAGE_COMPUTE_BIT) {
+      for (u32 i = 0; i < 3; i++) {
+        reflection.mLocalSize[i] = compiler.get_execution_mode_argument(spv::ExecutionModeLocalSize, i);
+      }
+    }
+  } catch (const spirv_cross::CompilerError &error) {
+    fmt::print("reflection failed: {}\n", error.what());
+    assert(0);
+  }
+  return reflection;
+}
+
+void ShaderReflection::Merge(const ShaderReflection &other)
+{
+  mStages |= other.mStages;
+  if (mSets.size() < other.mSets.size()) {
+    mSets.resize(other.mSets.size());
+  }
+  for (u32 set = 0; set < (u32)other.mSets.size(); set++) {
+    auto &bindings = mSets[set];
+    for (const auto &binding : other.mSets[set]) {
+      auto existing = std::find_if(
+          bindings.begin(), bindings.end(), [&](const auto &b) { return b.binding == binding.binding; });
+      if (existing == bindings.end()) {
+        bindings.push_back(binding);
+        continue;
+      }
+      if (existing->descriptorType != binding.descriptorType
+          || existing->descriptorCount != binding.descriptorCount) {
+        fmt::print("reflection: stages disagree on set {} binding {}\n", set, binding.binding);
+        assert(0);
+      }
+      existing->stageFlags |= binding.stageFlags;
+    }
+    std::sort(bindings.begin(), bindings.end(), [](const auto &a, const auto &b) { return a.binding < b.binding; });
+  }
+
+  // one range over every stage's block, pushes have to name all of its stages
+  if (other.mPushConstants.size != 0) {
+    mPushConstants.stageFlags |= other.mPushConstants.stageFlags;
+    mPushConstants.size = std::max(mPushConstants.size, other.mPushConstants.size);
+  }
+
+  if (!other.mVertexInputs.empty()) {
+    mVertexInputs = other.mVertexInputs;
+  }
+  for (const auto &constant : other.mSpecConstants) {
+    bool known = std::any_of(
+        mSpecConstants.begin(), mSpecConstants.end(), [&](const auto &c) { return c.mId == constant.mId; });
+    if (!known) {
+      mSpecConstants.push_back(constant);
+    }
+  }
+  std::sort(mSpecConstants.begin(), mSpecConstants.end(), [](const auto &a, const auto &b) { return a.mId < b.mId; });
+  if (other.mStages & VK_SHADER_STAGE_COMPUTE_BIT) {
+    std::copy(std::begin(other.mLocalSize), std::end(other.mLocalSize), mLocalSize);
+  }
+}
+
+void ShaderReflection::SetDynamic(u32 set, u32 binding)
+{
+  assert(set < mSets.size());
+  for (auto &b : mSets[set]) {
+    if (b.binding != binding) {
+      continue;
+    }
+    if (b.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
+      b.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    } else if (b.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) {
+      b.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    }
+    return;
+  }
+  fmt::print("reflection: no set {} binding {} to make dynamic\n", set, binding);
+  assert(0);
+}
+
+u32 ShaderReflection::GetVertexAttributes(u32 binding, std::vector<VkVertexInputAttributeDescription> *attributes) const
+{
+  u32 offset = 0;
+  attributes->clear();
+  for (const auto &input : mVertexInputs) {
+    attributes->push_back({
+        .location = input.mLocation,
+        .binding = binding,
+        .format = input.mFormat,
+        .offset = offset,
+    });
+    offset += VertexFormatSize(input.mFormat);
+  }
+  return offset;
+}
+
+std::vector<VkDescriptorPoolSize> ShaderReflection::GetPoolSizes(u32 set, u32 setCount) const
+{
+  std::vector<VkDescriptorPoolSize> sizes;
+  if (set >= mSets.size()) {
+    return sizes;
+  }
+  for (const auto &binding : mSets[set]) {
+    auto size = std::find_if(
+        sizes.begin(), sizes.end(), [&](const auto &s) { return s.type == binding.descriptorType; });
+    if (size == sizes.end()) {
+      sizes.push_back({binding.descriptorType, 0});
+      size = sizes.end() - 1;
+    }
+    size->descriptorCount += binding.descriptorCount * setCount;
+  }
+  return sizes;
+}
+
+const SpecConstantInfo *ShaderReflection::FindSpecConstant(const char *name) const
+{
+  for (const auto &constant : mSpecConstants) {
+    if (constant.mName == name) {
+      return &constant;
+    }
+  }
+  return nullptr;
+}
+
+// FNV-1a over the fields that make two layouts different, the structs themselves have padding and pointers
+static u64 HashLayoutWords(const std::vector<u64> &words)
+{
+  u64 hash = 0xcbf29ce484222325ull;
+  for (u64 word : words) {
+    for (u32 i = 0; i < 8; i++) {
+      hash = (hash ^ ((word >> (i * 8)) & 0xff)) * 0x100000001b3ull;
+    }
+  }
+  return hash;
+}
+
+static bool SameBindings(
+    const std::vector<VkDescriptorSetLayoutBinding> &a, const std::vector<VkDescriptorSetLayoutBinding> &b)
+{
+  return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const auto &x, const auto &y) {
+    return x.binding == y.binding && x.descriptorType == y.descriptorType && x.descriptorCount == y.descriptorCount
+        && x.stageFlags == y.stageFlags;
+  });
+}
+
+LayoutCache::LayoutCache(VkDevice device) : mDevice(device) {}
+
+void LayoutCache::Destroy()
+{
+  for (auto &[hash, entries] : mPipelineLayouts) {
+    for (auto &entry : entries) {
+      vkDestroyPipelineLayout(mDevice, entry.mLayout, nullptr);
+    }
+  }
+  for (auto &[hash, entries] : mSetLayouts) {
+    for (auto &entry : entries) {
+      vkDestroyDescriptorSetLayout(mDevice, entry.mLayout, nullptr);
+    }
+  }
+  mPipelineLayouts.clear();
+  mSetLayouts.clear();
+}
+
+VkDescriptorSetLayout LayoutCache::GetSetLayout(const std::vector<VkDescriptorSetLayoutBinding> &bindings)
+{
+  std::vector<u64> words;
+  for (const auto &binding : bindings) {
+    // immutable samplers would have to be part of the key, nothing reflected has any
+    assert(binding.pImmutableSamplers == nullptr);
+    words.push_back((u64)binding.binding << 32 | binding.descriptorType);
+    words.push_back((u64)binding.descriptorCount << 32 | binding.stageFlags);
+  }
+  auto &bucket = mSetLayouts[HashLayoutWords(words)];
+  for (const auto &entry : bucket) {
+    if (SameBindings(entry.mBindings, bindings)) {
+      mReused++;
+      return entry.mLayout;
+    }
+  }
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .bindingCount = (u32)bindings.size(),
+      .pBindings = bindings.data(),
+  };
+  VkDescriptorSetLayout layout;
+  if (vkCreateDescriptorSetLayout(mDevice, &layoutInfo, nullptr, &layout) != VK_SUCCESS) {
+    fmt::print("failed to create descriptor set layout\n");
+    assert(0);
+  }
+  bucket.push_back({bindings, layout});
+  mCreated++;
+  return layout;
+}
+
+VkPipelineLayout LayoutCache::GetPipelineLayout(const ShaderReflection &reflection)
+{
+  std::vector<VkDescriptorSetLayout> setLayouts;
+  for (const auto &bindings : reflection.mSets) {
+    setLayouts.push_back(GetSetLayout(bindings));
+  }
+  const auto &push = reflection.mPushConstants;
+
+  // set layouts are deduplicated already, their handles stand in for their contents
+  std::vector<u64> words = {(u64)push.stageFlags << 32 | push.size, push.offset};
+  for (auto layout : setLayouts) {
+    words.push_back((u64)layout);
+  }
+  auto &bucket = mPipelineLayouts[HashLayoutWords(words)];
+  for (const auto &entry : bucket) {
+    if (entry.mSetLayouts == setLayouts && entry.mPushConstants.stageFlags == push.stageFlags
+        && entry.mPushConstants.offset == push.offset && entry.mPushConstants.size == push.size) {
+      mReused++;
+      return entry.mLayout;
+    }
+  }
+
+  VkPipelineLayoutCreateInfo layoutInfo = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+      .setLayoutCount = (u32)setLayouts.size(),
+      .pSetLayouts = setLayouts.data(),
+      .pushConstantRangeCount = push.size != 0 ? 1u : 0u,
+      .pPushConstantRanges = &push,
+  };
+  VkPipelineLayout layout;
+  if (vkCreatePipelineLayout(mDevice, &layoutInfo, nullptr, &layout) != VK_SUCCESS) {
+    fmt::print("failed to create pipeline layout\n");
+    assert(0);
+  }
+  bucket.push_back({std::move(setLayouts), push, layout});
+  mCreated++;
+  return layout;
+}
+
+void LayoutCache::PrintStats() const
+{
+  fmt::print("LayoutCache: {} layouts created, {} lookups served from the cache\n", mCreated, mReused);
+}
+
+} // namespace vk
@@ -0,0 +1,95 @@
+#pragma once
+#include "common.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace vk
+{
+
+struct VertexInput {
+  u32 mLocation;
+  VkFormat mFormat;
+};
+
+struct SpecConstantInfo {
+  // the constant_id the shader declared, what VkSpecializationMapEntry refers to
+  u32 mId;
+  u32 mSize;
+  // empty once the module's debug info is stripped, which cooking does
+  std::string mName;
+};
+
+// Everything a pipeline's layout and vertex input need from its shaders, for one stage or merged over several. The
+// shaders are the only place bindings, push constants and vertex inputs are written down, pipelines are built from
+// this instead of a second copy kept in sync by hand.
+struct ShaderReflection {
+  VkShaderStageFlags mStages = 0;
+  // indexed by set, each sorted by binding, a set no shader uses is empty
+  std::vector<std::vector<VkDescriptorSetLayoutBinding>> mSets;
+  // one range covering every stage's push constant block, size 0 when there isn't one
+  VkPushConstantRange mPushConstants = {};
+  // vertex stage inputs sorted by location, built-ins left out
+  std::vector<VertexInput> mVertexInputs;
+  // sorted by id
+  std::vector<SpecConstantInfo> mSpecConstants;
+  // compute only
+  u32 mLocalSize[3] = {1, 1, 1};
+
+  // stages are or'd together, a binding declared by both has to agree on its type and count
+  void Merge(const ShaderReflection &other);
+  // Switches a uniform or storage buffer binding to its _DYNAMIC type. The shader looks the same either way, only
+  // the app knows it binds with dynamic offsets.
+  void SetDynamic(u32 set, u32 binding);
+
+  // Attributes for vertices interleaved in one buffer at binding, packed in location order with no padding.
+  // Returns the stride, which callers should check against their vertex struct.
+  u32 GetVertexAttributes(u32 binding, std::vector<VkVertexInputAttributeDescription> *attributes) const;
+  // enough of every descriptor type for setCount copies of set
+  NODISCARD std::vector<VkDescriptorPoolSize> GetPoolSizes(u32 set, u32 setCount) const;
+  // nullptr if no stage declares it, or the names were stripped
+  NODISCARD const SpecConstantInfo *FindSpecConstant(const char *name) const;
+};
+
+// reflects the SPIR-V's first entry point, SPIR-V the reflection can't make sense of is an error
+NODISCARD ShaderReflection ReflectShader(const std::vector<char> &spirv);
+
+// Owns descriptor set layouts and pipeline layouts, each one created once however many pipelines ask for it. Lookups
+// hash the description and compare in full within the bucket, so a collision costs a compare rather than the wrong
+// layout. Not thread safe.
+class LayoutCache
+{
+  struct SetLayoutEntry {
+    std::vector<VkDescriptorSetLayoutBinding> mBindings;
+    VkDescriptorSetLayout mLayout;
+  };
+  struct PipelineLayoutEntry {
+    std::vector<VkDescriptorSetLayout> mSetLayouts;
+    VkPushConstantRange mPushConstants;
+    VkPipelineLayout mLayout;
+  };
+
+  VkDevice mDevice = VK_NULL_HANDLE;
+  std::unordered_map<u64, std::vector<SetLayoutEntry>> mSetLayouts;
+  std::unordered_map<u64, std::vector<PipelineLayoutEntry>> mPipelineLayouts;
+
+  u32 mCreated = 0;
+  u32 mReused = 0;
+
+public:
+  LayoutCache() = default;
+  explicit LayoutCache(VkDevice device);
+
+  // every pipeline using the layouts must be gone
+  void Destroy();
+
+  NODISCARD VkDescriptorSetLayout GetSetLayout(const std::vector<VkDescriptorSetLayoutBinding> &bindings);
+  // a set layout for every set up to the last the reflection uses, empty for the gaps
+  NODISCARD VkPipelineLayout GetPipelineLayout(const ShaderReflection &reflection);
+
+  void PrintStats() const;
+};
+
+} // namespace vk
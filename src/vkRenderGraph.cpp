@@ -0,0 +1,803 @@
+#include "vkRenderGraph.hpp"
+
+#include "common.h"
+
+#include <algorithm>
+#include <cassert>
+#include <fmt/core.h>
+
+namespace vk
+{
+
+static constexpr VkAccessFlags sRenderGraphWriteAccess =
+    VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+static bool IsDepthFormat(VkFormat format)
+{
+  switch (format) {
+  case VK_FORMAT_D16_UNORM:
+  case VK_FORMAT_X8_D24_UNORM_PACK32:
+  case VK_FORMAT_D32_SFLOAT:
+  case VK_FORMAT_D16_UNORM_S8_UINT:
+  case VK_FORMAT_D24_UNORM_S8_UINT:
+  case VK_FORMAT_D32_SFLOAT_S8_UINT:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static VkImageAspectFlags GetFormatAspect(VkFormat format)
+{
+  switch (format) {
+  case VK_FORMAT_D16_UNORM_S8_UINT:
+  case VK_FORMAT_D24_UNORM_S8_UINT:
+  case VK_FORMAT_D32_SFLOAT_S8_UINT:
+    return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+  default:
+    return IsDepthFormat(format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+  }
+}
+
+VkImage RenderGraph::PassContext::GetImage(ImageHandle handle) const
+{
+  return mGraph->mImages[handle].mImage;
+}
+
+VkImageView RenderGraph::PassContext::GetImageView(ImageHandle handle) const
+{
+  return mGraph->mImages[handle].mView;
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::WriteColor(ImageHandle handle, const VkClearColorValue *clear)
+{
+  Use use = {
+      .mHandle = handle,
+      .mLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .mStages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      // loading reads the old contents
+      .mAccess = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+                 | (clear ? 0 : (VkAccessFlags)VK_ACCESS_COLOR_ATTACHMENT_READ_BIT),
+      .mUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+      .mAttachment = true,
+      .mWrite = true,
+      .mClear = clear != nullptr,
+      .mClearValue = {},
+  };
+  if (clear) {
+    use.mClearValue.color = *clear;
+  }
+  mGraph->AddUse(mPass, use);
+  return *this;
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::WriteDepth(
+    ImageHandle handle, const VkClearDepthStencilValue *clear)
+{
+  Use use = {
+      .mHandle = handle,
+      .mLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+      .mStages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+      .mAccess = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+      .mUsage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+      .mAttachment = true,
+      .mWrite = true,
+      .mClear = clear != nullptr,
+      .mClearValue = {},
+  };
+  if (clear) {
+    use.mClearValue.depthStencil = *clear;
+  }
+  mGraph->AddUse(mPass, use);
+  return *this;
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::ReadTexture(ImageHandle handle, VkPipelineStageFlags stages)
+{
+  mGraph->AddUse(mPass, {
+      .mHandle = handle,
+      .mLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      .mStages = stages,
+      .mAccess = VK_ACCESS_SHADER_READ_BIT,
+      .mUsage = VK_IMAGE_USAGE_SAMPLED_BIT,
+      .mAttachment = false,
+      .mWrite = false,
+      .mClear = false,
+      .mClearValue = {},
+  });
+  return *this;
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::ReadTransfer(ImageHandle handle)
+{
+  mGraph->AddUse(mPass, {
+      .mHandle = handle,
+      .mLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      .mStages = VK_PIPELINE_STAGE_TRANSFER_BIT,
+      .mAccess = VK_ACCESS_TRANSFER_READ_BIT,
+      .mUsage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+      .mAttachment = false,
+      .mWrite = false,
+      .mClear = false,
+      .mClearValue = {},
+  });
+  return *this;
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::WriteTransfer(ImageHandle handle)
+{
+  // copies may only cover part of the image, so they keep the rest alive like a load would
+  mGraph->AddUse(mPass, {
+      .mHandle = handle,
+      .mLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      .mStages = VK_PIPELINE_STAGE_TRANSFER_BIT,
+      .mAccess = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .mUsage = VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+      .mAttachment = false,
+      .mWrite = true,
+      .mClear = false,
+      .mClearValue = {},
+  });
+  return *this;
+}
+
+RenderGraph::PassBuilder &RenderGraph::PassBuilder::SetSideEffects()
+{
+  mGraph->mPasses[mPass].mSideEffects = true;
+  return *this;
+}
+
+RenderGraph::RenderGraph(VkDevice device, Allocator *allocator, Timeline *timeline, DeletionQueue *deletions) :
+    mDevice(device), mAllocator(allocator), mTimeline(timeline), mDeletions(deletions)
+{
+}
+
+void RenderGraph::Destroy()
+{
+  RetireTransients();
+  ReleaseFramebuffers();
+  for (auto &[key, renderPass] : mRenderPasses) {
+    mDeletions->RenderPass(mTimeline, mTimeline->GetLastSignaled(), renderPass);
+  }
+  mRenderPasses.clear();
+  mTransientKey.clear();
+  Reset();
+}
+
+void RenderGraph::Reset()
+{
+  mPasses.clear();
+  mImages.clear();
+  mFinalBarriers.Clear();
+  mCompiled = false;
+}
+
+RenderGraph::ImageHandle RenderGraph::ImportImage(const char *name, VkImage image, VkImageView view,
+    const ImageDesc &desc, const ImageState &initial, const ImageState &final)
+{
+  mImages.push_back({
+      .mName = name,
+      .mDesc = desc,
+      .mImported = true,
+      .mInitial = initial,
+      .mFinal = final,
+      .mImage = image,
+      .mView = view,
+  });
+  return (ImageHandle)mImages.size() - 1;
+}
+
+RenderGraph::ImageHandle RenderGraph::CreateImage(const char *name, const ImageDesc &desc)
+{
+  mImages.push_back({
+      .mName = name,
+      .mDesc = desc,
+  });
+  return (ImageHandle)mImages.size() - 1;
+}
+
+RenderGraph::PassBuilder RenderGraph::AddPass(const char *name, VkSubpassContents contents, ExecuteFunc execute)
+{
+  assert(!mCompiled && "passes added after Compile()");
+  mPasses.push_back({
+      .mName = name,
+      .mExecute = std::move(execute),
+      .mContents = contents,
+  });
+  return {this, (u32)mPasses.size() - 1};
+}
+
+void RenderGraph::AddUse(u32 pass, const Use &use)
+{
+  assert(use.mHandle < mImages.size());
+  auto &uses = mPasses[pass].mUses;
+  // an image used twice by one pass is a feedback loop, there's no layout that works for both
+  assert(std::none_of(uses.begin(), uses.end(), [&](const Use &other) { return other.mHandle == use.mHandle; }));
+  uses.push_back(use);
+}
+
+void RenderGraph::Compile()
+{
+  assert(!mCompiled);
+  mCompileCount++;
+
+  // framebuffers nobody has asked for in a while most likely wrap views that are gone
+  for (auto it = mFramebuffers.begin(); it != mFramebuffers.end();) {
+    if (it->second.mLastUsed + sFramebufferIdleCompiles < mCompileCount) {
+      RetireFramebuffer(it->second.mFramebuffer);
+      it = mFramebuffers.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  mStats.mPassCount = (u32)mPasses.size();
+  mStats.mCulledPassCount = 0;
+  mStats.mBarrierBatchCount = 0;
+  mStats.mImageBarrierCount = 0;
+
+  CullPasses();
+  ComputeLifetimes();
+  AllocateTransients();
+  BuildBarriers();
+  BuildRenderPasses();
+  mCompiled = true;
+}
+
+void RenderGraph::CullPasses()
+{
+  // Backwards liveness: an image is needed if a later live pass reads what's in it, imported images always are. A
+  // pass is live if it writes something needed. Clearing an image ends the need for what was in it before.
+  std::vector<bool> needed(mImages.size());
+  for (u32 i = 0; i < mImages.size(); i++) {
+    needed[i] = mImages[i].mImported;
+  }
+  for (u32 p = (u32)mPasses.size(); p-- > 0;) {
+    auto &pass = mPasses[p];
+    pass.mLive = pass.mSideEffects || std::any_of(pass.mUses.begin(), pass.mUses.end(), [&](const Use &use) {
+      return use.mWrite && needed[use.mHandle];
+    });
+    if (!pass.mLive) {
+      mStats.mCulledPassCount++;
+      continue;
+    }
+    for (const auto &use : pass.mUses) {
+      if (use.mClear) {
+        needed[use.mHandle] = false;
+      }
+    }
+    for (const auto &use : pass.mUses) {
+      if (!use.mClear) {
+        needed[use.mHandle] = true;
+      }
+    }
+  }
+}
+
+void RenderGraph::ComputeLifetimes()
+{
+  for (u32 p = 0; p < mPasses.size(); p++) {
+    if (!mPasses[p].mLive) {
+      continue;
+    }
+    for (const auto &use : mPasses[p].mUses) {
+      auto &image = mImages[use.mHandle];
+      image.mUsage |= use.mUsage;
+      image.mFirstPass = std::min(image.mFirstPass, p);
+      image.mLastPass = std::max(image.mLastPass, p);
+    }
+  }
+}
+
+void RenderGraph::AllocateTransients()
+{
+  std::vector<u32> key;
+  for (const auto &image : mImages) {
+    if (image.mImported) {
+      key.push_back(0);
+      continue;
+    }
+    key.insert(key.end(), {1, (u32)image.mDesc.mFormat, image.mDesc.mExtent.width, image.mDesc.mExtent.height,
+                              image.mUsage, image.mFirstPass, image.mLastPass});
+  }
+
+  if (key != mTransientKey) {
+    RetireTransients();
+    mTransients.assign(mImages.size(), {});
+    mTransientKey = std::move(key);
+
+    struct Slot {
+      VkMemoryRequirements mRequirements;
+      std::vector<u32> mImages;
+    };
+    std::vector<Slot> slots;
+    std::vector<VkMemoryRequirements> requirements(mImages.size());
+    std::vector<u32> order;
+    mStats.mTransientImageCount = 0;
+    mStats.mTransientBytes = 0;
+    mStats.mAllocatedBytes = 0;
+
+    for (u32 i = 0; i < mImages.size(); i++) {
+      const auto &image = mImages[i];
+      // culled along with every pass that used it
+      if (image.mImported || image.mUsage == 0) {
+        continue;
+      }
+      VkImageCreateInfo imageInfo = {
+          .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+          .imageType = VK_IMAGE_TYPE_2D,
+          .format = image.mDesc.mFormat,
+          .extent = {image.mDesc.mExtent.width, image.mDesc.mExtent.height, 1},
+          .mipLevels = 1,
+          .arrayLayers = 1,
+          .samples = VK_SAMPLE_COUNT_1_BIT,
+          .tiling = VK_IMAGE_TILING_OPTIMAL,
+          .usage = image.mUsage,
+          .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+          .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      };
+      if (vkCreateImage(mDevice, &imageInfo, nullptr, &mTransients[i].mImage) != VK_SUCCESS) {
+        fmt::print("failed to create transient image {}\n", image.mName);
+        assert(0);
+      }
+      vkGetImageMemoryRequirements(mDevice, mTransients[i].mImage, &requirements[i]);
+      mStats.mTransientImageCount++;
+      mStats.mTransientBytes += requirements[i].size;
+      order.push_back(i);
+    }
+
+    // Biggest first, each image goes into the first slot whose images are all dead before it starts or born after
+    // it ends. Greedy interval packing, not optimal but it never does worse than one allocation per image.
+    std::sort(order.begin(), order.end(), [&](u32 a, u32 b) { return requirements[a].size > requirements[b].size; });
+    for (u32 i : order) {
+      const auto &image = mImages[i];
+      auto fits = [&](const Slot &slot) {
+        if ((slot.mRequirements.memoryTypeBits & requirements[i].memoryTypeBits) == 0) {
+          return false;
+        }
+        return std::all_of(slot.mImages.begin(), slot.mImages.end(), [&](u32 other) {
+          return image.mLastPass < mImages[other].mFirstPass || mImages[other].mLastPass < image.mFirstPass;
+        });
+      };
+      auto slot = std::find_if(slots.begin(), slots.end(), fits);
+      if (slot == slots.end()) {
+        slots.push_back({requirements[i], {}});
+        slot = slots.end() - 1;
+      }
+      slot->mRequirements.size = std::max(slot->mRequirements.size, requirements[i].size);
+      slot->mRequirements.alignment = std::max(slot->mRequirements.alignment, requirements[i].alignment);
+      slot->mRequirements.memoryTypeBits &= requirements[i].memoryTypeBits;
+      slot->mImages.push_back(i);
+    }
+
+    for (u32 s = 0; s < slots.size(); s++) {
+      auto &slot = slots[s];
+      u32 memoryType =
+          mAllocator->FindMemoryType(slot.mRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+      auto allocation = mAllocator->Allocate(slot.mRequirements, memoryType, false);
+      mTransientMemory.push_back(allocation);
+      mTransientMemoryAccess.push_back({0, 0});
+      mStats.mAllocatedBytes += slot.mRequirements.size;
+
+      // in the order they use the memory, each has to wait for the one before it to finish
+      std::sort(slot.mImages.begin(), slot.mImages.end(),
+          [&](u32 a, u32 b) { return mImages[a].mFirstPass < mImages[b].mFirstPass; });
+      for (u32 j = 0; j < slot.mImages.size(); j++) {
+        u32 i = slot.mImages[j];
+        auto &transient = mTransients[i];
+        transient.mSlot = s;
+        transient.mAliasOf = j > 0 ? slot.mImages[j - 1] : ~0u;
+        vkBindImageMemory(mDevice, transient.mImage, allocation.mMemory, allocation.mOffset);
+
+        VkImageViewCreateInfo viewInfo = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = transient.mImage,
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = mImages[i].mDesc.mFormat,
+            .subresourceRange = {GetFormatAspect(mImages[i].mDesc.mFormat), 0, 1, 0, 1},
+        };
+        if (vkCreateImageView(mDevice, &viewInfo, nullptr, &transient.mView) != VK_SUCCESS) {
+          fmt::print("failed to create transient image view {}\n", mImages[i].mName);
+          assert(0);
+        }
+      }
+    }
+  }
+
+  for (u32 i = 0; i < mImages.size(); i++) {
+    if (!mImages[i].mImported) {
+      mImages[i].mImage = mTransients[i].mImage;
+      mImages[i].mView = mTransients[i].mView;
+    }
+  }
+}
+
+void RenderGraph::BuildBarriers()
+{
+  std::vector<Tracking> tracking(mImages.size());
+  for (u32 i = 0; i < mImages.size(); i++) {
+    const auto &image = mImages[i];
+    if (image.mImported) {
+      tracking[i] = {
+          .mLayout = image.mInitial.mLayout,
+          .mWriteStages = image.mInitial.mStage,
+          .mWriteAccess = image.mInitial.mAccess,
+          .mReadStages = 0,
+          .mReadAccess = 0,
+          .mHasContents = image.mInitial.mLayout != VK_IMAGE_LAYOUT_UNDEFINED,
+      };
+    } else if (image.mUsage != 0 && mTransients[i].mAliasOf == ~0u) {
+      // The image and its memory are the same ones earlier frames used, and those may still be in flight. Their
+      // accesses are in the first sync scope of this barrier since they were submitted to the same queue first.
+      const auto &previous = mTransientMemoryAccess[mTransients[i].mSlot];
+      tracking[i] = {VK_IMAGE_LAYOUT_UNDEFINED, previous.mStages, previous.mWriteAccess, 0, 0, false};
+    } else {
+      tracking[i] = {VK_IMAGE_LAYOUT_UNDEFINED, 0, 0, 0, 0, false};
+    }
+  }
+
+  for (u32 p = 0; p < mPasses.size(); p++) {
+    auto &pass = mPasses[p];
+    pass.mBarriers.Clear();
+    pass.mLoadOps.clear();
+    if (!pass.mLive) {
+      continue;
+    }
+
+    for (const auto &use : pass.mUses) {
+      auto &state = tracking[use.mHandle];
+      const auto &image = mImages[use.mHandle];
+
+      // memory shared with an earlier transient, that one's last accesses have to finish before this one starts
+      u32 aliasOf = image.mImported ? ~0u : mTransients[use.mHandle].mAliasOf;
+      if (image.mFirstPass == p && aliasOf != ~0u) {
+        const auto &previous = tracking[aliasOf];
+        state.mWriteStages = previous.mWriteStages | previous.mReadStages;
+        state.mWriteAccess = previous.mWriteAccess;
+      }
+
+      bool discard = use.mClear || !state.mHasContents;
+      if (use.mAttachment) {
+        pass.mLoadOps.push_back(use.mClear              ? VK_ATTACHMENT_LOAD_OP_CLEAR
+                                : state.mHasContents ? VK_ATTACHMENT_LOAD_OP_LOAD
+                                                     : VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+      }
+
+      bool layoutChange = state.mLayout != use.mLayout;
+      bool hazard;
+      if (use.mWrite || layoutChange) {
+        // writes and transitions wait for everything before them, reads included
+        hazard = (state.mWriteStages | state.mReadStages) != 0;
+      } else {
+        // a read only needs a barrier the first time its stage and access see the last write
+        hazard = state.mWriteStages != 0
+                 && ((state.mReadStages & use.mStages) != use.mStages
+                     || (state.mReadAccess & use.mAccess) != use.mAccess);
+      }
+
+      if (layoutChange || hazard) {
+        VkPipelineStageFlags srcStages = state.mWriteStages;
+        if (use.mWrite || layoutChange) {
+          srcStages |= state.mReadStages;
+        }
+        pass.mBarriers.Image(srcStages ? srcStages : (VkPipelineStageFlags)VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            use.mStages,
+            {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                .srcAccessMask = state.mWriteAccess,
+                .dstAccessMask = use.mAccess,
+                .oldLayout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.mLayout,
+                .newLayout = use.mLayout,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .image = image.mImage,
+                .subresourceRange = {GetFormatAspect(image.mDesc.mFormat), 0, 1, 0, 1},
+            });
+      }
+
+      if (use.mWrite) {
+        state.mLayout = use.mLayout;
+        state.mWriteStages = use.mStages;
+        state.mWriteAccess = use.mAccess & sRenderGraphWriteAccess;
+        state.mReadStages = 0;
+        state.mReadAccess = 0;
+        state.mHasContents = true;
+      } else if (layoutChange) {
+        // the transition is ordered before this read, earlier reads are ordered before the transition
+        state.mLayout = use.mLayout;
+        state.mWriteStages |= use.mStages;
+        state.mReadStages = use.mStages;
+        state.mReadAccess = use.mAccess;
+      } else {
+        state.mReadStages |= use.mStages;
+        state.mReadAccess |= hazard ? use.mAccess : 0;
+      }
+    }
+
+    if (!pass.mBarriers.IsEmpty()) {
+      mStats.mBarrierBatchCount++;
+      mStats.mImageBarrierCount += pass.mBarriers.GetCount();
+    }
+  }
+
+  // every transient in a slot is ordered before its last, so the union of them is all the next frame waits on
+  for (auto &access : mTransientMemoryAccess) {
+    access = {0, 0};
+  }
+  for (u32 i = 0; i < mImages.size(); i++) {
+    if (mImages[i].mImported || mImages[i].mUsage == 0) {
+      continue;
+    }
+    auto &access = mTransientMemoryAccess[mTransients[i].mSlot];
+    access.mStages |= tracking[i].mWriteStages | tracking[i].mReadStages;
+    access.mWriteAccess |= tracking[i].mWriteAccess;
+  }
+
+  // hand imported images over in the layout the next user expects, it waits for anything else itself
+  mFinalBarriers.Clear();
+  for (u32 i = 0; i < mImages.size(); i++) {
+    const auto &image = mImages[i];
+    const auto &state = tracking[i];
+    if (!image.mImported || state.mLayout == image.mFinal.mLayout) {
+      continue;
+    }
+    VkPipelineStageFlags srcStages = state.mWriteStages | state.mReadStages;
+    mFinalBarriers.Image(srcStages ? srcStages : (VkPipelineStageFlags)VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        image.mFinal.mStage,
+        {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = state.mWriteAccess,
+            .dstAccessMask = image.mFinal.mAccess,
+            .oldLayout = state.mLayout,
+            .newLayout = image.mFinal.mLayout,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = image.mImage,
+            .subresourceRange = {GetFormatAspect(image.mDesc.mFormat), 0, 1, 0, 1},
+        });
+  }
+  if (!mFinalBarriers.IsEmpty()) {
+    mStats.mBarrierBatchCount++;
+    mStats.mImageBarrierCount += mFinalBarriers.GetCount();
+  }
+}
+
+void RenderGraph::BuildRenderPasses()
+{
+  for (u32 p = 0; p < mPasses.size(); p++) {
+    auto &pass = mPasses[p];
+    pass.mRenderPass = VK_NULL_HANDLE;
+    pass.mFramebuffer = VK_NULL_HANDLE;
+    pass.mExtent = {};
+    pass.mClearValues.clear();
+    if (!pass.mLive) {
+      continue;
+    }
+
+    std::vector<u32> key;
+    std::vector<VkImageView> views;
+    u32 attachment = 0;
+    for (const auto &use : pass.mUses) {
+      if (!use.mAttachment) {
+        continue;
+      }
+      const auto &image = mImages[use.mHandle];
+      // keep the result if a later live pass reads it before clearing it, or if it leaves the graph
+      VkAttachmentStoreOp storeOp = image.mImported ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+      bool found = false;
+      for (u32 later = p + 1; later < mPasses.size() && !found; later++) {
+        if (!mPasses[later].mLive) {
+          continue;
+        }
+        for (const auto &laterUse : mPasses[later].mUses) {
+          if (laterUse.mHandle == use.mHandle) {
+            storeOp = laterUse.mClear ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+            found = true;
+          }
+        }
+      }
+
+      if (pass.mExtent.width == 0) {
+        pass.mExtent = image.mDesc.mExtent;
+      }
+      assert(pass.mExtent.width == image.mDesc.mExtent.width && pass.mExtent.height == image.mDesc.mExtent.height
+             && "attachments of one pass must be the same size");
+
+      bool depth = use.mLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+      key.insert(key.end(), {(u32)image.mDesc.mFormat, (u32)pass.mLoadOps[attachment], (u32)storeOp,
+                                (u32)use.mLayout, (u32)depth});
+      views.push_back(image.mView);
+      pass.mClearValues.push_back(use.mClearValue);
+      attachment++;
+    }
+    if (key.empty()) {
+      continue;
+    }
+    pass.mRenderPass = GetRenderPass(key);
+    pass.mFramebuffer = GetFramebuffer(pass.mRenderPass, views, pass.mExtent);
+  }
+}
+
+void RenderGraph::Execute(VkCommandBuffer commandBuffer)
+{
+  assert(mCompiled && "Execute() without Compile()");
+  for (const auto &pass : mPasses) {
+    if (!pass.mLive) {
+      continue;
+    }
+    pass.mBarriers.Record(commandBuffer);
+
+    PassContext context = {
+        .mCommandBuffer = commandBuffer,
+        .mRenderPass = pass.mRenderPass,
+        .mFramebuffer = pass.mFramebuffer,
+        .mExtent = pass.mExtent,
+        .mGraph = this,
+    };
+    if (pass.mRenderPass == VK_NULL_HANDLE) {
+      pass.mExecute(context);
+      continue;
+    }
+    VkRenderPassBeginInfo renderPassInfo = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+        .renderPass = pass.mRenderPass,
+        .framebuffer = pass.mFramebuffer,
+        .renderArea = {{0, 0}, pass.mExtent},
+        .clearValueCount = (u32)pass.mClearValues.size(),
+        .pClearValues = pass.mClearValues.data(),
+    };
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, pass.mContents);
+    pass.mExecute(context);
+    vkCmdEndRenderPass(commandBuffer);
+  }
+
+  mFinalBarriers.Record(commandBuffer);
+}
+
+VkRenderPass RenderGraph::GetCompatibleRenderPass(const std::vector<VkFormat> &colorFormats, VkFormat depthFormat)
+{
+  // compatibility ignores load and store ops and layouts, only the formats and their order have to line up
+  std::vector<u32> key;
+  for (auto format : colorFormats) {
+    key.insert(key.end(), {(u32)format, (u32)VK_ATTACHMENT_LOAD_OP_DONT_CARE, (u32)VK_ATTACHMENT_STORE_OP_STORE,
+                              (u32)VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 0});
+  }
+  if (depthFormat != VK_FORMAT_UNDEFINED) {
+    key.insert(key.end(), {(u32)depthFormat, (u32)VK_ATTACHMENT_LOAD_OP_DONT_CARE, (u32)VK_ATTACHMENT_STORE_OP_STORE,
+                              (u32)VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1});
+  }
+  return GetRenderPass(key);
+}
+
+VkRenderPass RenderGraph::GetRenderPass(const std::vector<u32> &key)
+{
+  auto it = mRenderPasses.find(key);
+  if (it != mRenderPasses.end()) {
+    return it->second;
+  }
+
+  // five words per attachment: format, load op, store op, layout, depth
+  std::vector<VkAttachmentDescription> attachments;
+  std::vector<VkAttachmentReference> colorRefs;
+  VkAttachmentReference depthRef = {};
+  bool hasDepth = false;
+  for (u32 i = 0; i + 5 <= key.size(); i += 5) {
+    auto format = (VkFormat)key[i];
+    auto loadOp = (VkAttachmentLoadOp)key[i + 1];
+    auto storeOp = (VkAttachmentStoreOp)key[i + 2];
+    auto layout = (VkImageLayout)key[i + 3];
+    bool stencil = GetFormatAspect(format) & VK_IMAGE_ASPECT_STENCIL_BIT;
+    attachments.push_back({
+        .format = format,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .loadOp = loadOp,
+        .storeOp = storeOp,
+        .stencilLoadOp = stencil ? loadOp : VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = stencil ? storeOp : VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        // the graph's barriers put it in this layout before the pass and pick it up from there after
+        .initialLayout = layout,
+        .finalLayout = layout,
+    });
+    VkAttachmentReference ref = {(u32)attachments.size() - 1, layout};
+    if (key[i + 4]) {
+      depthRef = ref;
+      hasDepth = true;
+    } else {
+      colorRefs.push_back(ref);
+    }
+  }
+
+  VkSubpassDescription subpass = {
+      .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+      .colorAttachmentCount = (u32)colorRefs.size(),
+      .pColorAttachments = colorRefs.data(),
+      .pDepthStencilAttachment = hasDepth ? &depthRef : nullptr,
+  };
+  VkRenderPassCreateInfo renderPassInfo = {
+      .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+      .attachmentCount = (u32)attachments.size(),
+      .pAttachments = attachments.data(),
+      .subpassCount = 1,
+      .pSubpasses = &subpass,
+  };
+  VkRenderPass renderPass;
+  if (vkCreateRenderPass(mDevice, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
+    fmt::print("failed to create render graph render pass\n");
+    assert(0);
+  }
+  mRenderPasses.emplace(key, renderPass);
+  return renderPass;
+}
+
+VkFramebuffer RenderGraph::GetFramebuffer(
+    VkRenderPass renderPass, const std::vector<VkImageView> &views, VkExtent2D extent)
+{
+  std::vector<u64> key = {(u64)renderPass, extent.width, extent.height};
+  for (auto view : views) {
+    key.push_back((u64)view);
+  }
+  auto it = mFramebuffers.find(key);
+  if (it != mFramebuffers.end()) {
+    it->second.mLastUsed = mCompileCount;
+    return it->second.mFramebuffer;
+  }
+
+  VkFramebufferCreateInfo framebufferInfo = {
+      .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+      .renderPass = renderPass,
+      .attachmentCount = (u32)views.size(),
+      .pAttachments = views.data(),
+      .width = extent.width,
+      .height = extent.height,
+      .layers = 1,
+  };
+  VkFramebuffer framebuffer;
+  if (vkCreateFramebuffer(mDevice, &framebufferInfo, nullptr, &framebuffer) != VK_SUCCESS) {
+    fmt::print("failed to create render graph framebuffer\n");
+    assert(0);
+  }
+  mFramebuffers.emplace(key, CachedFramebuffer{framebuffer, mCompileCount});
+  return framebuffer;
+}
+
+void RenderGraph::ReleaseFramebuffers()
+{
+  if (mFramebuffers.empty()) {
+    return;
+  }
+  for (auto &[key, cached] : mFramebuffers) {
+    RetireFramebuffer(cached.mFramebuffer);
+  }
+  mFramebuffers.clear();
+}
+
+void RenderGraph::RetireFramebuffer(VkFramebuffer framebuffer)
+{
+  mDeletions->Framebuffer(mTimeline, mTimeline->GetLastSignaled(), framebuffer);
+}
+
+void RenderGraph::RetireTransients()
+{
+  // the images go first, the memory they alias is queued after them
+  u64 value = mTimeline->GetLastSignaled();
+  for (auto &transient : mTransients) {
+    mDeletions->ImageView(mTimeline, value, transient.mView);
+    mDeletions->Image(mTimeline, value, transient.mImage);
+  }
+  for (auto &allocation : mTransientMemory) {
+    mDeletions->Memory(mTimeline, value, allocation);
+  }
+  mTransients.clear();
+  mTransientMemory.clear();
+  mTransientMemoryAccess.clear();
+}
+
+void RenderGraph::PrintStats() const
+{
+  fmt::print("RenderGraph: {} passes ({} culled), {} barrier batches with {} image barriers, {} transient images in "
+             "{} KiB instead of {} KiB\n",
+      mStats.mPassCount, mStats.mCulledPassCount, mStats.mBarrierBatchCount, mStats.mImageBarrierCount,
+      mStats.mTransientImageCount, mStats.mAllocatedBytes / 1024, mStats.mTransientBytes / 1024);
+}
+
+} // namespace vk
@@ -0,0 +1,247 @@
+#pragma once
+#include "common.h"
+#include "vkAllocator.hpp"
+#include "vkDeletionQueue.hpp"
+#include "vkSync.hpp"
+#include "vkTimeline.hpp"
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace vk
+{
+
+// A frame described as passes that declare which images they read and write. The graph is rebuilt every frame and
+// Compile() works out everything that used to be written by hand:
+//  - passes whose results nobody reads are culled
+//  - one batched pipeline barrier before each pass covers every layout transition and hazard it has
+//  - attachment load and store ops follow from whether the previous contents are needed and whether anything reads
+//    the result later
+//  - transient images whose lifetimes don't overlap share memory, and since the memory is kept from frame to frame
+//    the first use of it each frame waits on the previous frame's last
+//
+// Render passes are single subpass and carry no dependencies or layout transitions of their own, the graph's
+// barriers do all of that. Render passes, framebuffers and transient images are cached between frames, a graph whose
+// shape doesn't change from frame to frame creates nothing after the first. Anything that stops being used goes to
+// the deletion queue with the timeline's last value.
+class RenderGraph
+{
+public:
+  using ImageHandle = u32;
+
+  struct ImageDesc {
+    VkFormat mFormat = VK_FORMAT_UNDEFINED;
+    VkExtent2D mExtent = {};
+  };
+
+  // how an imported image is left before the graph and must be left after it. mStage and mAccess are the previous
+  // (or next) user's, for a swap chain image that's the stage the acquire semaphore is waited on.
+  struct ImageState {
+    VkImageLayout mLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkPipelineStageFlags mStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    VkAccessFlags mAccess = 0;
+  };
+
+  // what a pass gets while it records, the render pass and framebuffer are null for passes without attachments
+  struct PassContext {
+    VkCommandBuffer mCommandBuffer;
+    VkRenderPass mRenderPass;
+    VkFramebuffer mFramebuffer;
+    VkExtent2D mExtent;
+    const RenderGraph *mGraph;
+
+    NODISCARD VkImage GetImage(ImageHandle handle) const;
+    NODISCARD VkImageView GetImageView(ImageHandle handle) const;
+  };
+  using ExecuteFunc = std::function<void(const PassContext &context)>;
+
+  class PassBuilder
+  {
+    RenderGraph *mGraph;
+    u32 mPass;
+
+  public:
+    PassBuilder(RenderGraph *graph, u32 pass) : mGraph(graph), mPass(pass) {}
+    // Without a clear value the previous contents are loaded if there are any. Colour attachments have to be declared
+    // before the depth attachment for GetCompatibleRenderPass() to match.
+    PassBuilder &WriteColor(ImageHandle handle, const VkClearColorValue *clear = nullptr);
+    PassBuilder &WriteDepth(ImageHandle handle, const VkClearDepthStencilValue *clear = nullptr);
+    PassBuilder &ReadTexture(ImageHandle handle, VkPipelineStageFlags stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    PassBuilder &ReadTransfer(ImageHandle handle);
+    PassBuilder &WriteTransfer(ImageHandle handle);
+    // never culled, for passes whose effects the graph can't see
+    PassBuilder &SetSideEffects();
+  };
+
+  struct Stats {
+    u32 mPassCount = 0;
+    u32 mCulledPassCount = 0;
+    u32 mBarrierBatchCount = 0;
+    u32 mImageBarrierCount = 0;
+    u32 mTransientImageCount = 0;
+    // what the transient images would take without aliasing, and what they were given
+    VkDeviceSize mTransientBytes = 0;
+    VkDeviceSize mAllocatedBytes = 0;
+  };
+
+private:
+  // frames a cached framebuffer may go unused before it's destroyed
+  static constexpr u32 sFramebufferIdleCompiles = 16;
+
+  struct Use {
+    ImageHandle mHandle;
+    VkImageLayout mLayout;
+    VkPipelineStageFlags mStages;
+    VkAccessFlags mAccess;
+    VkImageUsageFlags mUsage;
+    // bound to the pass's render pass
+    bool mAttachment;
+    bool mWrite;
+    // replaces the previous contents outright, they're neither loaded nor kept alive for this pass
+    bool mClear;
+    VkClearValue mClearValue;
+  };
+
+  struct Pass {
+    std::string mName;
+    ExecuteFunc mExecute;
+    VkSubpassContents mContents;
+    std::vector<Use> mUses;
+    bool mSideEffects = false;
+    bool mLive = false;
+
+    // filled by Compile()
+    BarrierBatch mBarriers;
+    VkRenderPass mRenderPass = VK_NULL_HANDLE;
+    VkFramebuffer mFramebuffer = VK_NULL_HANDLE;
+    VkExtent2D mExtent = {};
+    // one per attachment in declaration order
+    std::vector<VkAttachmentLoadOp> mLoadOps;
+    std::vector<VkClearValue> mClearValues;
+  };
+
+  struct Image {
+    std::string mName;
+    ImageDesc mDesc;
+    bool mImported = false;
+    ImageState mInitial;
+    ImageState mFinal;
+    VkImage mImage = VK_NULL_HANDLE;
+    VkImageView mView = VK_NULL_HANDLE;
+
+    // filled by Compile()
+    VkImageUsageFlags mUsage = 0;
+    u32 mFirstPass = ~0u;
+    u32 mLastPass = 0;
+  };
+
+  // hazard tracking for one image while Compile() walks the passes
+  struct Tracking {
+    VkImageLayout mLayout;
+    // the last write and the transitions since, everything after has to wait on these
+    VkPipelineStageFlags mWriteStages;
+    VkAccessFlags mWriteAccess;
+    // reads since then, a write has to wait for them and a read already covered needs no barrier
+    VkPipelineStageFlags mReadStages;
+    VkAccessFlags mReadAccess;
+    // a live pass wrote it or it was imported with contents
+    bool mHasContents;
+  };
+
+  struct TransientImage {
+    VkImage mImage = VK_NULL_HANDLE;
+    VkImageView mView = VK_NULL_HANDLE;
+    // index into mTransientMemory
+    u32 mSlot = 0;
+    // the image that used the same memory before this one, ~0u for the first
+    u32 mAliasOf = ~0u;
+  };
+
+  // what the last compiled frame did to a transient memory slot, the frames after it reuse the same memory
+  struct SlotAccess {
+    VkPipelineStageFlags mStages;
+    VkAccessFlags mWriteAccess;
+  };
+
+  struct CachedFramebuffer {
+    VkFramebuffer mFramebuffer;
+    u64 mLastUsed;
+  };
+
+  VkDevice mDevice = VK_NULL_HANDLE;
+  Allocator *mAllocator = nullptr;
+  Timeline *mTimeline = nullptr;
+  DeletionQueue *mDeletions = nullptr;
+
+  std::vector<Pass> mPasses;
+  std::vector<Image> mImages;
+  BarrierBatch mFinalBarriers;
+  bool mCompiled = false;
+  u64 mCompileCount = 0;
+  Stats mStats;
+
+  // physical images behind the transient handles, in handle order, rebuilt when mTransientKey changes
+  std::vector<u32> mTransientKey;
+  std::vector<TransientImage> mTransients;
+  std::vector<Allocation> mTransientMemory;
+  // indexed like mTransientMemory, the first image in each slot waits on it
+  std::vector<SlotAccess> mTransientMemoryAccess;
+
+  std::map<std::vector<u32>, VkRenderPass> mRenderPasses;
+  std::map<std::vector<u64>, CachedFramebuffer> mFramebuffers;
+
+public:
+  RenderGraph() = default;
+  // the timeline is the one the recorded command buffers are submitted to
+  RenderGraph(VkDevice device, Allocator *allocator, Timeline *timeline, DeletionQueue *deletions);
+
+  // hands everything the graph owns to the deletion queue, frames still in flight may keep using it
+  void Destroy();
+
+  // drops last frame's passes and images, the caches stay
+  void Reset();
+
+  // an image the graph doesn't own, e.g. the swap chain image. Its contents are kept unless initial.mLayout is
+  // VK_IMAGE_LAYOUT_UNDEFINED, and it's never culled.
+  NODISCARD ImageHandle ImportImage(const char *name, VkImage image, VkImageView view, const ImageDesc &desc,
+      const ImageState &initial, const ImageState &final);
+  // an image that only lives for this frame, usage flags come from how the passes use it
+  NODISCARD ImageHandle CreateImage(const char *name, const ImageDesc &desc);
+
+  NODISCARD PassBuilder AddPass(const char *name, VkSubpassContents contents, ExecuteFunc execute);
+
+  void Compile();
+  // records every live pass, and the barriers around them, into commandBuffer
+  void Execute(VkCommandBuffer commandBuffer);
+
+  // A render pass compatible with what the graph creates for passes with these attachments, for building
+  // pipelines. Owned by the graph.
+  NODISCARD VkRenderPass GetCompatibleRenderPass(
+      const std::vector<VkFormat> &colorFormats, VkFormat depthFormat = VK_FORMAT_UNDEFINED);
+
+  // retires every cached framebuffer, call when imported views are about to be destroyed so a recycled handle
+  // can't match a stale entry
+  void ReleaseFramebuffers();
+
+  NODISCARD const Stats &GetStats() const { return mStats; }
+  void PrintStats() const;
+
+private:
+  void AddUse(u32 pass, const Use &use);
+  // everything recorded so far has been submitted by the time anything is retired, the last signalled value covers it
+  void RetireFramebuffer(VkFramebuffer framebuffer);
+  void RetireTransients();
+  void CullPasses();
+  void ComputeLifetimes();
+  void AllocateTransients();
+  void BuildBarriers();
+  void BuildRenderPasses();
+  NODISCARD VkRenderPass GetRenderPass(const std::vector<u32> &key);
+  NODISCARD VkFramebuffer GetFramebuffer(VkRenderPass renderPass, const std::vector<VkImageView> &views,
+      VkExtent2D extent);
+};
+
+} // namespace vk
@@ -0,0 +1,88 @@
+#include "vkResources.hpp"
+
+#include "common.h"
+
+#include <fmt/core.h>
+
+namespace vk
+{
+
+ResourceRegistry::ResourceRegistry(VkDevice device, Allocator *allocator, DeletionQueue *deletions) :
+    mDevice(device), mAllocator(allocator), mDeletions(deletions)
+{
+}
+
+void ResourceRegistry::Destroy()
+{
+  mBuffers.ForEach([&](BufferHandle handle) {
+    vkDestroyBuffer(mDevice, mBuffers.Get<0>(handle), nullptr);
+    mAllocator->Free(mBuffers.Get<1>(handle));
+  });
+  mImages.ForEach([&](ImageHandle handle) {
+    vkDestroyImageView(mDevice, mImages.Get<1>(handle), nullptr);
+    vkDestroyImage(mDevice, mImages.Get<0>(handle), nullptr);
+    mAllocator->Free(mImages.Get<2>(handle));
+  });
+  mSamplers.ForEach([&](SamplerHandle handle) { vkDestroySampler(mDevice, mSamplers.Get<0>(handle), nullptr); });
+  mPipelines.ForEach([&](PipelineHandle handle) { vkDestroyPipeline(mDevice, mPipelines.Get<0>(handle), nullptr); });
+  mBuffers = {};
+  mImages = {};
+  mSamplers = {};
+  mPipelines = {};
+}
+
+BufferHandle ResourceRegistry::AddBuffer(VkBuffer buffer, const Allocation &allocation, VkDeviceSize size)
+{
+  return mBuffers.Create(buffer, allocation, size);
+}
+
+ImageHandle ResourceRegistry::AddImage(
+    VkImage image, VkImageView view, const Allocation &allocation, VkExtent2D extent, VkFormat format)
+{
+  return mImages.Create(image, view, allocation, extent, format);
+}
+
+SamplerHandle ResourceRegistry::AddSampler(VkSampler sampler)
+{
+  return mSamplers.Create(sampler);
+}
+
+PipelineHandle ResourceRegistry::AddPipeline(VkPipeline pipeline, VkPipelineLayout layout,
+    VkPipelineBindPoint bindPoint)
+{
+  return mPipelines.Create(pipeline, layout, bindPoint);
+}
+
+void ResourceRegistry::Destroy(BufferHandle handle, Timeline *timeline, u64 value)
+{
+  mDeletions->Buffer(timeline, value, mBuffers.Get<0>(handle), mBuffers.Get<1>(handle));
+  mBuffers.Destroy(handle);
+}
+
+void ResourceRegistry::Destroy(ImageHandle handle, Timeline *timeline, u64 value)
+{
+  // the view is queued first so it's gone before the image it looks at
+  mDeletions->ImageView(timeline, value, mImages.Get<1>(handle));
+  mDeletions->Image(timeline, value, mImages.Get<0>(handle), mImages.Get<2>(handle));
+  mImages.Destroy(handle);
+}
+
+void ResourceRegistry::Destroy(SamplerHandle handle, Timeline *timeline, u64 value)
+{
+  mDeletions->Sampler(timeline, value, mSamplers.Get<0>(handle));
+  mSamplers.Destroy(handle);
+}
+
+void ResourceRegistry::Destroy(PipelineHandle handle, Timeline *timeline, u64 value)
+{
+  mDeletions->Pipeline(timeline, value, mPipelines.Get<0>(handle));
+  mPipelines.Destroy(handle);
+}
+
+void ResourceRegistry::PrintStats() const
+{
+  fmt::print("ResourceRegistry: {} buffers, {} images, {} samplers, {} pipelines live\n", mBuffers.GetCount(),
+      mImages.GetCount(), mSamplers.GetCount(), mPipelines.GetCount());
+}
+
+} // namespace vk
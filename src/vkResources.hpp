@@ -0,0 +1,91 @@
+#pragma once
+#include "HandlePool.hpp"
+#include "common.h"
+#include "vkAllocator.hpp"
+#include "vkDeletionQueue.hpp"
+#include "vkTimeline.hpp"
+
+#include <vulkan/vulkan.h>
+
+namespace vk
+{
+
+struct BufferTag;
+struct ImageTag;
+struct SamplerTag;
+struct PipelineTag;
+using BufferHandle = Handle<BufferTag>;
+using ImageHandle = Handle<ImageTag>;
+using SamplerHandle = Handle<SamplerTag>;
+using PipelineHandle = Handle<PipelineTag>;
+
+// Owns GPU resources behind 32 bit generational handles, so the rest of the app passes around handles that can be
+// checked for staleness instead of Vulkan objects that can't. The objects are made by whoever needs them and handed
+// over, the registry only keeps them and their metadata in SoA pools, and destroying a handle frees its slot straight
+// away while the objects themselves go through the deletion queue.
+class ResourceRegistry
+{
+  // field order is the order of the Get<> indices below
+  using BufferPool = HandlePool<BufferTag, VkBuffer, Allocation, VkDeviceSize>;
+  using ImagePool = HandlePool<ImageTag, VkImage, VkImageView, Allocation, VkExtent2D, VkFormat>;
+  using SamplerPool = HandlePool<SamplerTag, VkSampler>;
+  using PipelinePool = HandlePool<PipelineTag, VkPipeline, VkPipelineLayout, VkPipelineBindPoint>;
+
+  VkDevice mDevice = VK_NULL_HANDLE;
+  Allocator *mAllocator = nullptr;
+  DeletionQueue *mDeletions = nullptr;
+
+  BufferPool mBuffers;
+  ImagePool mImages;
+  SamplerPool mSamplers;
+  PipelinePool mPipelines;
+
+public:
+  ResourceRegistry() = default;
+  ResourceRegistry(VkDevice device, Allocator *allocator, DeletionQueue *deletions);
+
+  // destroys everything still registered, the GPU must be idle
+  void Destroy();
+
+  NODISCARD BufferHandle AddBuffer(VkBuffer buffer, const Allocation &allocation, VkDeviceSize size);
+  // the view can be set later with SetImageView(), e.g. once the upload has been recorded
+  NODISCARD ImageHandle AddImage(
+      VkImage image, VkImageView view, const Allocation &allocation, VkExtent2D extent, VkFormat format);
+  NODISCARD SamplerHandle AddSampler(VkSampler sampler);
+  // the layout is only kept for lookups, it stays with whoever made it, usually the layout cache
+  NODISCARD PipelineHandle AddPipeline(VkPipeline pipeline, VkPipelineLayout layout, VkPipelineBindPoint bindPoint);
+
+  // the handle is stale as soon as this returns, the objects are destroyed once timeline reaches value
+  void Destroy(BufferHandle handle, Timeline *timeline, u64 value);
+  void Destroy(ImageHandle handle, Timeline *timeline, u64 value);
+  void Destroy(SamplerHandle handle, Timeline *timeline, u64 value);
+  void Destroy(PipelineHandle handle, Timeline *timeline, u64 value);
+
+  NODISCARD bool IsValid(BufferHandle handle) const { return mBuffers.IsValid(handle); }
+  NODISCARD bool IsValid(ImageHandle handle) const { return mImages.IsValid(handle); }
+  NODISCARD bool IsValid(SamplerHandle handle) const { return mSamplers.IsValid(handle); }
+  NODISCARD bool IsValid(PipelineHandle handle) const { return mPipelines.IsValid(handle); }
+
+  // lookups assert the handle is valid
+  NODISCARD VkBuffer GetBuffer(BufferHandle handle) const { return mBuffers.Get<0>(handle); }
+  NODISCARD const Allocation &GetAllocation(BufferHandle handle) const { return mBuffers.Get<1>(handle); }
+  NODISCARD VkDeviceSize GetSize(BufferHandle handle) const { return mBuffers.Get<2>(handle); }
+
+  NODISCARD VkImage GetImage(ImageHandle handle) const { return mImages.Get<0>(handle); }
+  NODISCARD VkImageView GetImageView(ImageHandle handle) const { return mImages.Get<1>(handle); }
+  NODISCARD const Allocation &GetAllocation(ImageHandle handle) const { return mImages.Get<2>(handle); }
+  NODISCARD VkExtent2D GetExtent(ImageHandle handle) const { return mImages.Get<3>(handle); }
+  NODISCARD VkFormat GetFormat(ImageHandle handle) const { return mImages.Get<4>(handle); }
+  // the registry takes over the view, any previous one must already be gone
+  void SetImageView(ImageHandle handle, VkImageView view) { mImages.Get<1>(handle) = view; }
+
+  NODISCARD VkSampler GetSampler(SamplerHandle handle) const { return mSamplers.Get<0>(handle); }
+
+  NODISCARD VkPipeline GetPipeline(PipelineHandle handle) const { return mPipelines.Get<0>(handle); }
+  NODISCARD VkPipelineLayout GetPipelineLayout(PipelineHandle handle) const { return mPipelines.Get<1>(handle); }
+  NODISCARD VkPipelineBindPoint GetBindPoint(PipelineHandle handle) const { return mPipelines.Get<2>(handle); }
+
+  void PrintStats() const;
+};
+
+} // namespace vk
@@ -0,0 +1,478 @@
+#include "vkShaderCompiler.hpp"
+
+#include "common.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fmt/core.h>
+#include <fstream>
+#include <functional>
+#include <shaderc/shaderc.hpp>
+#include <spirv-tools/libspirv.hpp>
+#include <spirv-tools/optimizer.hpp>
+#include <spirv_cross/spirv.hpp>
+#include <sstream>
+#include <unordered_map>
+
+namespace vk
+{
+
+static constexpr u32 sSpirvMagic = 0x07230203;
+
+// FNV-1a over every input that changes the output, each one length prefixed so neighbours can't run into each other
+struct ShaderKeyHasher {
+  u64 mHash = 0xcbf29ce484222325ull;
+
+  void Add(const void *data, Size size)
+  {
+    for (Size i = 0; i < size; i++) {
+      mHash = (mHash ^ ((const u8 *)data)[i]) * 0x100000001b3ull;
+    }
+  }
+  void Add(const std::string &text)
+  {
+    u64 size = text.size();
+    Add(&size, sizeof(size));
+    Add(text.data(), text.size());
+  }
+  void Add(u32 value) { Add(&value, sizeof(value)); }
+};
+
+static u32 CountInstructions(const std::vector<u32> &words)
+{
+  // the header is 5 words, every instruction after it starts with its word count in the high half
+  u32 count = 0;
+  for (u64 i = 5; i < words.size(); i += std::max(words[i] >> 16, 1u)) {
+    count++;
+  }
+  return count;
+}
+
+// Turns the listed spec constants into plain constants and drops their SpecId, the rest stay specializable. spirv-opt's
+// freeze pass can't be told which ones, it freezes them all. Only 32 bit and bool constants, false if it meets another.
+static bool FreezeSpecConstants(std::vector<u32> *words, const std::vector<SpecConstantValue> &constants)
+{
+  std::unordered_map<u32, u32> values;
+  for (const auto &constant : constants) {
+    values[constant.mId] = constant.mValue;
+  }
+  // result id of each frozen constant to its value
+  std::unordered_map<u32, u32> frozen;
+  auto &in = *words;
+  for (u64 i = 5; i < in.size(); i += std::max(in[i] >> 16, 1u)) {
+    if ((in[i] & 0xffff) == spv::OpDecorate && in[i + 2] == spv::DecorationSpecId) {
+      if (auto value = values.find(in[i + 3]); value != values.end()) {
+        frozen[in[i + 1]] = value->second;
+      }
+    }
+  }
+
+  std::vector<u32> out(in.begin(), in.begin() + 5);
+  for (u64 i = 5; i < in.size(); i += std::max(in[i] >> 16, 1u)) {
+    u32 count = in[i] >> 16;
+    u32 op = in[i] & 0xffff;
+    if (op == spv::OpDecorate && in[i + 2] == spv::DecorationSpecId && frozen.count(in[i + 1]) != 0) {
+      continue;
+    }
+    auto value = op == spv::OpSpecConstantTrue || op == spv::OpSpecConstantFalse || op == spv::OpSpecConstant
+                     ? frozen.find(in[i + 2])
+                     : frozen.end();
+    if (value == frozen.end()) {
+      out.insert(out.end(), in.begin() + (s64)i, in.begin() + (s64)(i + std::max(count, 1u)));
+    } else if (op == spv::OpSpecConstant) {
+      if (count != 4) {
+        return false;
+      }
+      out.insert(out.end(), {(count << 16) | spv::OpConstant, in[i + 1], in[i + 2], value->second});
+    } else {
+      out.insert(out.end(), {(3u << 16) | (value->second != 0 ? spv::OpConstantTrue : spv::OpConstantFalse), in[i + 1],
+                                in[i + 2]});
+    }
+  }
+  *words = std::move(out);
+  return true;
+}
+
+static shaderc_shader_kind ShaderKindFromPath(const std::string &path)
+{
+  static const std::pair<const char *, shaderc_shader_kind> kinds[] = {
+      {".vert", shaderc_vertex_shader},
+      {".frag", shaderc_fragment_shader},
+      {".comp", shaderc_compute_shader},
+      {".geom", shaderc_geometry_shader},
+      {".tesc", shaderc_tess_control_shader},
+      {".tese", shaderc_tess_evaluation_shader},
+  };
+  auto extension = fs::path(path).extension().string();
+  for (const auto &[name, kind] : kinds) {
+    if (extension == name) {
+      return kind;
+    }
+  }
+  // anything else has to say what it is with #pragma shader_stage(...)
+  return shaderc_glsl_infer_from_source;
+}
+
+static bool ReadText(const std::string &path, std::string *text)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    return false;
+  }
+  std::stringstream stream;
+  stream << file.rdbuf();
+  *text = stream.str();
+  return true;
+}
+
+// Serves includes out of the sources Gather() already read, so what's compiled is exactly what was hashed. shaderc
+// hands the names back as requestingPath for nested includes, they're the resolved paths.
+class GatheredIncluder : public shaderc::CompileOptions::IncluderInterface
+{
+  struct Result {
+    shaderc_include_result mResult;
+    std::string mName;
+    std::string mText;
+  };
+
+  std::unordered_map<std::string, const std::string *> mSources;
+  std::function<std::string(const std::string &, const std::string &, bool)> mResolve;
+
+public:
+  GatheredIncluder(const std::unordered_map<std::string, const std::string *> &sources,
+      std::function<std::string(const std::string &, const std::string &, bool)> resolve) :
+      mSources(sources), mResolve(std::move(resolve))
+  {
+  }
+
+  shaderc_include_result *GetInclude(const char *requestedSource, shaderc_include_type type,
+      const char *requestingSource, size_t) override
+  {
+    auto result = new Result;
+    result->mName = mResolve(requestingSource, requestedSource, type == shaderc_include_type_relative);
+    auto source = mSources.find(result->mName);
+    if (result->mName.empty() || source == mSources.end()) {
+      // an empty name tells shaderc the include failed, the content is the error message
+      result->mName.clear();
+      result->mText = fmt::format("can't find include {}", requestedSource);
+    } else {
+      result->mText = *source->second;
+    }
+    result->mResult = {
+        .source_name = result->mName.data(),
+        .source_name_length = result->mName.size(),
+        .content = result->mText.data(),
+        .content_length = result->mText.size(),
+        .user_data = result,
+    };
+    return &result->mResult;
+  }
+
+  void ReleaseInclude(shaderc_include_result *data) override { delete (Result *)data->user_data; }
+};
+
+ShaderCompiler::ShaderCompiler() = default;
+ShaderCompiler::~ShaderCompiler() = default;
+
+void ShaderCompiler::Init(JobSystem *jobs, const fs::path &shaderDir, const fs::path &cacheDir)
+{
+  mJobs = jobs;
+  mShaderDir = shaderDir;
+  mCacheDir = cacheDir;
+  mCompiler = std::make_unique<shaderc::Compiler>();
+  if (!mCompiler->IsValid()) {
+    fmt::print("failed to initialise the shader compiler\n");
+    assert(0);
+  }
+  std::error_code error;
+  fs::create_directories(mCacheDir, error);
+  if (error) {
+    fmt::print("shader cache: can't create {}, every shader will be compiled ({})\n", mCacheDir.string(),
+        error.message());
+  }
+}
+
+std::vector<char> ShaderCompiler::Compile(const ShaderRequest &request)
+{
+  auto sources = Gather((mShaderDir / request.mPath).lexically_normal().string());
+  if (sources.empty()) {
+    fmt::print("failed to read shader {}\n", request.mPath);
+    assert(0);
+    return {};
+  }
+  u64 key = HashKey(request, sources);
+  if (!request.mOptimize) {
+    return CompileSources(request, sources, key);
+  }
+  auto cookedPath = mCacheDir / fmt::format("{:016x}.opt.spv", HashCookKey(request, key));
+  if (auto cooked = LoadCached(cookedPath); !cooked.empty()) {
+    mCookHits++;
+    return cooked;
+  }
+
+  auto spirv = CompileSources(request, sources, key);
+  if (spirv.empty()) {
+    return spirv;
+  }
+  // a module that doesn't validate never reaches the driver, failed cooks aren't cached so the next run tries again
+  auto cooked = Cook(request, spirv);
+  if (cooked.empty()) {
+    return {};
+  }
+  StoreCached(cookedPath, cooked);
+  return cooked;
+}
+
+std::vector<char> ShaderCompiler::CompileSources(const ShaderRequest &request, const std::vector<Source> &sources,
+    u64 key)
+{
+  auto cachePath = mCacheDir / fmt::format("{:016x}.spv", key);
+  if (auto spirv = LoadCached(cachePath); !spirv.empty()) {
+    mCacheHits++;
+    return spirv;
+  }
+
+  auto start = std::chrono::high_resolution_clock::now();
+  std::unordered_map<std::string, const std::string *> gathered;
+  for (const auto &source : sources) {
+    gathered[source.mPath] = &source.mText;
+  }
+  shaderc::CompileOptions options;
+  options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_0);
+  options.SetSourceLanguage(shaderc_source_language_glsl);
+  options.SetIncluder(std::make_unique<GatheredIncluder>(
+      gathered, [this](const std::string &requesting, const std::string &name, bool relative) {
+        return ResolveInclude(requesting, name, relative);
+      }));
+  for (const auto &[name, value] : request.mDefines) {
+    options.AddMacroDefinition(name, value);
+  }
+
+  const auto &main = sources.front();
+  auto result = mCompiler->CompileGlslToSpv(main.mText, ShaderKindFromPath(main.mPath), main.mPath.c_str(),
+      request.mEntryPoint.c_str(), options);
+  if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+    fmt::print("failed to compile shader {}:\n{}", request.mPath, result.GetErrorMessage());
+    assert(0);
+    return {};
+  }
+  if (result.GetNumWarnings() > 0) {
+    fmt::print("{}", result.GetErrorMessage());
+  }
+  std::vector<char> spirv((const char *)result.cbegin(), (const char *)result.cend());
+  auto end = std::chrono::high_resolution_clock::now();
+  mCompileNs += (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  mCompiled++;
+
+  StoreCached(cachePath, spirv);
+  return spirv;
+}
+
+std::vector<char> ShaderCompiler::Cook(const ShaderRequest &request, const std::vector<char> &spirv)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  std::vector<u32> words(spirv.size() / sizeof(u32));
+  memcpy(words.data(), spirv.data(), words.size() * sizeof(u32));
+
+  std::string messages;
+  auto consumer = [&messages](spv_message_level_t level, const char *, const spv_position_t &position,
+                      const char *message) {
+    if (level <= SPV_MSG_WARNING) {
+      messages += fmt::format("  word {}: {}\n", position.index, message);
+    }
+  };
+  if (!FreezeSpecConstants(&words, request.mFrozenConstants)) {
+    fmt::print("failed to freeze the spec constants of shader {}, only 32 bit and bool ones can be\n", request.mPath);
+    assert(0);
+    mCookFailures++;
+    return {};
+  }
+  spvtools::Optimizer optimizer(SPV_ENV_VULKAN_1_0);
+  optimizer.SetMessageConsumer(consumer);
+  if (!request.mFrozenConstants.empty()) {
+    // the performance passes fold what freezing leaves behind
+    optimizer.RegisterPass(spvtools::CreateFoldSpecConstantOpAndCompositePass());
+  }
+  optimizer.RegisterPerformancePasses();
+  optimizer.RegisterPass(spvtools::CreateStripDebugInfoPass());
+  optimizer.RegisterPass(spvtools::CreateCompactIdsPass());
+
+  // validates the input before running any pass
+  spvtools::OptimizerOptions options;
+  options.set_run_validator(true);
+  options.set_preserve_bindings(true);
+  std::vector<u32> optimized;
+  bool valid = optimizer.Run(words.data(), words.size(), &optimized, options);
+  if (valid) {
+    spvtools::SpirvTools tools(SPV_ENV_VULKAN_1_0);
+    tools.SetMessageConsumer(consumer);
+    valid = tools.Validate(optimized);
+  }
+  if (!valid) {
+    fmt::print("failed to optimize shader {}:\n{}", request.mPath, messages);
+    assert(0);
+    mCookFailures++;
+    return {};
+  }
+
+  u32 before = CountInstructions(words);
+  u32 after = CountInstructions(optimized);
+  fmt::print("cooked {}: {} -> {} instructions, {} frozen constants\n", request.mPath, before, after,
+      request.mFrozenConstants.size());
+  auto end = std::chrono::high_resolution_clock::now();
+  mCookNs += (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  mInstructionsBefore += before;
+  mInstructionsAfter += after;
+  mCooked++;
+  return std::vector<char>((const char *)optimized.data(), (const char *)(optimized.data() + optimized.size()));
+}
+
+void ShaderCompiler::CompileAsync(const ShaderRequest &request, std::vector<char> *spirv, JobCounter *counter)
+{
+  mJobs->Run([this, request, spirv] { *spirv = Compile(request); }, counter);
+}
+
+std::vector<ShaderCompiler::Source> ShaderCompiler::Gather(const std::string &path) const
+{
+  std::vector<Source> sources(1);
+  sources[0].mPath = path;
+  if (!ReadText(path, &sources[0].mText)) {
+    return {};
+  }
+  // breadth first, each file once however many times it's included
+  for (u64 next = 0; next < sources.size(); next++) {
+    std::istringstream lines(sources[next].mText);
+    for (std::string line; std::getline(lines, line);) {
+      u64 pos = line.find_first_not_of(" \t");
+      if (pos == std::string::npos || line[pos] != '#') {
+        continue;
+      }
+      pos = line.find_first_not_of(" \t", pos + 1);
+      if (pos == std::string::npos || line.compare(pos, 7, "include") != 0) {
+        continue;
+      }
+      pos = line.find_first_of("\"<", pos + 7);
+      if (pos == std::string::npos) {
+        continue;
+      }
+      bool relative = line[pos] == '"';
+      u64 close = line.find(relative ? '"' : '>', pos + 1);
+      if (close == std::string::npos) {
+        continue;
+      }
+      auto resolved = ResolveInclude(sources[next].mPath, line.substr(pos + 1, close - pos - 1), relative);
+      bool seen = resolved.empty();
+      for (const auto &source : sources) {
+        seen = seen || source.mPath == resolved;
+      }
+      if (!seen) {
+        Source include = {.mPath = resolved};
+        ReadText(resolved, &include.mText);
+        sources.push_back(std::move(include));
+      }
+    }
+  }
+  return sources;
+}
+
+std::string ShaderCompiler::ResolveInclude(const std::string &requestingPath, const std::string &name,
+    bool relative) const
+{
+  std::error_code error;
+  if (relative) {
+    auto path = (fs::path(requestingPath).parent_path() / name).lexically_normal();
+    if (fs::is_regular_file(path, error)) {
+      return path.string();
+    }
+  }
+  auto path = (mShaderDir / name).lexically_normal();
+  return fs::is_regular_file(path, error) ? path.string() : std::string();
+}
+
+u64 ShaderCompiler::HashKey(const ShaderRequest &request, const std::vector<Source> &sources) const
+{
+  ShaderKeyHasher hasher;
+  hasher.Add(sCacheVersion);
+  hasher.Add((u32)ShaderKindFromPath(sources.front().mPath));
+  hasher.Add(request.mEntryPoint);
+  hasher.Add((u32)request.mDefines.size());
+  for (const auto &[name, value] : request.mDefines) {
+    hasher.Add(name);
+    hasher.Add(value);
+  }
+  // the main source goes in by content alone, includes by the name they're found under too since that's what
+  // decides which of them an #include picks
+  hasher.Add(sources.front().mText);
+  for (u64 i = 1; i < sources.size(); i++) {
+    hasher.Add(fs::path(sources[i].mPath).lexically_relative(mShaderDir).string());
+    hasher.Add(sources[i].mText);
+  }
+  return hasher.mHash;
+}
+
+u64 ShaderCompiler::HashCookKey(const ShaderRequest &request, u64 compiledKey) const
+{
+  ShaderKeyHasher hasher;
+  hasher.Add(&compiledKey, sizeof(compiledKey));
+  hasher.Add(sCookVersion);
+  hasher.Add((u32)request.mFrozenConstants.size());
+  for (const auto &constant : request.mFrozenConstants) {
+    hasher.Add(constant.mId);
+    hasher.Add(constant.mValue);
+  }
+  return hasher.mHash;
+}
+
+std::vector<char> ShaderCompiler::LoadCached(const fs::path &path) const
+{
+  std::ifstream file(path, std::ios::ate | std::ios::binary);
+  if (!file.is_open()) {
+    return {};
+  }
+  std::vector<char> spirv((u64)file.tellg());
+  file.seekg(0);
+  file.read(spirv.data(), (std::streamsize)spirv.size());
+  // a torn or foreign file is just a miss, the compile overwrites it
+  u32 magic = 0;
+  if (!file || spirv.size() < 20 || spirv.size() % 4 != 0) {
+    return {};
+  }
+  memcpy(&magic, spirv.data(), sizeof(magic));
+  return magic == sSpirvMagic ? spirv : std::vector<char>();
+}
+
+void ShaderCompiler::StoreCached(const fs::path &path, const std::vector<char> &spirv)
+{
+  // written to the side and renamed over, two threads compiling the same key each get a temp file of their own
+  auto tmpPath = path;
+  tmpPath += fmt::format(".{}.tmp", mTempFiles++);
+  {
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+      return;
+    }
+    file.write(spirv.data(), (std::streamsize)spirv.size());
+    if (!file) {
+      file.close();
+      std::error_code error;
+      fs::remove(tmpPath, error);
+      return;
+    }
+  }
+  std::error_code error;
+  fs::rename(tmpPath, path, error);
+  if (error) {
+    fs::remove(tmpPath, error);
+  }
+}
+
+void ShaderCompiler::PrintStats() const
+{
+  fmt::print("shader compiler: {} compiled in {:.3f} ms, {} from the cache\n", mCompiled.load(),
+      (f64)mCompileNs.load() / 1e6, mCacheHits.load());
+  fmt::print("shader compiler: {} cooked in {:.3f} ms ({} -> {} instructions), {} from the cache, {} failed\n",
+      mCooked.load(), (f64)mCookNs.load() / 1e6, mInstructionsBefore.load(), mInstructionsAfter.load(),
+      mCookHits.load(), mCookFailures.load());
+}
+
+} // namespace vk
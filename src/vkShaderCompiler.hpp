@@ -0,0 +1,113 @@
+#pragma once
+#include "JobSystem.hpp"
+#include "common.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace shaderc
+{
+class Compiler;
+}
+
+namespace vk
+{
+
+struct SpecConstantValue {
+  u32 mId;
+  // the bit pattern, a bool is true when it's not zero
+  u32 mValue;
+};
+
+struct ShaderRequest {
+  // relative to the shader directory, the stage comes from the extension (.vert, .frag, .comp, ...)
+  std::string mPath;
+  // name, value pairs, an empty value defines the name as nothing
+  std::vector<std::pair<std::string, std::string>> mDefines;
+  std::string mEntryPoint = "main";
+  // Baked into the module when it's cooked, so the optimizer can fold them and drop the branches they turn off. They
+  // can't be specialized afterwards, spec constants that aren't listed still can.
+  std::vector<SpecConstantValue> mFrozenConstants;
+  // off hands back the SPIR-V as shaderc wrote it, debug info and all
+  bool mOptimize = true;
+};
+
+// Compiles GLSL to SPIR-V at runtime with shaderc, with #include "..." resolved next to the including file and
+// #include <...> from the shader directory.
+//
+// Results are cached on disk under a hash of the source, the contents of everything it includes, the defines and the
+// compiler options, so a warm start reads the SPIR-V back without touching the compiler and an edit to any of the
+// inputs can't be served a stale binary. Includes are found by scanning the source before compiling, an include
+// inside an #if that's off still counts towards the key, which only costs a recompile nobody needed.
+//
+// Compiled modules are then cooked with spirv-opt: frozen spec constants, the performance passes (inlining, dead code
+// elimination, constant folding and the rest) and debug info stripped. Bindings are kept even when nothing reads
+// them, so every variant of a shader fits the same layout. The input is validated before the passes and the output
+// after, and a module that fails is an error, it never reaches the driver. Cooked modules are cached next to the
+// compiled ones under a key of their own, made from the compiled key, the pass list version and the frozen constants.
+//
+// Compile() is safe to call from several threads at once, shaderc's compiler is and every compile and cook has
+// options of its own. CompileAsync() fans compiles out over a job system.
+class ShaderCompiler
+{
+  // bump whenever the options or the key layout change
+  static constexpr u32 sCacheVersion = 1;
+  // bump whenever the passes change
+  static constexpr u32 sCookVersion = 2;
+
+  fs::path mShaderDir;
+  fs::path mCacheDir;
+  JobSystem *mJobs = nullptr;
+  std::unique_ptr<shaderc::Compiler> mCompiler;
+
+  std::atomic<u32> mCompiled{0};
+  std::atomic<u32> mCacheHits{0};
+  std::atomic<u64> mCompileNs{0};
+  std::atomic<u32> mCooked{0};
+  std::atomic<u32> mCookHits{0};
+  std::atomic<u32> mCookFailures{0};
+  std::atomic<u64> mCookNs{0};
+  std::atomic<u64> mInstructionsBefore{0};
+  std::atomic<u64> mInstructionsAfter{0};
+  std::atomic<u32> mTempFiles{0};
+
+public:
+  ShaderCompiler();
+  ~ShaderCompiler();
+
+  // the cache directory is created if it isn't there
+  void Init(JobSystem *jobs, const fs::path &shaderDir, const fs::path &cacheDir);
+
+  // cooked SPIR-V for the request, from the cache if it's there, empty if the shader failed to compile or cook
+  NODISCARD std::vector<char> Compile(const ShaderRequest &request);
+  // queues Compile() on the job system, spirv is written once counter reaches zero
+  void CompileAsync(const ShaderRequest &request, std::vector<char> *spirv, JobCounter *counter);
+
+  void PrintStats() const;
+
+private:
+  struct Source {
+    // resolved path, also the name shaderc reports errors against
+    std::string mPath;
+    std::string mText;
+  };
+
+  // the source and everything it includes, the source first, empty if the source couldn't be read
+  NODISCARD std::vector<Source> Gather(const std::string &path) const;
+  NODISCARD std::string ResolveInclude(const std::string &requestingPath, const std::string &name, bool relative) const;
+  NODISCARD u64 HashKey(const ShaderRequest &request, const std::vector<Source> &sources) const;
+  NODISCARD u64 HashCookKey(const ShaderRequest &request, u64 compiledKey) const;
+
+  // the request as shaderc compiles it, cached under key
+  NODISCARD std::vector<char> CompileSources(const ShaderRequest &request, const std::vector<Source> &sources, u64 key);
+  // empty if the optimizer failed or its output didn't validate
+  NODISCARD std::vector<char> Cook(const ShaderRequest &request, const std::vector<char> &spirv);
+
+  NODISCARD std::vector<char> LoadCached(const fs::path &path) const;
+  void StoreCached(const fs::path &path, const std::vector<char> &spirv);
+};
+
+} // namespace vk
@@ -0,0 +1,156 @@
+#include "vkShaderVariants.hpp"
+
+#include "common.h"
+
+#include <chrono>
+#include <fmt/core.h>
+
+namespace vk
+{
+
+VkSpecializationInfo ShaderVariant::GetSpecializationInfo() const
+{
+  return {
+      .mapEntryCount = (u32)mSpecEntries.size(),
+      .pMapEntries = mSpecEntries.data(),
+      .dataSize = mSpecData.size() * sizeof(VkBool32),
+      .pData = mSpecData.data(),
+  };
+}
+
+void ShaderVariants::Init(const char *name, ShaderCompiler *compiler, JobSystem *jobs,
+    std::vector<std::pair<VkShaderStageFlagBits, std::string>> stages, std::vector<ShaderFeature> features)
+{
+  if (features.size() > 64) {
+    fmt::print("shader variants {}: {} features don't fit in a 64 bit key\n", name, features.size());
+    assert(0);
+  }
+  mName = name;
+  mCompiler = compiler;
+  mJobs = jobs;
+  mFeatures = std::move(features);
+  for (auto &[stage, path] : stages) {
+    VariantKey defineMask = 0;
+    for (u32 i = 0; i < mFeatures.size(); i++) {
+      if (mFeatures[i].mKind == FeatureKind::Define && (mFeatures[i].mStages & stage) != 0) {
+        defineMask |= 1ull << i;
+      }
+    }
+    mStages.push_back({.mStage = stage, .mPath = std::move(path), .mDefineMask = defineMask});
+  }
+}
+
+VariantKey ShaderVariants::MakeKey(const std::vector<std::string> &names) const
+{
+  VariantKey key = 0;
+  for (const auto &name : names) {
+    u32 i = 0;
+    while (i < mFeatures.size() && mFeatures[i].mName != name) {
+      i++;
+    }
+    if (i == mFeatures.size()) {
+      fmt::print("shader variants {}: no feature called {}\n", mName, name);
+      assert(0);
+      continue;
+    }
+    key |= 1ull << i;
+  }
+  return key;
+}
+
+std::string ShaderVariants::Describe(VariantKey key) const
+{
+  std::string description;
+  for (u32 i = 0; i < mFeatures.size(); i++) {
+    if (key & (1ull << i)) {
+      description += (description.empty() ? "" : "|") + mFeatures[i].mName;
+    }
+  }
+  return description.empty() ? "base" : description;
+}
+
+const ShaderVariant *ShaderVariants::Get(VariantKey key)
+{
+  {
+    std::lock_guard lock(mMutex);
+    if (auto found = mVariants.find(key); found != mVariants.end()) {
+      return &found->second;
+    }
+  }
+  if (mFeatures.size() < 64 && key >> mFeatures.size() != 0) {
+    fmt::print("shader variants {}: key {:#x} has bits past the last feature\n", mName, key);
+    assert(0);
+  }
+
+  // the modules are looked up and compiled outside the lock so one slow compile doesn't hold up other variants
+  auto start = std::chrono::high_resolution_clock::now();
+  ShaderVariant variant = {.mKey = key};
+  variant.mSpirv.resize(mStages.size());
+  std::vector<std::vector<char>> compiled(mStages.size());
+  JobCounter counter;
+  for (u32 i = 0; i < mStages.size(); i++) {
+    {
+      std::lock_guard lock(mMutex);
+      auto module = mStages[i].mModules.find(key & mStages[i].mDefineMask);
+      if (module != mStages[i].mModules.end()) {
+        variant.mSpirv[i] = module->second;
+        continue;
+      }
+    }
+    ShaderRequest request = {.mPath = mStages[i].mPath};
+    for (u32 feature = 0; feature < mFeatures.size(); feature++) {
+      if (key & mStages[i].mDefineMask & (1ull << feature)) {
+        request.mDefines.push_back({mFeatures[feature].mName, "1"});
+      }
+    }
+    mCompiler->CompileAsync(request, &compiled[i], &counter);
+  }
+  mJobs->Wait(&counter);
+  for (u32 i = 0; i < mStages.size(); i++) {
+    // nothing is cached for a failed variant, the next Get() tries again
+    if (variant.mSpirv[i] == nullptr && compiled[i].empty()) {
+      fmt::print("shader variants {}: {} failed to compile {}\n", mName, Describe(key), mStages[i].mPath);
+      return nullptr;
+    }
+  }
+
+  for (u32 i = 0; i < mFeatures.size(); i++) {
+    if (mFeatures[i].mKind == FeatureKind::Specialization) {
+      variant.mSpecEntries.push_back({
+          .constantID = mFeatures[i].mSpecId,
+          .offset = (u32)(variant.mSpecData.size() * sizeof(VkBool32)),
+          .size = sizeof(VkBool32),
+      });
+      variant.mSpecData.push_back((key & (1ull << i)) ? VK_TRUE : VK_FALSE);
+    }
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+
+  std::lock_guard lock(mMutex);
+  for (u32 i = 0; i < mStages.size(); i++) {
+    if (variant.mSpirv[i] == nullptr) {
+      // whoever got here first wins, the copies are identical
+      auto &module = mStages[i].mModules[key & mStages[i].mDefineMask];
+      if (module == nullptr) {
+        module = std::make_shared<const std::vector<char>>(std::move(compiled[i]));
+        mModulesCompiled++;
+      }
+      variant.mSpirv[i] = module;
+    }
+  }
+  mCompileNs += (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  return &mVariants.try_emplace(key, std::move(variant)).first->second;
+}
+
+void ShaderVariants::PrintStats() const
+{
+  std::lock_guard lock(mMutex);
+  std::string variants;
+  for (const auto &[key, variant] : mVariants) {
+    variants += (variants.empty() ? "" : ", ") + Describe(key);
+  }
+  fmt::print("shader variants {}: {} variants ({}) from {} modules, {:.3f} ms building them\n", mName,
+      mVariants.size(), variants, mModulesCompiled, (f64)mCompileNs / 1e6);
+}
+
+} // namespace vk
@@ -0,0 +1,102 @@
+#pragma once
+#include "JobSystem.hpp"
+#include "common.h"
+#include "vkShaderCompiler.hpp"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace vk
+{
+
+// bit i is feature i of the set it came from
+using VariantKey = u64;
+
+enum class FeatureKind {
+  // a bool spec constant, every variant shares the SPIR-V and the driver specializes it at pipeline creation
+  Specialization,
+  // a #define, the module is compiled once per value so the optimizer can throw away what it turns off
+  Define,
+};
+
+struct ShaderFeature {
+  // the #define for Define features, only a name for MakeKey() and reports for Specialization ones
+  std::string mName;
+  FeatureKind mKind;
+  // constant_id of the bool, Specialization only
+  u32 mSpecId = 0;
+  // stages that look at it, a Define feature only splits the modules of these stages
+  VkShaderStageFlags mStages = VK_SHADER_STAGE_ALL;
+};
+
+struct ShaderVariant {
+  VariantKey mKey = 0;
+  // one per stage in the order they were declared, shared with every variant differing only in spec constants
+  std::vector<std::shared_ptr<const std::vector<char>>> mSpirv;
+  // every Specialization feature, on or off, so nothing is left to the shader's default
+  std::vector<VkSpecializationMapEntry> mSpecEntries;
+  std::vector<VkBool32> mSpecData;
+
+  // points into the variant, which must outlive the pipeline create call
+  NODISCARD VkSpecializationInfo GetSpecializationInfo() const;
+};
+
+// The permutations of a set of stages, e.g. a vertex and fragment shader pair, over the features they declare.
+// Variants are looked up by a key with a bit per feature and built the first time they're asked for, so a variant
+// nobody draws with is never compiled. Modules are shared between variants whose Define features match over the
+// stage, a Specialization feature never costs a compile.
+//
+// Get() is safe to call from several threads, two threads asking for the same new variant may both compile it, the
+// shader compiler's cache keeps the second one cheap.
+class ShaderVariants
+{
+  struct Stage {
+    VkShaderStageFlagBits mStage;
+    std::string mPath;
+    // the Define features that split this stage's modules
+    VariantKey mDefineMask = 0;
+    // keyed by the variant key masked by mDefineMask
+    std::unordered_map<VariantKey, std::shared_ptr<const std::vector<char>>> mModules;
+  };
+
+  std::string mName;
+  ShaderCompiler *mCompiler = nullptr;
+  JobSystem *mJobs = nullptr;
+  std::vector<Stage> mStages;
+  std::vector<ShaderFeature> mFeatures;
+
+  mutable std::mutex mMutex;
+  // node based, so references handed out by Get() survive later inserts
+  std::unordered_map<VariantKey, ShaderVariant> mVariants;
+
+  u32 mModulesCompiled = 0;
+  u64 mCompileNs = 0;
+
+public:
+  ShaderVariants() = default;
+  ShaderVariants(const ShaderVariants &) = delete;
+  ShaderVariants &operator=(const ShaderVariants &) = delete;
+
+  // at most 64 features, the name is only for reports
+  void Init(const char *name, ShaderCompiler *compiler, JobSystem *jobs,
+      std::vector<std::pair<VkShaderStageFlagBits, std::string>> stages, std::vector<ShaderFeature> features);
+
+  // asserts every name is a declared feature
+  NODISCARD VariantKey MakeKey(const std::vector<std::string> &names) const;
+  // the feature names in key joined with '|', "base" for none
+  NODISCARD std::string Describe(VariantKey key) const;
+
+  // compiles whatever modules the variant is missing, stages in parallel, null if any of them failed to compile
+  NODISCARD const ShaderVariant *Get(VariantKey key);
+  NODISCARD VkShaderStageFlagBits GetStage(u32 index) const { return mStages[index].mStage; }
+  NODISCARD u32 GetStageCount() const { return (u32)mStages.size(); }
+
+  void PrintStats() const;
+};
+
+} // namespace vk
@@ -0,0 +1,152 @@
+#include "vkSync.hpp"
+
+#include "common.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <fmt/core.h>
+
+namespace vk
+{
+
+// command buffers are recorded on several threads, the counters have to be atomic
+static std::atomic<u64> sSyncBarriers = 0;
+static std::atomic<u64> sSyncBarrierCalls = 0;
+static std::atomic<u64> sSyncSubmissions = 0;
+static std::atomic<u64> sSyncSubmitInfos = 0;
+static std::atomic<u64> sSyncQueueSubmits = 0;
+
+SyncStats GetSyncStats()
+{
+  return {
+      .mBarriers = sSyncBarriers.load(),
+      .mBarrierCalls = sSyncBarrierCalls.load(),
+      .mSubmissions = sSyncSubmissions.load(),
+      .mSubmitInfos = sSyncSubmitInfos.load(),
+      .mQueueSubmits = sSyncQueueSubmits.load(),
+  };
+}
+
+void BarrierBatch::Memory(
+    VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages, VkAccessFlags srcAccess, VkAccessFlags dstAccess)
+{
+  mSrcStages |= srcStages;
+  mDstStages |= dstStages;
+  mMemoryBarriers.push_back({
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = srcAccess,
+      .dstAccessMask = dstAccess,
+  });
+}
+
+void BarrierBatch::Buffer(
+    VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages, const VkBufferMemoryBarrier &barrier)
+{
+  mSrcStages |= srcStages;
+  mDstStages |= dstStages;
+  mBufferBarriers.push_back(barrier);
+}
+
+void BarrierBatch::Image(
+    VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages, const VkImageMemoryBarrier &barrier)
+{
+  mSrcStages |= srcStages;
+  mDstStages |= dstStages;
+  mImageBarriers.push_back(barrier);
+}
+
+void BarrierBatch::Record(VkCommandBuffer commandBuffer) const
+{
+  if (IsEmpty()) {
+    return;
+  }
+  vkCmdPipelineBarrier(commandBuffer, mSrcStages, mDstStages, 0, (u32)mMemoryBarriers.size(),
+      mMemoryBarriers.data(), (u32)mBufferBarriers.size(), mBufferBarriers.data(), (u32)mImageBarriers.size(),
+      mImageBarriers.data());
+  sSyncBarriers += GetCount();
+  sSyncBarrierCalls++;
+}
+
+void BarrierBatch::Flush(VkCommandBuffer commandBuffer)
+{
+  Record(commandBuffer);
+  Clear();
+}
+
+void BarrierBatch::Clear()
+{
+  mSrcStages = 0;
+  mDstStages = 0;
+  mMemoryBarriers.clear();
+  mBufferBarriers.clear();
+  mImageBarriers.clear();
+}
+
+void SubmitBatch::Add(Submission submission)
+{
+  assert(submission.mWaitSemaphores.size() == submission.mWaitValues.size()
+         && submission.mWaitSemaphores.size() == submission.mWaitStages.size());
+  assert(submission.mSignalSemaphores.size() == submission.mSignalValues.size());
+  sSyncSubmissions++;
+
+  // Nothing to wait for, so running it straight after the previous submission's command buffers changes nothing.
+  // The previous one's signals move to the end of the merged batch, which only ever delays them.
+  if (mPending.empty() || !submission.mWaitSemaphores.empty()) {
+    mPending.push_back(std::move(submission));
+    return;
+  }
+  auto &previous = mPending.back();
+  previous.mCommandBuffers.insert(
+      previous.mCommandBuffers.end(), submission.mCommandBuffers.begin(), submission.mCommandBuffers.end());
+  for (u32 i = 0; i < submission.mSignalSemaphores.size(); i++) {
+    auto semaphore = submission.mSignalSemaphores[i];
+    auto it = std::find(previous.mSignalSemaphores.begin(), previous.mSignalSemaphores.end(), semaphore);
+    if (it == previous.mSignalSemaphores.end()) {
+      previous.mSignalSemaphores.push_back(semaphore);
+      previous.mSignalValues.push_back(submission.mSignalValues[i]);
+    } else {
+      auto &value = previous.mSignalValues[it - previous.mSignalSemaphores.begin()];
+      value = std::max(value, submission.mSignalValues[i]);
+    }
+  }
+}
+
+void SubmitBatch::Flush()
+{
+  if (mPending.empty()) {
+    return;
+  }
+  std::vector<VkTimelineSemaphoreSubmitInfo> timelineInfos(mPending.size());
+  std::vector<VkSubmitInfo> submitInfos(mPending.size());
+  for (u32 i = 0; i < mPending.size(); i++) {
+    const auto &submission = mPending[i];
+    timelineInfos[i] = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount = (u32)submission.mWaitValues.size(),
+        .pWaitSemaphoreValues = submission.mWaitValues.data(),
+        .signalSemaphoreValueCount = (u32)submission.mSignalValues.size(),
+        .pSignalSemaphoreValues = submission.mSignalValues.data(),
+    };
+    submitInfos[i] = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timelineInfos[i],
+        .waitSemaphoreCount = (u32)submission.mWaitSemaphores.size(),
+        .pWaitSemaphores = submission.mWaitSemaphores.data(),
+        .pWaitDstStageMask = submission.mWaitStages.data(),
+        .commandBufferCount = (u32)submission.mCommandBuffers.size(),
+        .pCommandBuffers = submission.mCommandBuffers.data(),
+        .signalSemaphoreCount = (u32)submission.mSignalSemaphores.size(),
+        .pSignalSemaphores = submission.mSignalSemaphores.data(),
+    };
+  }
+  if (vkQueueSubmit(mQueue, (u32)submitInfos.size(), submitInfos.data(), VK_NULL_HANDLE) != VK_SUCCESS) {
+    fmt::print("failed to submit batch\n");
+    assert(0);
+  }
+  sSyncSubmitInfos += submitInfos.size();
+  sSyncQueueSubmits++;
+  mPending.clear();
+}
+
+} // namespace vk
@@ -0,0 +1,81 @@
+#pragma once
+#include "common.h"
+
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace vk
+{
+
+// Process wide counters, every BarrierBatch and SubmitBatch adds to them
+struct SyncStats {
+  u64 mBarriers = 0;
+  u64 mBarrierCalls = 0;
+  // submissions handed to a SubmitBatch, the VkSubmitInfos they turned into and the vkQueueSubmit calls carrying them
+  u64 mSubmissions = 0;
+  u64 mSubmitInfos = 0;
+  u64 mQueueSubmits = 0;
+};
+NODISCARD SyncStats GetSyncStats();
+
+// Collects memory, buffer and image barriers and records them with a single vkCmdPipelineBarrier. The stage masks of
+// everything added are merged, so only batch barriers that would be recorded back to back anyway, a batch never
+// waits on more than the sum of its barriers would have.
+class BarrierBatch
+{
+  VkPipelineStageFlags mSrcStages = 0;
+  VkPipelineStageFlags mDstStages = 0;
+  std::vector<VkMemoryBarrier> mMemoryBarriers;
+  std::vector<VkBufferMemoryBarrier> mBufferBarriers;
+  std::vector<VkImageMemoryBarrier> mImageBarriers;
+
+public:
+  void Memory(VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages, VkAccessFlags srcAccess,
+      VkAccessFlags dstAccess);
+  void Buffer(VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages, const VkBufferMemoryBarrier &barrier);
+  void Image(VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages, const VkImageMemoryBarrier &barrier);
+
+  NODISCARD bool IsEmpty() const { return GetCount() == 0; }
+  NODISCARD u32 GetCount() const
+  {
+    return (u32)(mMemoryBarriers.size() + mBufferBarriers.size() + mImageBarriers.size());
+  }
+
+  // records the batch and keeps it, for batches built once and replayed
+  void Record(VkCommandBuffer commandBuffer) const;
+  // records the batch and empties it
+  void Flush(VkCommandBuffer commandBuffer);
+  void Clear();
+};
+
+// one vkQueueSubmit worth of work, binary semaphores take a value of 0
+struct Submission {
+  std::vector<VkSemaphore> mWaitSemaphores;
+  std::vector<u64> mWaitValues;
+  std::vector<VkPipelineStageFlags> mWaitStages;
+  std::vector<VkCommandBuffer> mCommandBuffers;
+  std::vector<VkSemaphore> mSignalSemaphores;
+  std::vector<u64> mSignalValues;
+};
+
+// Queues submissions to one queue and hands them over in one vkQueueSubmit. A submission that doesn't wait on
+// anything is folded into the one before it, and a timeline signalled by both only keeps the higher value since
+// reaching it implies the lower one. Anything waiting on a value has to make sure the submission signalling it has
+// been flushed.
+class SubmitBatch
+{
+  VkQueue mQueue = VK_NULL_HANDLE;
+  std::vector<Submission> mPending;
+
+public:
+  SubmitBatch() = default;
+  explicit SubmitBatch(VkQueue queue) : mQueue(queue) {}
+
+  NODISCARD bool IsValid() const { return mQueue != VK_NULL_HANDLE; }
+  NODISCARD bool IsEmpty() const { return mPending.empty(); }
+
+  void Add(Submission submission);
+  void Flush();
+};
+
+} // namespace vk
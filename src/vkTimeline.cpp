@@ -0,0 +1,68 @@
+#include "vkTimeline.hpp"
+
+#include "common.h"
+
+#include <algorithm>
+#include <cassert>
+#include <fmt/core.h>
+
+namespace vk
+{
+
+Timeline::Timeline(VkDevice device) : mDevice(device)
+{
+  VkSemaphoreTypeCreateInfo typeInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+      .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+      .initialValue = 0,
+  };
+  VkSemaphoreCreateInfo semaphoreInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+      .pNext = &typeInfo,
+  };
+  if (vkCreateSemaphore(mDevice, &semaphoreInfo, nullptr, &mSemaphore) != VK_SUCCESS) {
+    fmt::print("failed to create timeline semaphore\n");
+    assert(0);
+  }
+}
+
+void Timeline::Destroy()
+{
+  vkDestroySemaphore(mDevice, mSemaphore, nullptr);
+  mSemaphore = VK_NULL_HANDLE;
+}
+
+u64 Timeline::GetCompleted()
+{
+  u64 value = 0;
+  if (vkGetSemaphoreCounterValue(mDevice, mSemaphore, &value) == VK_SUCCESS) {
+    mCompleted = std::max(mCompleted, value);
+  }
+  return mCompleted;
+}
+
+bool Timeline::IsComplete(u64 value)
+{
+  return value <= mCompleted || value <= GetCompleted();
+}
+
+void Timeline::Wait(u64 value)
+{
+  assert(value <= mSignaled && "waiting on a value nothing will signal");
+  if (value <= mCompleted) {
+    return;
+  }
+  VkSemaphoreWaitInfo waitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+      .semaphoreCount = 1,
+      .pSemaphores = &mSemaphore,
+      .pValues = &value,
+  };
+  if (vkWaitSemaphores(mDevice, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+    fmt::print("failed to wait on timeline semaphore\n");
+    assert(0);
+  }
+  mCompleted = std::max(mCompleted, value);
+}
+
+} // namespace vk
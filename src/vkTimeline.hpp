@@ -0,0 +1,46 @@
+#pragma once
+#include "common.h"
+
+#include <vulkan/vulkan.h>
+
+namespace vk
+{
+
+// A timeline semaphore paired with the queue that signals it. Every submission to the queue signals the next value,
+// so "has the GPU got past submission X" is a single comparison against the counter, and CPU waits and cross queue
+// waits are both expressed as values instead of a fence or binary semaphore per submission.
+//
+// Values are handed out in submission order and a submission must signal the value it reserved, the semaphore
+// requires them to strictly increase.
+class Timeline
+{
+  VkDevice mDevice = VK_NULL_HANDLE;
+  VkSemaphore mSemaphore = VK_NULL_HANDLE;
+  // last value handed out to a submission
+  u64 mSignaled = 0;
+  // last value read back from the GPU, only ever behind the real one
+  u64 mCompleted = 0;
+
+public:
+  Timeline() = default;
+  explicit Timeline(VkDevice device);
+
+  // the GPU must be done with every submission that signals it
+  void Destroy();
+
+  NODISCARD VkSemaphore Get() const { return mSemaphore; }
+  NODISCARD bool IsValid() const { return mSemaphore != VK_NULL_HANDLE; }
+
+  // reserves the value the next submission to the queue signals
+  NODISCARD u64 Next() { return ++mSignaled; }
+  // value of the most recent submission, waiting on it covers everything submitted so far
+  NODISCARD u64 GetLastSignaled() const { return mSignaled; }
+
+  // queries the semaphore, everything at or below the result has completed
+  NODISCARD u64 GetCompleted();
+  // only queries the semaphore if the cached value isn't enough
+  NODISCARD bool IsComplete(u64 value);
+  void Wait(u64 value);
+};
+
+} // namespace vk
@@ -0,0 +1,71 @@
+#include "vkUniformRing.hpp"
+
+#include "common.h"
+
+#include <cassert>
+#include <fmt/core.h>
+
+namespace vk
+{
+
+static VkDeviceSize AlignUniform(VkDeviceSize value, VkDeviceSize alignment)
+{
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+UniformRing::UniformRing(VkPhysicalDevice physicalDevice, VkDevice device, Allocator *allocator,
+    VkDeviceSize frameSize, u32 frameCount) :
+    mDevice(device), mAllocator(allocator), mFrameCount(frameCount)
+{
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  mAlignment = properties.limits.minUniformBufferOffsetAlignment;
+  // every partition has to start on a valid dynamic offset
+  mFrameSize = AlignUniform(frameSize, mAlignment);
+
+  VkBufferCreateInfo bufferInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .size = mFrameSize * mFrameCount,
+      .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+  };
+  if (vkCreateBuffer(mDevice, &bufferInfo, nullptr, &mBuffer) != VK_SUCCESS) {
+    fmt::print("failed to create uniform ring buffer\n");
+    assert(0);
+  }
+
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(mDevice, mBuffer, &requirements);
+  mAllocation = mAllocator->Allocate(requirements,
+      mAllocator->FindMemoryType(requirements.memoryTypeBits,
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+      true);
+  vkBindBufferMemory(mDevice, mBuffer, mAllocation.mMemory, mAllocation.mOffset);
+}
+
+void UniformRing::Destroy()
+{
+  vkDestroyBuffer(mDevice, mBuffer, nullptr);
+  mAllocator->Free(mAllocation);
+  mBuffer = VK_NULL_HANDLE;
+  mAllocation = {};
+}
+
+void UniformRing::BeginFrame(u32 frame)
+{
+  assert(frame < mFrameCount);
+  mFrame = frame;
+  mHead = 0;
+}
+
+UniformRing::Slice UniformRing::Allocate(VkDeviceSize size)
+{
+  VkDeviceSize offset = mHead;
+  mHead = AlignUniform(mHead + size, mAlignment);
+  passert("uniform ring frame partition overflowed\n", (mHead <= mFrameSize));
+
+  VkDeviceSize bufferOffset = GetFrameOffset(mFrame) + offset;
+  return {(u8 *)mAllocation.mMapped + bufferOffset, (u32)bufferOffset};
+}
+
+} // namespace vk
@@ -0,0 +1,56 @@
+#pragma once
+#include "common.h"
+#include "vkAllocator.hpp"
+
+#include <vulkan/vulkan.h>
+
+namespace vk
+{
+
+// One persistently mapped uniform buffer split into a partition per frame. Each frame bump allocates out of its
+// own partition, and the data is bound with a VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC offset so a single
+// descriptor set covers every frame.
+class UniformRing
+{
+  VkDevice mDevice = VK_NULL_HANDLE;
+  Allocator *mAllocator = nullptr;
+  VkBuffer mBuffer = VK_NULL_HANDLE;
+  Allocation mAllocation;
+
+  VkDeviceSize mAlignment = 1;
+  VkDeviceSize mFrameSize = 0;
+  u32 mFrameCount = 0;
+
+  u32 mFrame = 0;
+  VkDeviceSize mHead = 0;
+
+public:
+  struct Slice {
+    void *mData;
+    u32 mOffset;
+  };
+
+  UniformRing() = default;
+  UniformRing(VkPhysicalDevice physicalDevice, VkDevice device, Allocator *allocator, VkDeviceSize frameSize,
+      u32 frameCount);
+
+  void Destroy();
+
+  // resets the bump pointer to the start of the frame's partition, the GPU must be done reading it
+  void BeginFrame(u32 frame);
+
+  NODISCARD Slice Allocate(VkDeviceSize size);
+
+  template<typename T>
+  u32 Push(const T &data)
+  {
+    auto slice = Allocate(sizeof(T));
+    memcpy(slice.mData, &data, sizeof(T));
+    return slice.mOffset;
+  }
+
+  NODISCARD VkBuffer GetBuffer() const { return mBuffer; }
+  NODISCARD u32 GetFrameOffset(u32 frame) const { return (u32)(mFrameSize * frame); }
+};
+
+} // namespace vk
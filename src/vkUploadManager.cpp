@@ -0,0 +1,481 @@
+#include "vkUploadManager.hpp"
+
+#include "common.h"
+
+#include <algorithm>
+#include <cassert>
+#include <fmt/core.h>
+
+namespace vk
+{
+
+static u64 AlignStaging(u64 value, u64 alignment)
+{
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+UploadManager::UploadManager(VkDevice device, u32 transferFamily, VkQueue transferQueue, u32 graphicsFamily,
+    VkQueue graphicsQueue, Timeline *transferTimeline, Timeline *graphicsTimeline, SubmitBatch *transferSubmits,
+    SubmitBatch *graphicsSubmits, Allocator *allocator, VkDeviceSize stagingSize) :
+    mDevice(device),
+    mTransferFamily(transferFamily),
+    mTransferQueue(transferQueue),
+    mGraphicsFamily(graphicsFamily),
+    mGraphicsQueue(graphicsQueue),
+    mAllocator(allocator),
+    mTransferTimeline(transferTimeline),
+    mGraphicsTimeline(graphicsTimeline),
+    mTransferSubmits(transferSubmits),
+    mGraphicsSubmits(graphicsSubmits),
+    mStagingSize(AlignStaging(stagingSize, sStagingAlignment))
+{
+  VkCommandPoolCreateInfo poolInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+      .queueFamilyIndex = mTransferFamily,
+  };
+  if (vkCreateCommandPool(mDevice, &poolInfo, nullptr, &mCommandPool) != VK_SUCCESS) {
+    fmt::print("failed to create upload command pool\n");
+    assert(0);
+  }
+  if (!SharesGraphicsQueue()) {
+    poolInfo.queueFamilyIndex = mGraphicsFamily;
+    if (vkCreateCommandPool(mDevice, &poolInfo, nullptr, &mAcquireCommandPool) != VK_SUCCESS) {
+      fmt::print("failed to create upload acquire command pool\n");
+      assert(0);
+    }
+  }
+
+  VkBufferCreateInfo bufferInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .size = mStagingSize,
+      .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+  };
+  if (vkCreateBuffer(mDevice, &bufferInfo, nullptr, &mStagingBuffer) != VK_SUCCESS) {
+    fmt::print("failed to create staging ring buffer\n");
+    assert(0);
+  }
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(mDevice, mStagingBuffer, &requirements);
+  mStagingAllocation = mAllocator->Allocate(requirements,
+      mAllocator->FindMemoryType(requirements.memoryTypeBits,
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+      true);
+  vkBindBufferMemory(mDevice, mStagingBuffer, mStagingAllocation.mMemory, mStagingAllocation.mOffset);
+}
+
+void UploadManager::Destroy()
+{
+  Submit();
+  while (!mInFlight.empty()) {
+    WaitOldest();
+  }
+  mFreeBatches.clear();
+  // destroying the pools frees every command buffer allocated from them
+  vkDestroyCommandPool(mDevice, mCommandPool, nullptr);
+  if (mAcquireCommandPool != VK_NULL_HANDLE) {
+    vkDestroyCommandPool(mDevice, mAcquireCommandPool, nullptr);
+  }
+  vkDestroyBuffer(mDevice, mStagingBuffer, nullptr);
+  mAllocator->Free(mStagingAllocation);
+}
+
+UploadManager::StagingSlice UploadManager::Stage(const void *data, VkDeviceSize size)
+{
+  mBytesUploaded += size;
+
+  // anything bigger than half the ring would force a full drain, give it a buffer of its own instead
+  if (size > mStagingSize / 2) {
+    VkBuffer buffer;
+    VkBufferCreateInfo bufferInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    if (vkCreateBuffer(mDevice, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+      fmt::print("failed to create dedicated staging buffer\n");
+      assert(0);
+    }
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(mDevice, buffer, &requirements);
+    auto allocation = mAllocator->Allocate(requirements,
+        mAllocator->FindMemoryType(requirements.memoryTypeBits,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+        true);
+    vkBindBufferMemory(mDevice, buffer, allocation.mMemory, allocation.mOffset);
+    memcpy(allocation.mMapped, data, size);
+
+    if (!mRecording) {
+      BeginBatch();
+    }
+    mCurrent.mDedicatedStaging.push_back({buffer, allocation});
+    return {buffer, 0};
+  }
+
+  u64 offset = 0;
+  for (;;) {
+    offset = AlignStaging(mStagingHead, sStagingAlignment);
+    // never let a slice straddle the end of the ring, skip to the start instead
+    if ((offset % mStagingSize) + size > mStagingSize) {
+      offset += mStagingSize - (offset % mStagingSize);
+    }
+    if (offset + size - mStagingTail <= mStagingSize) {
+      break;
+    }
+    // out of space, the oldest in flight batch has to finish before its staging memory can be reused
+    if (!mInFlight.empty()) {
+      WaitOldest();
+    } else {
+      assert(mRecording && "staging ring full with nothing in flight");
+      Submit();
+    }
+  }
+
+  if (!mRecording) {
+    BeginBatch();
+  }
+  mStagingHead = offset + size;
+  mCurrent.mStagingEnd = mStagingHead;
+
+  VkDeviceSize physicalOffset = offset % mStagingSize;
+  memcpy((u8 *)mStagingAllocation.mMapped + physicalOffset, data, size);
+  return {mStagingBuffer, physicalOffset};
+}
+
+VkCommandBuffer UploadManager::GetCommandBuffer()
+{
+  if (!mRecording) {
+    BeginBatch();
+  }
+  return mCurrent.mCommandBuffer;
+}
+
+void UploadManager::UploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void *data, VkDeviceSize size)
+{
+  auto slice = Stage(data, size);
+  VkBufferCopy copyRegion = {
+      .srcOffset = slice.mOffset,
+      .dstOffset = dstOffset,
+      .size = size,
+  };
+  vkCmdCopyBuffer(GetCommandBuffer(), slice.mBuffer, dstBuffer, 1, &copyRegion);
+  mCurrent.mBuffers.push_back(dstBuffer);
+}
+
+void UploadManager::UploadImage(
+    VkImage image, u32 width, u32 height, const void *data, VkDeviceSize size, VkImageLayout finalLayout)
+{
+  auto slice = Stage(data, size);
+  if (!mRecording) {
+    BeginBatch();
+  }
+
+  // recorded at submit, behind one barrier for every image in the batch
+  mBarriers.Image(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      {
+          .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+          .srcAccessMask = 0,
+          .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+          .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+          .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+          .image = image,
+          .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+      });
+  mImageCopies.push_back({
+      .mBuffer = slice.mBuffer,
+      .mImage = image,
+      .mRegion =
+          {
+              .bufferOffset = slice.mOffset,
+              .bufferRowLength = 0,
+              .bufferImageHeight = 0,
+              .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+              .imageOffset = {0, 0, 0},
+              .imageExtent = {width, height, 1},
+          },
+  });
+
+  // the transition into finalLayout happens at submit, as part of the hand over to the graphics queue
+  mCurrent.mImages.push_back({image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, finalLayout, true});
+}
+
+void UploadManager::TransitionHostWrittenImage(VkImage image, VkImageLayout finalLayout)
+{
+  if (!mRecording) {
+    BeginBatch();
+  }
+  mCurrent.mImages.push_back({image, VK_IMAGE_LAYOUT_PREINITIALIZED, finalLayout, false});
+}
+
+u64 UploadManager::Submit()
+{
+  if (!mRecording) {
+    return mLastTicket;
+  }
+
+  mBarriers.Flush(mCurrent.mCommandBuffer);
+  for (const auto &copy : mImageCopies) {
+    vkCmdCopyBufferToImage(mCurrent.mCommandBuffer, copy.mBuffer, copy.mImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        1, &copy.mRegion);
+  }
+  mImageCopies.clear();
+  RecordRelease();
+  vkEndCommandBuffer(mCurrent.mCommandBuffer);
+
+  if (SharesGraphicsQueue()) {
+    mCurrent.mTicket = mGraphicsTimeline->Next();
+    mGraphicsSubmits->Add({
+        .mCommandBuffers = {mCurrent.mCommandBuffer},
+        .mSignalSemaphores = {mGraphicsTimeline->Get()},
+        .mSignalValues = {mCurrent.mTicket},
+    });
+  } else {
+    // nothing else goes to the transfer queue, there's nothing to wait for
+    u64 transferValue = mTransferTimeline->Next();
+    mTransferSubmits->Add({
+        .mCommandBuffers = {mCurrent.mCommandBuffer},
+        .mSignalSemaphores = {mTransferTimeline->Get()},
+        .mSignalValues = {transferValue},
+    });
+    mTransferSubmits->Flush();
+
+    // the ticket is the acquire's value so a completed ticket means the graphics queue owns everything in the batch
+    RecordAcquire();
+    mCurrent.mTicket = mGraphicsTimeline->Next();
+    mGraphicsSubmits->Add({
+        .mWaitSemaphores = {mTransferTimeline->Get()},
+        .mWaitValues = {transferValue},
+        .mWaitStages = {VK_PIPELINE_STAGE_ALL_COMMANDS_BIT},
+        .mCommandBuffers = {mCurrent.mAcquireCommandBuffer},
+        .mSignalSemaphores = {mGraphicsTimeline->Get()},
+        .mSignalValues = {mCurrent.mTicket},
+    });
+  }
+
+  mLastTicket = mCurrent.mTicket;
+  mInFlight.push_back(std::move(mCurrent));
+  mCurrent = {};
+  mRecording = false;
+  mBatchesSubmitted++;
+  return mLastTicket;
+}
+
+bool UploadManager::IsComplete(u64 ticket)
+{
+  Update();
+  return mGraphicsTimeline->IsComplete(ticket);
+}
+
+void UploadManager::Wait(u64 ticket)
+{
+  assert(ticket <= mLastTicket && "waiting on a batch that was never submitted");
+  // the value may only be queued, waiting on it before it reaches the GPU would never return
+  if (!mGraphicsTimeline->IsComplete(ticket)) {
+    mGraphicsSubmits->Flush();
+  }
+  mGraphicsTimeline->Wait(ticket);
+  Update();
+}
+
+void UploadManager::Update()
+{
+  while (!mInFlight.empty() && mGraphicsTimeline->IsComplete(mInFlight.front().mTicket)) {
+    Retire(&mInFlight.front());
+    mInFlight.pop_front();
+  }
+}
+
+void UploadManager::PrintStats() const
+{
+  fmt::print("UploadManager: {} batches, {} KiB uploaded\n", mBatchesSubmitted, mBytesUploaded / 1024);
+}
+
+void UploadManager::RecordRelease()
+{
+  constexpr VkAccessFlags readAccess = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT
+                                       | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+  constexpr VkPipelineStageFlags readStages =
+      VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  bool ownershipTransfer = mTransferFamily != mGraphicsFamily;
+
+  if (SharesGraphicsQueue()) {
+    // same queue, make the writes visible to later submissions and move the images into their final layout
+    constexpr VkPipelineStageFlags writeStages = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_HOST_BIT;
+    mBarriers.Memory(writeStages, readStages, VK_ACCESS_TRANSFER_WRITE_BIT, readAccess);
+    for (const auto &pending : mCurrent.mImages) {
+      mBarriers.Image(writeStages, readStages,
+          {
+              .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+              .srcAccessMask = pending.mWrittenByTransfer ? VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_HOST_WRITE_BIT,
+              .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+              .oldLayout = pending.mOldLayout,
+              .newLayout = pending.mFinalLayout,
+              .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+              .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+              .image = pending.mImage,
+              .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+          });
+    }
+    mBarriers.Flush(mCurrent.mCommandBuffer);
+    return;
+  }
+
+  if (!ownershipTransfer) {
+    // a second queue from the same family, the semaphore carries the memory dependency and the acquire
+    // command buffer does the layout transitions
+    return;
+  }
+
+  // release half of the ownership transfer, the layout transition is part of it and must match the acquire
+  constexpr VkPipelineStageFlags srcStages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  constexpr VkPipelineStageFlags dstStages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+  for (auto buffer : mCurrent.mBuffers) {
+    mBarriers.Buffer(srcStages, dstStages,
+        {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = 0,
+            .srcQueueFamilyIndex = mTransferFamily,
+            .dstQueueFamilyIndex = mGraphicsFamily,
+            .buffer = buffer,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE,
+        });
+  }
+  for (const auto &pending : mCurrent.mImages) {
+    if (!pending.mWrittenByTransfer) {
+      continue;
+    }
+    mBarriers.Image(srcStages, dstStages,
+        {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = 0,
+            .oldLayout = pending.mOldLayout,
+            .newLayout = pending.mFinalLayout,
+            .srcQueueFamilyIndex = mTransferFamily,
+            .dstQueueFamilyIndex = mGraphicsFamily,
+            .image = pending.mImage,
+            .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+        });
+  }
+  mBarriers.Flush(mCurrent.mCommandBuffer);
+}
+
+void UploadManager::RecordAcquire()
+{
+  constexpr VkAccessFlags readAccess = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT
+                                       | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+  constexpr VkPipelineStageFlags readStages =
+      VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  bool ownershipTransfer = mTransferFamily != mGraphicsFamily;
+
+  VkCommandBufferBeginInfo beginInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+  };
+  vkBeginCommandBuffer(mCurrent.mAcquireCommandBuffer, &beginInfo);
+
+  // the semaphore wait covers ALL_COMMANDS, this barrier chains it on to every later submission on the graphics
+  // queue so the first frame that reads the resources is ordered after the upload
+  constexpr VkPipelineStageFlags srcStages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+  mBarriers.Memory(srcStages, readStages, 0, readAccess);
+  if (ownershipTransfer) {
+    for (auto buffer : mCurrent.mBuffers) {
+      mBarriers.Buffer(srcStages, readStages,
+          {
+              .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+              .srcAccessMask = 0,
+              .dstAccessMask = readAccess,
+              .srcQueueFamilyIndex = mTransferFamily,
+              .dstQueueFamilyIndex = mGraphicsFamily,
+              .buffer = buffer,
+              .offset = 0,
+              .size = VK_WHOLE_SIZE,
+          });
+    }
+  }
+  for (const auto &pending : mCurrent.mImages) {
+    // host writes are made visible by the submission itself, only the layout transition is left to do
+    bool acquire = ownershipTransfer && pending.mWrittenByTransfer;
+    mBarriers.Image(srcStages, readStages,
+        {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = 0,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .oldLayout = pending.mOldLayout,
+            .newLayout = pending.mFinalLayout,
+            .srcQueueFamilyIndex = acquire ? mTransferFamily : VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = acquire ? mGraphicsFamily : VK_QUEUE_FAMILY_IGNORED,
+            .image = pending.mImage,
+            .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+        });
+  }
+  mBarriers.Flush(mCurrent.mAcquireCommandBuffer);
+  vkEndCommandBuffer(mCurrent.mAcquireCommandBuffer);
+}
+
+void UploadManager::BeginBatch()
+{
+  assert(!mRecording);
+  if (!mFreeBatches.empty()) {
+    mCurrent = std::move(mFreeBatches.back());
+    mFreeBatches.pop_back();
+  } else {
+    VkCommandBufferAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = mCommandPool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    vkAllocateCommandBuffers(mDevice, &allocInfo, &mCurrent.mCommandBuffer);
+    if (!SharesGraphicsQueue()) {
+      allocInfo.commandPool = mAcquireCommandPool;
+      vkAllocateCommandBuffers(mDevice, &allocInfo, &mCurrent.mAcquireCommandBuffer);
+    }
+  }
+  mCurrent.mStagingEnd = mStagingHead;
+
+  VkCommandBufferBeginInfo beginInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+  };
+  vkBeginCommandBuffer(mCurrent.mCommandBuffer, &beginInfo);
+  mRecording = true;
+}
+
+void UploadManager::Retire(Batch *batch)
+{
+  mStagingTail = std::max(mStagingTail, batch->mStagingEnd);
+  for (auto &[buffer, allocation] : batch->mDedicatedStaging) {
+    vkDestroyBuffer(mDevice, buffer, nullptr);
+    mAllocator->Free(allocation);
+  }
+  batch->mDedicatedStaging.clear();
+  batch->mBuffers.clear();
+  batch->mImages.clear();
+  vkResetCommandBuffer(batch->mCommandBuffer, 0);
+  if (batch->mAcquireCommandBuffer != VK_NULL_HANDLE) {
+    vkResetCommandBuffer(batch->mAcquireCommandBuffer, 0);
+  }
+  batch->mTicket = 0;
+  mFreeBatches.push_back(std::move(*batch));
+}
+
+void UploadManager::WaitOldest()
+{
+  assert(!mInFlight.empty());
+  auto &batch = mInFlight.front();
+  if (!mGraphicsTimeline->IsComplete(batch.mTicket)) {
+    mGraphicsSubmits->Flush();
+  }
+  mGraphicsTimeline->Wait(batch.mTicket);
+  Retire(&batch);
+  mInFlight.pop_front();
+}
+
+} // namespace vk
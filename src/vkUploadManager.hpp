@@ -0,0 +1,147 @@
+#pragma once
+#include "common.h"
+#include "vkAllocator.hpp"
+#include "vkSync.hpp"
+#include "vkTimeline.hpp"
+
+#include <deque>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace vk
+{
+
+// Records copies and layout transitions into one command buffer at a time, staging the source data through a
+// persistently mapped ring buffer. Submit() flushes the batch and hands back a ticket that callers can poll or wait
+// on, staging space is reclaimed once the batch that used it has completed.
+//
+// Uploads run on the transfer queue. When that is a different queue from the graphics queue the batch signals the
+// transfer timeline, and a small acquire command buffer on the graphics queue waits for that value before anything
+// can read the uploaded resources. If the queues are from different families the resources are released and
+// acquired with queue family ownership transfer barriers.
+//
+// Either way the batch ends on the graphics queue, so a ticket is the graphics timeline value of its last submission
+// and frames can order themselves after an upload with a plain value comparison. What goes to the graphics queue is
+// only queued on its SubmitBatch and rides along with the next frame's submit, Wait() flushes it when it can't wait
+// that long.
+//
+// Image copies are deferred to Submit() so the layout transitions in front of them go out as one barrier for the
+// whole batch rather than one per image.
+class UploadManager
+{
+  static constexpr VkDeviceSize sDefaultStagingSize = 32ull * 1024 * 1024;
+  static constexpr VkDeviceSize sStagingAlignment = 16;
+
+  struct PendingImage {
+    VkImage mImage;
+    VkImageLayout mOldLayout;
+    VkImageLayout mFinalLayout;
+    // false for images the CPU wrote directly, they were never touched by the transfer queue so they don't need
+    // releasing from it
+    bool mWrittenByTransfer;
+  };
+
+  struct PendingCopy {
+    VkBuffer mBuffer;
+    VkImage mImage;
+    VkBufferImageCopy mRegion;
+  };
+
+  struct Batch {
+    VkCommandBuffer mCommandBuffer = VK_NULL_HANDLE;
+    // only used when the transfer and graphics queues differ
+    VkCommandBuffer mAcquireCommandBuffer = VK_NULL_HANDLE;
+    // graphics timeline value the batch completes at
+    u64 mTicket = 0;
+    // virtual end of the staging ring used by this batch, the ring tail moves here when the batch retires
+    u64 mStagingEnd = 0;
+    // uploads that didn't fit in the ring get their own buffer, freed when the batch retires
+    std::vector<std::pair<VkBuffer, Allocation>> mDedicatedStaging;
+    // resources written by the batch that need handing over to the graphics queue
+    std::vector<VkBuffer> mBuffers;
+    std::vector<PendingImage> mImages;
+  };
+
+  VkDevice mDevice = VK_NULL_HANDLE;
+  u32 mTransferFamily = 0;
+  VkQueue mTransferQueue = VK_NULL_HANDLE;
+  u32 mGraphicsFamily = 0;
+  VkQueue mGraphicsQueue = VK_NULL_HANDLE;
+  Allocator *mAllocator = nullptr;
+  // the same timeline when the two queues are the same
+  Timeline *mTransferTimeline = nullptr;
+  Timeline *mGraphicsTimeline = nullptr;
+  // the same batch when the two queues are the same
+  SubmitBatch *mTransferSubmits = nullptr;
+  SubmitBatch *mGraphicsSubmits = nullptr;
+  VkCommandPool mCommandPool = VK_NULL_HANDLE;
+  VkCommandPool mAcquireCommandPool = VK_NULL_HANDLE;
+
+  VkBuffer mStagingBuffer = VK_NULL_HANDLE;
+  Allocation mStagingAllocation;
+  VkDeviceSize mStagingSize = 0;
+  // virtual offsets that only ever grow, the physical offset is the virtual one modulo mStagingSize
+  u64 mStagingHead = 0;
+  u64 mStagingTail = 0;
+
+  bool mRecording = false;
+  Batch mCurrent;
+  // image copies of the batch being recorded and the transitions they wait on
+  BarrierBatch mBarriers;
+  std::vector<PendingCopy> mImageCopies;
+  std::deque<Batch> mInFlight;
+  std::vector<Batch> mFreeBatches;
+
+  u64 mLastTicket = 0;
+
+  u64 mBatchesSubmitted = 0;
+  u64 mBytesUploaded = 0;
+
+public:
+  struct StagingSlice {
+    VkBuffer mBuffer;
+    VkDeviceSize mOffset;
+  };
+
+  UploadManager() = default;
+  UploadManager(VkDevice device, u32 transferFamily, VkQueue transferQueue, u32 graphicsFamily,
+      VkQueue graphicsQueue, Timeline *transferTimeline, Timeline *graphicsTimeline, SubmitBatch *transferSubmits,
+      SubmitBatch *graphicsSubmits, Allocator *allocator, VkDeviceSize stagingSize = sDefaultStagingSize);
+
+  // waits for every outstanding batch before tearing down
+  void Destroy();
+
+  // copies data into staging memory that stays alive until the current batch completes
+  NODISCARD StagingSlice Stage(const void *data, VkDeviceSize size);
+  // the command buffer of the batch currently being recorded, begins a new batch if needed. It runs on the transfer
+  // queue so only transfer commands can be recorded into it. Image uploads are recorded after anything in here.
+  NODISCARD VkCommandBuffer GetCommandBuffer();
+
+  void UploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void *data, VkDeviceSize size);
+  // uploads the first mip of a 2D colour image and leaves it in finalLayout for the graphics queue
+  void UploadImage(VkImage image, u32 width, u32 height, const void *data, VkDeviceSize size,
+      VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  // moves a linear image the CPU wrote in place out of VK_IMAGE_LAYOUT_PREINITIALIZED along with the next batch
+  void TransitionHostWrittenImage(VkImage image, VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+  // submits the current batch, returns the ticket of the last submitted batch if nothing was recorded. Tickets are
+  // graphics timeline values.
+  u64 Submit();
+  NODISCARD bool IsComplete(u64 ticket);
+  // flushes the graphics SubmitBatch if the ticket is still queued on it
+  void Wait(u64 ticket);
+  // retires finished batches without blocking, call once per frame
+  void Update();
+
+  void PrintStats() const;
+
+private:
+  NODISCARD bool SharesGraphicsQueue() const { return mTransferQueue == mGraphicsQueue; }
+  void RecordRelease();
+  void RecordAcquire();
+  void BeginBatch();
+  void Retire(Batch *batch);
+  void WaitOldest();
+};
+
+} // namespace vk